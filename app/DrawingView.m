@@ -38,6 +38,9 @@
 @implementation DrawingView
 {
     lua_State * L;
+    BFDisplayListRef displayList;
+    NSRect displayListBounds;
+    CGFloat displayListBackingScale;
 }
 
 - (instancetype)initWithCoder:(NSCoder *)coder
@@ -64,21 +67,30 @@
 
 - (void)dealloc
 {
+    BFRelease(displayList);
     lua_close(L);
 }
 
+- (void)invalidateDisplayList
+{
+    BFRelease(displayList);
+    displayList = NULL;
+}
+
 - (void)setDrawingScriptString:(NSString *)drawingScriptString
 {
     // Load a Lua script defining a global `draw` function. (We could just call
     // `luaL_dostring` here, but the blank name will make parsing error messages easier.)
+    // Scripts that have been loaded before are reused from the chunk cache without parsing.
     const char * cstring = [drawingScriptString UTF8String];
-    if (luaL_loadbuffer(L, cstring, strlen(cstring), "") || lua_pcall(L, 0, LUA_MULTRET, 0)) {
+    if (bf_lua_loadcachedbuffer(L, cstring, strlen(cstring), "") || lua_pcall(L, 0, LUA_MULTRET, 0)) {
         self.scriptIsValid = NO;
         [self handleError:[NSString stringWithUTF8String:lua_tostring(L, -1)]];
         lua_pop(L, 1);
     } else {
         self.scriptIsValid = YES;
     }
+    [self invalidateDisplayList];
     [self setNeedsDisplay:YES];
 }
 
@@ -88,28 +100,54 @@
         return;
     }
 
-    // Push the drawing function onto the stack.
-    lua_getglobal(L, "draw");
-    if (lua_isnil(L, -1)) {
-        lua_pop(L, 1);
-        return;
+    NSRect viewBounds = [self bounds];
+    CGFloat backingScale = [self.window.screen backingScaleFactor];
+    if (!displayList || !NSEqualRects(viewBounds, displayListBounds) || backingScale != displayListBackingScale) {
+        [self invalidateDisplayList];
+        if (![self recordDisplayListWithBounds:viewBounds backingScale:backingScale]) {
+            return;
+        }
     }
 
     // Get the Quartz graphics context for the canvas to use.
     CGContextRef context = [[NSGraphicsContext currentContext] graphicsPort];
 
+    // Replay the recorded drawing commands into a display canvas. Commands falling entirely
+    // outside the dirty rect are skipped, so partial redraws don't pay for the whole script.
+    BFCanvasMetricsRef canvasMetrics = [self newCanvasMetricsWithBounds:viewBounds backingScale:backingScale];
+    BFCanvasRef canvas = BFCanvasCreateForDisplay(context, canvasMetrics);
+    BFRelease(canvasMetrics);
+    BFCanvasSetDirtyRect(canvas, (BFRect){ .left = NSMinX(dirtyRect), .bottom = NSMinY(dirtyRect), .right = NSMaxX(dirtyRect), .top = NSMaxY(dirtyRect) });
+    BFDisplayListReplay(displayList, canvas);
+    BFRelease(canvas);
+    [self didDraw];
+}
+
+- (BFCanvasMetricsRef)newCanvasMetricsWithBounds:(NSRect)viewBounds backingScale:(CGFloat)backingScale
+{
     // Create the metrics object for the canvas.
     // These functions follow the same naming conventions as Core Foundation, namely the
     // Create Rule and the Get Rule. This means that when we call `BFCanvasMetricsCreate`
     // below, we own the returned object and are responsible for releasing it.
-    NSRect viewBounds = [self bounds];
     BFRect bounds = { .left = NSMinX(viewBounds), .bottom = NSMinY(viewBounds), .right = NSMaxX(viewBounds), .top = NSMaxY(viewBounds) };
-    CGFloat backingScale = [self.window.screen backingScaleFactor];
-    BFCanvasMetricsRef canvasMetrics = BFCanvasMetricsCreate(bounds, backingScale, 1);
+    return BFCanvasMetricsCreate(bounds, backingScale, 1);
+}
 
-    // Create the canvas object for the Lua scripts to draw into.
-    // As above with the canvas metrics, we own the object returned by `BFCanvasCreateForDisplay`.
-    BFCanvasRef canvas = BFCanvasCreateForDisplay(context, canvasMetrics);
+- (BOOL)recordDisplayListWithBounds:(NSRect)viewBounds backingScale:(CGFloat)backingScale
+{
+    // Push the drawing function onto the stack.
+    lua_getglobal(L, "draw");
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return NO;
+    }
+
+    BFCanvasMetricsRef canvasMetrics = [self newCanvasMetricsWithBounds:viewBounds backingScale:backingScale];
+
+    // Create a recording canvas for the Lua scripts to draw into. The script only runs again
+    // when it changes or the view is resized; other redraws replay what it recorded.
+    // As above with the canvas metrics, we own the object returned by `BFCanvasCreateForRecording`.
+    BFCanvasRef canvas = BFCanvasCreateForRecording(canvasMetrics);
 
     // Now that we've given `canvasMetrics` to the canvas object, we no longer need it here
     // and it's safe to release.
@@ -119,17 +157,22 @@
     // on behalf of the Lua state.
     bf_lua_push(L, canvas, BFCanvasClassName);
 
-    // Now that the canvas userdata is in the Lua state, `canvas` is safe for us to release.
-    // The object will live until Lua's garbage collector collects the userdata.
-    BFRelease(canvas);
-
     // Call the drawing function. One argument (`canvas`), zero return values.
+    BOOL success = NO;
     if (lua_pcall(L, 1, 0, 0)) {
         [self handleError:[NSString stringWithUTF8String:lua_tostring(L, -1)]];
         lua_pop(L, 1);
     } else {
-        [self didDraw];
+        displayList = BFCanvasTakeDisplayList(canvas);
+        displayListBounds = viewBounds;
+        displayListBackingScale = backingScale;
+        success = YES;
     }
+
+    // We kept our reference to `canvas` to collect its display list; the userdata in the
+    // Lua state holds its own until the garbage collector collects it.
+    BFRelease(canvas);
+    return success;
 }
 
 - (void)didDraw
@@ -26,9 +26,17 @@
 
 #include "butterfly.h"
 
+typedef struct BFLuaUserdata {
+    void * object;
+    const BFLuaClass * luaClass;
+    const void * tag;
+} BFLuaUserdata;
+
+static const char bf_lua_userdataTag = 0;
+
 static int bf_lua_retain(lua_State * L);
 static int bf_lua_release(lua_State * L);
-static void * bf_lua_tryuserdata(lua_State * L, int narg, const char * tname);
+static BFLuaUserdata * bf_lua_tryuserdata(lua_State * L, int narg, const char * tname);
 
 void bf_lua_loadmodule(lua_State * L, const BFLuaClass * luaLibrary, const BFLuaClass * luaClass) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
@@ -63,12 +71,25 @@ void bf_lua_loadclass(lua_State * L, const BFLuaClass * luaClass) {
         luaL_getmetatable(L, luaClass->superClass->metatableName);
         lua_setmetatable(L, -2);
     }
-    lua_pushcfunction(L, &bf_lua_retain);
-    lua_setfield(L, -2, "_ref");
-    lua_pushcfunction(L, &bf_lua_release);
-    lua_setfield(L, -2, "__gc");
-    lua_pushvalue(L, -1);
-    lua_setfield(L, -2, "__index");
+    if (!luaClass->isValueType) {
+        if (luaClass->metatableName) {
+            lua_pushlightuserdata(L, (void *)luaClass);
+            lua_setfield(L, -2, "_class");
+        }
+        lua_pushcfunction(L, &bf_lua_retain);
+        lua_setfield(L, -2, "_ref");
+        lua_pushcfunction(L, &bf_lua_release);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pushliteral(L, "__index");
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+    } else {
+        lua_pop(L, 1);
+    }
 }
 
 static int bf_lua_retain(lua_State * L) {
@@ -85,45 +106,88 @@ static int bf_lua_release(lua_State * L) {
     return 0;
 }
 
-static void * bf_lua_tryuserdata(lua_State * L, int narg, const char * tname) {
-    void ** userdata = lua_touserdata(L, narg);
-    if (userdata) {
-        lua_pushvalue(L, narg);
-        lua_getfield(L, LUA_REGISTRYINDEX, tname);
-        lua_pushvalue(L, -2);
-        int mtcount = 0;
-        while (lua_getmetatable(L, -1)) {
-            mtcount++;
-            if (lua_rawequal(L, -1, -2 - mtcount)) {
-                lua_pop(L, 3 + mtcount);
-                return *userdata;
+static BFLuaUserdata * bf_lua_tryuserdata(lua_State * L, int narg, const char * tname) {
+    BFLuaUserdata * userdata = lua_touserdata(L, narg);
+    if (!userdata) {
+        return NULL;
+    }
+    
+    // Userdata pushed by bf_lua_push carries its class, so checking the type is just a walk up the class chain.
+    // Class names are usually the same string literal, so the pointer comparison almost always decides it.
+    if (lua_type(L, narg) == LUA_TUSERDATA && lua_objlen(L, narg) == sizeof(BFLuaUserdata) && userdata->tag == &bf_lua_userdataTag && userdata->luaClass) {
+        for (const BFLuaClass * luaClass = userdata->luaClass; luaClass; luaClass = luaClass->superClass) {
+            if (luaClass->metatableName == tname || strcmp(luaClass->metatableName, tname) == 0) {
+                return userdata;
             }
         }
-        lua_pop(L, 3 + mtcount);
+        return NULL;
+    }
+    
+    lua_pushvalue(L, narg);
+    lua_getfield(L, LUA_REGISTRYINDEX, tname);
+    lua_pushvalue(L, -2);
+    int mtcount = 0;
+    while (lua_getmetatable(L, -1)) {
+        mtcount++;
+        if (lua_rawequal(L, -1, -2 - mtcount)) {
+            lua_pop(L, 3 + mtcount);
+            return userdata;
+        }
     }
+    lua_pop(L, 3 + mtcount);
     return NULL;
 }
 
+void * bf_lua_checkuserdata(lua_State * L, int narg, const char * tname) {
+    BFLuaUserdata * userdata = bf_lua_tryuserdata(L, narg, tname);
+    if (!userdata) {
+        luaL_typerror(L, narg, tname);
+        return NULL;
+    }
+    return userdata->object;
+}
+
+void * bf_lua_checkmutableuserdata(lua_State * L, int narg, const char * tname) {
+    // Setters leave immutable objects unchanged, so scripts get an error instead of a silent no-op.
+    void * object = bf_lua_checkuserdata(L, narg, tname);
+    luaL_argcheck(L, !BFIsImmutable(object), narg, "object is immutable");
+    return object;
+}
+
+void * bf_lua_testuserdata(lua_State * L, int narg, const char * tname) {
+    BFLuaUserdata * userdata = bf_lua_tryuserdata(L, narg, tname);
+    return (userdata ? userdata->object : NULL);
+}
+
 void * bf_lua_getoptionaluserdata(lua_State * L, int narg, const char * tname) {
     if (!lua_toboolean(L, narg)) {
         return NULL;
     }
-    void * result = bf_lua_tryuserdata(L, narg, tname);
-    if (!result) {
+    BFLuaUserdata * userdata = bf_lua_tryuserdata(L, narg, tname);
+    if (!userdata || !userdata->object) {
         luaL_typerror(L, narg, tname);
+        return NULL;
     }
-    return result;
+    return userdata->object;
 }
 
 void bf_lua_push(lua_State * L, void * data, const char * tname) {
-    void ** userdata = (void **)lua_newuserdata(L, sizeof(void *));
-    *userdata = data;
+    BFLuaUserdata * userdata = lua_newuserdata(L, sizeof(BFLuaUserdata));
+    userdata->object = data;
+    userdata->luaClass = NULL;
+    userdata->tag = &bf_lua_userdataTag;
     if (tname) {
         luaL_getmetatable(L, tname);
         lua_pushvalue(L, -1);
         lua_setmetatable(L, -3);
+        lua_getfield(L, -1, "_class");
+        userdata->luaClass = lua_touserdata(L, -1);
+        lua_pop(L, 1); /* _class */
         lua_getfield(L, -1, "_ref");
-        if (lua_isfunction(L, -1)) {
+        if (lua_tocfunction(L, -1) == &bf_lua_retain) {
+            lua_pop(L, 1); /* _ref */
+            BFRetain(data);
+        } else if (lua_isfunction(L, -1)) {
             lua_pushvalue(L, -3);
             if (lua_pcall(L, 1, 0, 0)) {
                 lua_pop(L, 1); /* error */
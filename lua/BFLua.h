@@ -29,20 +29,29 @@
 #include <lualib.h>
 #include <lauxlib.h>
 
+#include "butterfly.h"
+
 #define BF_LUA_DEBUG_STACK 1
 
 typedef struct BFLuaClass {
     char * metatableName;
     char * libraryName;
     const struct BFLuaClass * superClass;
+    int isValueType;
     struct luaL_Reg methods [];
 } BFLuaClass;
 
 void bf_lua_loadmodule(lua_State * L, const BFLuaClass * luaLibrary, const BFLuaClass * luaClass);
 void bf_lua_loadclass(lua_State * L, const BFLuaClass * luaClass);
 
+void * bf_lua_checkuserdata(lua_State * L, int narg, const char * tname);
+void * bf_lua_checkmutableuserdata(lua_State * L, int narg, const char * tname);
+void * bf_lua_testuserdata(lua_State * L, int narg, const char * tname);
 void * bf_lua_getoptionaluserdata(lua_State * L, int narg, const char * tname);
 
+int bf_lua_getrect(lua_State * L, int narg, BFRect * rect);
+int bf_lua_getpoint(lua_State * L, int narg, BFPoint * point);
+
 #if BF_LUA_DEBUG_STACK
 #define BF_LUA_DEBUG_STACK_BEGIN(L) int _top1 = lua_gettop(L); int _top2;
 #define BF_LUA_DEBUG_STACK_ENDR(L, ret) _top2 = lua_gettop(L) - ret; \
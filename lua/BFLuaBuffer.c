@@ -0,0 +1,160 @@
+//
+//  BFLuaBuffer.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include "lua.h"
+#include "BFLua.h"
+
+#include "butterfly.h"
+
+static int new(lua_State * L);
+static int fromTable(lua_State * L);
+
+static int getValue(lua_State * L);
+static int setValue(lua_State * L);
+static int count(lua_State * L);
+
+static const BFLuaClass luaBufferLibrary = {
+    .libraryName = "Buffer",
+    .methods = {
+        {"new", new},
+        {"fromTable", fromTable},
+        {NULL, NULL}
+    }
+};
+
+static const BFLuaClass luaBufferClass = {
+    .metatableName = BFBufferClassName,
+    .methods = {
+        {"__index", getValue},
+        {"__newindex", setValue},
+        {"__len", count},
+        {"count", count},
+        {NULL, NULL}
+    }
+};
+
+// Global functions
+
+int bf_lua_loadBuffer(lua_State * L) {
+    bf_lua_loadmodule(L, &luaBufferLibrary, &luaBufferClass);
+    return 0;
+}
+
+// Local functions
+
+static BFBufferType getType(lua_State * L, int narg) {
+    static const char * const typeNames[] = { "double", "float", NULL };
+    static const BFBufferType types[] = { kBFBufferTypeDouble, kBFBufferTypeFloat };
+    return types[luaL_checkoption(L, narg, "double", typeNames)];
+}
+
+static int new(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    lua_Integer count = luaL_checkinteger(L, 1);
+    BFBufferType type = getType(L, 2);
+    BFBufferRef buffer;
+    
+    luaL_argcheck(L, count >= 0, 1, "count must not be negative");
+    
+    buffer = BFBufferCreate(type, (size_t)count);
+    if (!buffer) {
+        return luaL_error(L, "not enough memory");
+    }
+    bf_lua_push(L, buffer, BFBufferClassName);
+    BFRelease(buffer);
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int fromTable(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFBufferType type = getType(L, 2);
+    BFBufferRef buffer;
+    size_t index, count;
+    
+    luaL_checktype(L, 1, LUA_TTABLE);
+    count = lua_objlen(L, 1);
+    
+    buffer = BFBufferCreate(type, count);
+    if (!buffer) {
+        return luaL_error(L, "not enough memory");
+    }
+    bf_lua_push(L, buffer, BFBufferClassName);
+    BFRelease(buffer);
+    for (index = 0; index < count; index++) {
+        lua_rawgeti(L, 1, (int)index + 1);
+        BFBufferSetValue(buffer, index, lua_tonumber(L, -1));
+        lua_pop(L, 1);
+    }
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int getValue(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFBufferRef buffer = bf_lua_checkuserdata(L, 1, BFBufferClassName);
+    
+    // Numeric keys index the values from 1, like a Lua array; anything else looks up a method.
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Integer index = lua_tointeger(L, 2);
+        if (index >= 1 && (size_t)index <= BFBufferGetCount(buffer)) {
+            lua_pushnumber(L, BFBufferGetValue(buffer, (size_t)index - 1));
+        } else {
+            lua_pushnil(L);
+        }
+    } else {
+        lua_getmetatable(L, 1);
+        lua_pushvalue(L, 2);
+        lua_rawget(L, -2);
+        lua_remove(L, -2);
+    }
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int setValue(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFBufferRef buffer = bf_lua_checkuserdata(L, 1, BFBufferClassName);
+    lua_Integer index = luaL_checkinteger(L, 2);
+    double value = luaL_checknumber(L, 3);
+    
+    luaL_argcheck(L, index >= 1 && (size_t)index <= BFBufferGetCount(buffer), 2, "index out of range");
+    
+    BFBufferSetValue(buffer, (size_t)index - 1, value);
+    
+    BF_LUA_DEBUG_STACK_END(L);
+    return 0;
+}
+
+static int count(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFBufferRef buffer = bf_lua_checkuserdata(L, 1, BFBufferClassName);
+    
+    BF_LUA_DEBUG_STACK_END(L);
+    lua_pushnumber(L, BFBufferGetCount(buffer));
+    return 1;
+}
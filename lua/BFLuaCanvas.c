@@ -33,6 +33,9 @@ static int drawText(lua_State * L);
 static int strokeText(lua_State * L);
 static int drawIcon(lua_State * L);
 static int clipIcon(lua_State * L);
+static int fillRects(lua_State * L);
+static int fillPaths(lua_State * L);
+static int drawInstances(lua_State * L);
 static int setOpacity(lua_State * L);
 static int setPaint(lua_State * L);
 static int setPaintMode(lua_State * L);
@@ -43,8 +46,11 @@ static int concatTransformation(lua_State * L);
 static int clipRect(lua_State * L);
 static int clipPath(lua_State * L);
 static int preserveState(lua_State * L);
+static int record(lua_State * L);
+static int replay(lua_State * L);
 static int isHitTest(lua_State * L);
 static int test(lua_State * L);
+static int hitPoints(lua_State * L);
 static int metrics(lua_State * L);
 static int dirtyRect(lua_State * L);
 
@@ -57,6 +63,9 @@ static const BFLuaClass luaCanvasClass = {
         {"strokeText", strokeText},
         {"drawIcon", drawIcon},
         {"clipIcon", clipIcon},
+        {"fillRects", fillRects},
+        {"fillPaths", fillPaths},
+        {"drawInstances", drawInstances},
         {"setOpacity", setOpacity},
         {"setPaint", setPaint},
         {"setPaintMode", setPaintMode},
@@ -67,8 +76,11 @@ static const BFLuaClass luaCanvasClass = {
         {"clipRect", clipRect},
         {"clip", clipPath},
         {"preserve", preserveState},
+        {"record", record},
+        {"replay", replay},
         {"isHitTest", isHitTest},
         {"test", test},
+        {"hitPoints", hitPoints},
         {"metrics", metrics},
         {"dirtyRect", dirtyRect},
         {NULL, NULL}
@@ -86,7 +98,7 @@ int bf_lua_loadCanvas(lua_State * L) {
 
 static int stroke(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFPathRef path = bf_lua_getoptionaluserdata(L, 2, BFPathClassName);
 
     if (path) {
@@ -100,7 +112,7 @@ static int stroke(lua_State * L) {
 
 static int fill(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFPathRef path = bf_lua_getoptionaluserdata(L, 2, BFPathClassName);
 
     if (path) {
@@ -114,14 +126,14 @@ static int fill(lua_State * L) {
 
 static int drawText(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFStyledStringRef styledString = NULL;
     double x = luaL_checknumber(L, 3);
     double y = luaL_checknumber(L, 4);
     double alignment = lua_tonumber(L, 5);
 
     if (lua_isuserdata(L, 2)) {
-        styledString = *(BFStyledStringRef *)luaL_checkudata(L, 2, BFStyledStringClassName);
+        styledString = bf_lua_checkuserdata(L, 2, BFStyledStringClassName);
         BFRetain(styledString); /* not necessary, but allows us to avoid an if-check on the release below. */
     } else {
         const char * cstring = lua_tostring(L, 2);
@@ -141,14 +153,14 @@ static int drawText(lua_State * L) {
 
 static int strokeText(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFStyledStringRef styledString = NULL;
     double x = luaL_checknumber(L, 3);
     double y = luaL_checknumber(L, 4);
     double alignment = lua_tonumber(L, 5);
 
     if (lua_isuserdata(L, 2)) {
-        styledString = *(BFStyledStringRef *)luaL_checkudata(L, 2, BFStyledStringClassName);
+        styledString = bf_lua_checkuserdata(L, 2, BFStyledStringClassName);
         BFRetain(styledString); /* not necessary, but allows us to avoid an if-check on the release below. */
     } else {
         const char * cstring = lua_tostring(L, 2);
@@ -168,24 +180,13 @@ static int strokeText(lua_State * L) {
 
 static int drawIcon(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFIconRef icon = bf_lua_getoptionaluserdata(L, 2, BFIconClassName);
 
     if (icon) {
         BFRect rect;
 
-        lua_getfield(L, 3, "left");
-        rect.left = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 3, "bottom");
-        rect.bottom = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 3, "right");
-        rect.right = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 3, "top");
-        rect.top = lua_tonumber(L, -1);
-        lua_pop(L, 1);
+        bf_lua_getrect(L, 3, &rect);
 
         BFCanvasDrawIcon(canvas, icon, rect);
     }
@@ -197,27 +198,146 @@ static int drawIcon(lua_State * L) {
 
 static int clipIcon(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFIconRef icon = bf_lua_getoptionaluserdata(L, 2, BFIconClassName);
 
     if (icon) {
         BFRect rect;
 
-        lua_getfield(L, 3, "left");
-        rect.left = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 3, "bottom");
-        rect.bottom = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 3, "right");
-        rect.right = lua_tonumber(L, -1);
+        bf_lua_getrect(L, 3, &rect);
+
+        BFCanvasClipIcon(canvas, icon, rect);
+    }
+
+    BF_LUA_DEBUG_STACK_END(L);
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+static double getArrayNumber(lua_State * L, int narg, size_t index) {
+    lua_rawgeti(L, narg, (int)index);
+    double value = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return value;
+}
+
+static int fillRects(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    size_t index, count;
+    bool packed;
+
+    // Either a buffer or packed array of left, bottom, right, top numbers, or an array of rects.
+    BFBufferRef buffer = bf_lua_testuserdata(L, 2, BFBufferClassName);
+    if (buffer) {
+        packed = true;
+        count = BFBufferGetCount(buffer) / 4;
+    } else {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_rawgeti(L, 2, 1);
+        packed = (lua_type(L, -1) == LUA_TNUMBER);
         lua_pop(L, 1);
-        lua_getfield(L, 3, "top");
-        rect.top = lua_tonumber(L, -1);
+        count = (packed ? lua_objlen(L, 2) / 4 : lua_objlen(L, 2));
+    }
+
+    // Scratch arrays are Lua userdata, so nothing leaks if an element raises an error.
+    BFRect * rects = lua_newuserdata(L, count * sizeof(BFRect));
+    for (index = 0; index < count; index++) {
+        if (buffer) {
+            rects[index].left = BFBufferGetValue(buffer, index * 4);
+            rects[index].bottom = BFBufferGetValue(buffer, index * 4 + 1);
+            rects[index].right = BFBufferGetValue(buffer, index * 4 + 2);
+            rects[index].top = BFBufferGetValue(buffer, index * 4 + 3);
+        } else if (packed) {
+            rects[index].left = getArrayNumber(L, 2, index * 4 + 1);
+            rects[index].bottom = getArrayNumber(L, 2, index * 4 + 2);
+            rects[index].right = getArrayNumber(L, 2, index * 4 + 3);
+            rects[index].top = getArrayNumber(L, 2, index * 4 + 4);
+        } else {
+            lua_rawgeti(L, 2, (int)index + 1);
+            bf_lua_getrect(L, lua_gettop(L), &rects[index]);
+            lua_pop(L, 1);
+        }
+    }
+
+    BFCanvasFillRects(canvas, rects, count);
+    lua_pop(L, 1); /* rects */
+
+    BF_LUA_DEBUG_STACK_END(L);
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+static int fillPaths(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    bool hasTransformations = lua_toboolean(L, 3);
+    size_t index, count;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (hasTransformations) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+    }
+    count = lua_objlen(L, 2);
+
+    BFPathRef * paths = lua_newuserdata(L, count * sizeof(BFPathRef));
+    BFTransformationRef * transformations = (hasTransformations ? lua_newuserdata(L, count * sizeof(BFTransformationRef)) : NULL);
+    for (index = 0; index < count; index++) {
+        lua_rawgeti(L, 2, (int)index + 1);
+        paths[index] = bf_lua_checkuserdata(L, lua_gettop(L), BFPathClassName);
         lua_pop(L, 1);
+        if (hasTransformations) {
+            lua_rawgeti(L, 3, (int)index + 1);
+            transformations[index] = bf_lua_getoptionaluserdata(L, lua_gettop(L), BFTransformationClassName);
+            lua_pop(L, 1);
+        }
+    }
 
-        BFCanvasClipIcon(canvas, icon, rect);
+    BFCanvasFillPaths(canvas, paths, transformations, count);
+    lua_pop(L, (hasTransformations ? 2 : 1)); /* paths, transformations */
+
+    BF_LUA_DEBUG_STACK_END(L);
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+static int drawInstances(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    BFPathRef path = bf_lua_checkuserdata(L, 2, BFPathClassName);
+    bool hasPaints = lua_toboolean(L, 5);
+    size_t index, count;
+
+    BFBufferRef xs = bf_lua_testuserdata(L, 3, BFBufferClassName);
+    BFBufferRef ys = bf_lua_testuserdata(L, 4, BFBufferClassName);
+    if (!xs) {
+        luaL_checktype(L, 3, LUA_TTABLE);
     }
+    if (!ys) {
+        luaL_checktype(L, 4, LUA_TTABLE);
+    }
+    if (hasPaints) {
+        luaL_checktype(L, 5, LUA_TTABLE);
+    }
+    count = (xs ? BFBufferGetCount(xs) : lua_objlen(L, 3));
+    if ((ys ? BFBufferGetCount(ys) : lua_objlen(L, 4)) < count) {
+        count = (ys ? BFBufferGetCount(ys) : lua_objlen(L, 4));
+    }
+
+    BFPoint * points = lua_newuserdata(L, count * sizeof(BFPoint));
+    BFPaintRef * paints = (hasPaints ? lua_newuserdata(L, count * sizeof(BFPaintRef)) : NULL);
+    for (index = 0; index < count; index++) {
+        points[index].x = (xs ? BFBufferGetValue(xs, index) : getArrayNumber(L, 3, index + 1));
+        points[index].y = (ys ? BFBufferGetValue(ys, index) : getArrayNumber(L, 4, index + 1));
+        if (hasPaints) {
+            lua_rawgeti(L, 5, (int)index + 1);
+            paints[index] = bf_lua_checkuserdata(L, lua_gettop(L), BFPaintClassName);
+            lua_pop(L, 1);
+        }
+    }
+
+    BFCanvasDrawInstances(canvas, path, points, paints, count);
+    lua_pop(L, (hasPaints ? 2 : 1)); /* points, paints */
 
     BF_LUA_DEBUG_STACK_END(L);
     lua_pushvalue(L, 1);
@@ -226,7 +346,7 @@ static int clipIcon(lua_State * L) {
 
 static int setOpacity(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     double opacity = lua_tonumber(L, 2);
 
     if (lua_isnumber(L, 2)) {
@@ -240,7 +360,7 @@ static int setOpacity(lua_State * L) {
 
 static int setPaint(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFPaintRef paint = bf_lua_getoptionaluserdata(L, 2, BFPaintClassName);
 
     if (paint) {
@@ -254,7 +374,7 @@ static int setPaint(lua_State * L) {
 
 static int setPaintMode(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFPaintModeRef paintMode = bf_lua_getoptionaluserdata(L, 2, BFPaintModeClassName);
 
     if (paintMode) {
@@ -268,7 +388,7 @@ static int setPaintMode(lua_State * L) {
 
 static int setThickness(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
 
     if (lua_isnumber(L, 2)) {
         double thickness = luaL_checknumber(L, 2);
@@ -282,7 +402,7 @@ static int setThickness(lua_State * L) {
 
 static int setFont(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFFontRef font = bf_lua_getoptionaluserdata(L, 2, BFFontClassName);
 
     if (font) {
@@ -296,7 +416,7 @@ static int setFont(lua_State * L) {
 
 static int getFont(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFFontRef font;
 
     font = BFCanvasGetFont(canvas);
@@ -308,7 +428,7 @@ static int getFont(lua_State * L) {
 
 static int concatTransformation(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFTransformationRef transformation = bf_lua_getoptionaluserdata(L, 2, BFTransformationClassName);
 
     if (transformation) {
@@ -322,23 +442,12 @@ static int concatTransformation(lua_State * L) {
 
 static int clipRect(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
 
-    if (lua_istable(L, 2)) {
+    if (lua_toboolean(L, 2)) {
         BFRect rect;
 
-        lua_getfield(L, 2, "left");
-        rect.left = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 2, "bottom");
-        rect.bottom = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 2, "right");
-        rect.right = lua_tonumber(L, -1);
-        lua_pop(L, 1);
-        lua_getfield(L, 2, "top");
-        rect.top = lua_tonumber(L, -1);
-        lua_pop(L, 1);
+        bf_lua_getrect(L, 2, &rect);
 
         BFCanvasClipRect(canvas, rect);
     }
@@ -350,7 +459,7 @@ static int clipRect(lua_State * L) {
 
 static int clipPath(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFPathRef path = bf_lua_getoptionaluserdata(L, 2, BFPathClassName);
 
     if (path) {
@@ -364,7 +473,7 @@ static int clipPath(lua_State * L) {
 
 static int preserveState(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
 
     BFCanvasPush(canvas);
 
@@ -379,9 +488,46 @@ static int preserveState(lua_State * L) {
     return 1;
 }
 
+static int record(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    BFCanvasRef recordingCanvas = BFCanvasCreateForRecording(BFCanvasGetMetrics(canvas));
+    BFDisplayListRef displayList;
+
+    // Only the userdata owns the recording canvas while the function runs, so an error in it leaks nothing.
+    bf_lua_push(L, recordingCanvas, BFCanvasClassName);
+    BFRelease(recordingCanvas);
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, -2);
+    lua_call(L, 1, 0);
+
+    displayList = BFCanvasTakeDisplayList(recordingCanvas);
+    BFCanvasNukeStack(recordingCanvas);
+    lua_pop(L, 1);
+    bf_lua_push(L, displayList, BFDisplayListClassName);
+    BFRelease(displayList);
+
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int replay(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    BFDisplayListRef displayList = bf_lua_getoptionaluserdata(L, 2, BFDisplayListClassName);
+
+    if (displayList) {
+        BFDisplayListReplay(displayList, canvas);
+    }
+
+    BF_LUA_DEBUG_STACK_END(L);
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
 static int isHitTest(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     bool result = BFCanvasIsHitTest(canvas);
 
     BF_LUA_DEBUG_STACK_END(L);
@@ -391,17 +537,41 @@ static int isHitTest(lua_State * L) {
 
 static int test(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
-    bool hit = BFCanvasPerformHitTest(canvas);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    bool hit;
+
+    if (lua_isnumber(L, 2)) {
+        hit = BFCanvasGetHitTestResult(canvas, lua_tointeger(L, 2) - 1);
+    } else {
+        hit = BFCanvasPerformHitTest(canvas);
+    }
 
     BF_LUA_DEBUG_STACK_END(L);
     lua_pushboolean(L, hit);
     return 1;
 }
 
+static int hitPoints(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
+    size_t index, count = BFCanvasGetHitTestPointCount(canvas);
+    int hitCount = 0;
+
+    lua_newtable(L);
+    for (index = 0; index < count; index++) {
+        if (BFCanvasGetLastHitTestResult(canvas, index)) {
+            lua_pushinteger(L, index + 1);
+            lua_rawseti(L, -2, ++hitCount);
+        }
+    }
+
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
 static int metrics(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFCanvasMetricsRef metrics = NULL;
 
     metrics = BFCanvasGetMetrics(canvas);
@@ -413,7 +583,7 @@ static int metrics(lua_State * L) {
 
 static int dirtyRect(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasRef canvas = *(BFCanvasRef *)luaL_checkudata(L, 1, BFCanvasClassName);
+    BFCanvasRef canvas = bf_lua_checkuserdata(L, 1, BFCanvasClassName);
     BFRect dirtyRect;
 
     dirtyRect = BFCanvasGetDirtyRect(canvas);
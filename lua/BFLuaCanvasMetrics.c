@@ -48,7 +48,7 @@ int bf_lua_loadCanvasMetrics(lua_State * L) {
 
 static int rect(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasMetricsRef canvasMetrics = *(BFCanvasMetricsRef *)luaL_checkudata(L, 1, BFCanvasMetricsClassName);
+    BFCanvasMetricsRef canvasMetrics = bf_lua_checkuserdata(L, 1, BFCanvasMetricsClassName);
     BFRect bounds = BFCanvasMetricsGetBoundsRect(canvasMetrics);
 
     lua_newtable(L);
@@ -67,7 +67,7 @@ static int rect(lua_State * L) {
 
 static int backingScale(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasMetricsRef canvasMetrics = *(BFCanvasMetricsRef *)luaL_checkudata(L, 1, BFCanvasMetricsClassName);
+    BFCanvasMetricsRef canvasMetrics = bf_lua_checkuserdata(L, 1, BFCanvasMetricsClassName);
     double backingScale;
 
     backingScale = BFCanvasMetricsGetBackingScale(canvasMetrics);
@@ -79,7 +79,7 @@ static int backingScale(lua_State * L) {
 
 static int pointScale(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFCanvasMetricsRef canvasMetrics = *(BFCanvasMetricsRef *)luaL_checkudata(L, 1, BFCanvasMetricsClassName);
+    BFCanvasMetricsRef canvasMetrics = bf_lua_checkuserdata(L, 1, BFCanvasMetricsClassName);
     double pointScale;
 
     pointScale = BFCanvasMetricsGetPointScale(canvasMetrics);
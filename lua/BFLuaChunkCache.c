@@ -0,0 +1,341 @@
+//
+//  BFLuaChunkCache.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lua.h"
+#include "BFLua.h"
+
+// Scripts are cached by a hash of their name and text, so a changed script is simply a new entry. A hit is only used
+// once the stored name and text match exactly. When the cache is full it's emptied rather than tracking use; the
+// directory, if there is one, still has everything.
+#define BF_LUA_CHUNK_CACHE_BUCKET_COUNT 1024
+#define BF_LUA_CHUNK_CACHE_CAPACITY 16384
+
+// Chunk files start with this, then the name and source lengths as 64-bit integers, the name, the source and the
+// bytecode.
+#define BF_LUA_CHUNK_FILE_MAGIC "BFLC"
+#define BF_LUA_CHUNK_FILE_HEADER_SIZE (4 + 2 * sizeof(uint64_t))
+
+typedef struct BFLuaChunk {
+    struct BFLuaChunk * next;
+    uint64_t hash;
+    // The name and source the bytecode was compiled from, each followed by a NUL.
+    char * chunkName;
+    char * source;
+    size_t sourceSize;
+    char * bytecode;
+    size_t bytecodeSize;
+} BFLuaChunk;
+
+typedef struct BFLuaChunkWriter {
+    char * bytes;
+    size_t size;
+    size_t capacity;
+} BFLuaChunkWriter;
+
+static BFLuaChunk * bf_lua_chunkBuckets[BF_LUA_CHUNK_CACHE_BUCKET_COUNT];
+static size_t bf_lua_chunkCount = 0;
+static char * bf_lua_chunkDirectory = NULL;
+static pthread_mutex_t bf_lua_chunkMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t bf_lua_chunkhash(uint64_t hash, const char * buffer, size_t size) {
+    // 64-bit FNV-1a, continuing from `hash`.
+    size_t index;
+    for (index = 0; index < size; index++) {
+        hash = (hash ^ (unsigned char)buffer[index]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool bf_lua_chunkmatches(const char * chunkName, const char * source, size_t sourceSize, const char * otherChunkName, const char * otherSource, size_t otherSourceSize) {
+    // lua_dump keeps the chunk name for error messages, so the same text under another name is another chunk.
+    return (sourceSize == otherSourceSize && strcmp(chunkName, otherChunkName) == 0 && memcmp(source, otherSource, sourceSize) == 0);
+}
+
+static BFLuaChunk * bf_lua_findchunk(uint64_t hash, const char * chunkName, const char * source, size_t sourceSize) {
+    BFLuaChunk * chunk;
+    for (chunk = bf_lua_chunkBuckets[hash % BF_LUA_CHUNK_CACHE_BUCKET_COUNT]; chunk; chunk = chunk->next) {
+        if (chunk->hash == hash && bf_lua_chunkmatches(chunk->chunkName, chunk->source, chunk->sourceSize, chunkName, source, sourceSize)) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+static void bf_lua_clearchunks(void) {
+    size_t index;
+    for (index = 0; index < BF_LUA_CHUNK_CACHE_BUCKET_COUNT; index++) {
+        BFLuaChunk * chunk = bf_lua_chunkBuckets[index];
+        while (chunk) {
+            BFLuaChunk * next = chunk->next;
+            free(chunk->chunkName);
+            free(chunk->source);
+            free(chunk->bytecode);
+            free(chunk);
+            chunk = next;
+        }
+        bf_lua_chunkBuckets[index] = NULL;
+    }
+    bf_lua_chunkCount = 0;
+}
+
+static void bf_lua_addchunk(uint64_t hash, const char * chunkName, const char * source, size_t sourceSize, char * bytecode, size_t bytecodeSize) {
+    // Takes ownership of `bytecode`.
+    BFLuaChunk * chunk = (bf_lua_findchunk(hash, chunkName, source, sourceSize) ? NULL : malloc(sizeof(BFLuaChunk)));
+    char * chunkNameCopy = (chunk ? strdup(chunkName) : NULL);
+    char * sourceCopy = (chunk ? malloc(sourceSize + 1) : NULL);
+    if (!chunk || !chunkNameCopy || !sourceCopy) {
+        free(chunk);
+        free(chunkNameCopy);
+        free(sourceCopy);
+        free(bytecode);
+        return;
+    }
+    if (bf_lua_chunkCount >= BF_LUA_CHUNK_CACHE_CAPACITY) {
+        bf_lua_clearchunks();
+    }
+    memcpy(sourceCopy, source, sourceSize);
+    sourceCopy[sourceSize] = '\0';
+    chunk->hash = hash;
+    chunk->chunkName = chunkNameCopy;
+    chunk->source = sourceCopy;
+    chunk->sourceSize = sourceSize;
+    chunk->bytecode = bytecode;
+    chunk->bytecodeSize = bytecodeSize;
+    chunk->next = bf_lua_chunkBuckets[hash % BF_LUA_CHUNK_CACHE_BUCKET_COUNT];
+    bf_lua_chunkBuckets[hash % BF_LUA_CHUNK_CACHE_BUCKET_COUNT] = chunk;
+    bf_lua_chunkCount++;
+}
+
+static char * bf_lua_chunkpath(uint64_t hash, size_t sourceSize) {
+    if (!bf_lua_chunkDirectory) {
+        return NULL;
+    }
+    size_t length = strlen(bf_lua_chunkDirectory) + 64;
+    char * path = malloc(length);
+    if (path) {
+        snprintf(path, length, "%s/%016llx-%zu.luac", bf_lua_chunkDirectory, (unsigned long long)hash, sourceSize);
+    }
+    return path;
+}
+
+static char * bf_lua_readstream(FILE * file, size_t * size) {
+    char * bytes = NULL;
+    long length;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        bytes = malloc(length > 0 ? length : 1);
+        if (bytes && fread(bytes, 1, length, file) != (size_t)length) {
+            free(bytes);
+            bytes = NULL;
+        }
+        *size = length;
+    }
+    return bytes;
+}
+
+static char * bf_lua_readfile(const char * path, size_t * size) {
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    char * bytes = bf_lua_readstream(file, size);
+    fclose(file);
+    return bytes;
+}
+
+static char * bf_lua_readchunkfile(const char * path, const char * chunkName, const char * source, size_t sourceSize, size_t * bytecodeOffset, size_t * size) {
+    // The bytecode is run without being checked, so only files this user wrote are trusted, and only for the exact
+    // name and source they were compiled from.
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    struct stat status;
+    char * bytes = NULL;
+    if (fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode) && status.st_uid == geteuid()) {
+        bytes = bf_lua_readstream(file, size);
+    }
+    fclose(file);
+    if (!bytes || *size < BF_LUA_CHUNK_FILE_HEADER_SIZE || memcmp(bytes, BF_LUA_CHUNK_FILE_MAGIC, 4) != 0) {
+        free(bytes);
+        return NULL;
+    }
+    uint64_t lengths[2];
+    memcpy(lengths, bytes + 4, sizeof(lengths));
+    size_t chunkNameLength = strlen(chunkName);
+    *bytecodeOffset = BF_LUA_CHUNK_FILE_HEADER_SIZE + chunkNameLength + sourceSize;
+    if (lengths[0] != chunkNameLength || lengths[1] != sourceSize || *size < *bytecodeOffset ||
+        memcmp(bytes + BF_LUA_CHUNK_FILE_HEADER_SIZE, chunkName, chunkNameLength) != 0 ||
+        memcmp(bytes + BF_LUA_CHUNK_FILE_HEADER_SIZE + chunkNameLength, source, sourceSize) != 0) {
+        free(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+static void bf_lua_writechunkfile(const char * path, const char * chunkName, const char * source, size_t sourceSize, const char * bytecode, size_t bytecodeSize) {
+    // Written to a unique temporary file and renamed, so other threads and processes sharing the directory never
+    // see a partial file. mkstemp creates it readable only by this user.
+    size_t length = strlen(path) + 8;
+    char * temporaryPath = malloc(length);
+    if (!temporaryPath) {
+        return;
+    }
+    snprintf(temporaryPath, length, "%s.XXXXXX", path);
+    int descriptor = mkstemp(temporaryPath);
+    FILE * file = (descriptor >= 0 ? fdopen(descriptor, "wb") : NULL);
+    if (file) {
+        uint64_t lengths[2] = { strlen(chunkName), sourceSize };
+        bool written = (fwrite(BF_LUA_CHUNK_FILE_MAGIC, 1, 4, file) == 4 &&
+                        fwrite(lengths, sizeof(uint64_t), 2, file) == 2 &&
+                        fwrite(chunkName, 1, lengths[0], file) == lengths[0] &&
+                        fwrite(source, 1, sourceSize, file) == sourceSize &&
+                        fwrite(bytecode, 1, bytecodeSize, file) == bytecodeSize);
+        if (fclose(file) == 0 && written) {
+            rename(temporaryPath, path);
+        } else {
+            remove(temporaryPath);
+        }
+    } else if (descriptor >= 0) {
+        close(descriptor);
+        remove(temporaryPath);
+    }
+    free(temporaryPath);
+}
+
+static int bf_lua_writechunk(lua_State * L, const void * bytes, size_t size, void * userData) {
+    BFLuaChunkWriter * writer = userData;
+    if (writer->size + size > writer->capacity) {
+        size_t capacity = (writer->capacity ? writer->capacity * 2 : 1024);
+        while (capacity < writer->size + size) {
+            capacity *= 2;
+        }
+        char * newBytes = realloc(writer->bytes, capacity);
+        if (!newBytes) {
+            return 1;
+        }
+        writer->bytes = newBytes;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->bytes + writer->size, bytes, size);
+    writer->size += size;
+    return 0;
+}
+
+int bf_lua_setchunkcachedirectory(const char * directory) {
+    // Anyone who can write to the directory can choose what bytecode runs, so it's created private to this user and
+    // refused if it already exists with looser permissions.
+    bool usable = true;
+    if (directory) {
+        struct stat status;
+        usable = ((mkdir(directory, 0700) == 0 || errno == EEXIST) && stat(directory, &status) == 0 && S_ISDIR(status.st_mode) &&
+                  status.st_uid == geteuid() && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0);
+    }
+    pthread_mutex_lock(&bf_lua_chunkMutex);
+    free(bf_lua_chunkDirectory);
+    bf_lua_chunkDirectory = ((directory && usable) ? strdup(directory) : NULL);
+    pthread_mutex_unlock(&bf_lua_chunkMutex);
+    return usable;
+}
+
+int bf_lua_loadcachedbuffer(lua_State * L, const char * buffer, size_t size, const char * chunkName) {
+    // The name's NUL separates it from the source in the hash.
+    uint64_t hash = bf_lua_chunkhash(bf_lua_chunkhash(14695981039346656037ULL, chunkName, strlen(chunkName) + 1), buffer, size);
+    int status;
+    
+    // Undumping is quick, so the lock is held while loading rather than copying the bytecode out.
+    pthread_mutex_lock(&bf_lua_chunkMutex);
+    BFLuaChunk * chunk = bf_lua_findchunk(hash, chunkName, buffer, size);
+    if (chunk && luaL_loadbuffer(L, chunk->bytecode, chunk->bytecodeSize, chunkName) == 0) {
+        pthread_mutex_unlock(&bf_lua_chunkMutex);
+        return 0;
+    } else if (chunk) {
+        lua_pop(L, 1);
+    }
+    char * path = bf_lua_chunkpath(hash, size);
+    pthread_mutex_unlock(&bf_lua_chunkMutex);
+    
+    if (path) {
+        // A file that's truncated, for other text or from another Lua version is replaced below.
+        size_t bytecodeOffset, fileSize;
+        char * bytes = bf_lua_readchunkfile(path, chunkName, buffer, size, &bytecodeOffset, &fileSize);
+        if (bytes && luaL_loadbuffer(L, bytes + bytecodeOffset, fileSize - bytecodeOffset, chunkName) == 0) {
+            // Kept in memory without the header.
+            memmove(bytes, bytes + bytecodeOffset, fileSize - bytecodeOffset);
+            pthread_mutex_lock(&bf_lua_chunkMutex);
+            bf_lua_addchunk(hash, chunkName, buffer, size, bytes, fileSize - bytecodeOffset);
+            pthread_mutex_unlock(&bf_lua_chunkMutex);
+            free(path);
+            return 0;
+        } else if (bytes) {
+            lua_pop(L, 1);
+            free(bytes);
+        }
+    }
+    
+    status = luaL_loadbuffer(L, buffer, size, chunkName);
+    if (status == 0) {
+        BFLuaChunkWriter writer = { .bytes = NULL, .size = 0, .capacity = 0 };
+        if (lua_dump(L, bf_lua_writechunk, &writer) == 0 && writer.bytes) {
+            if (path) {
+                bf_lua_writechunkfile(path, chunkName, buffer, size, writer.bytes, writer.size);
+            }
+            pthread_mutex_lock(&bf_lua_chunkMutex);
+            bf_lua_addchunk(hash, chunkName, buffer, size, writer.bytes, writer.size);
+            pthread_mutex_unlock(&bf_lua_chunkMutex);
+        } else {
+            free(writer.bytes);
+        }
+    }
+    free(path);
+    return status;
+}
+
+int bf_lua_loadcachedfile(lua_State * L, const char * fileName) {
+    size_t size;
+    char * buffer = bf_lua_readfile(fileName, &size);
+    if (!buffer) {
+        lua_pushfstring(L, "cannot open %s", fileName);
+        return LUA_ERRFILE;
+    }
+    // Like luaL_loadfile, skip a leading #! line but keep its newline so line numbers still match.
+    size_t offset = 0;
+    if (size > 0 && buffer[0] == '#') {
+        while (offset < size && buffer[offset] != '\n') {
+            offset++;
+        }
+    }
+    lua_pushfstring(L, "@%s", fileName);
+    int status = bf_lua_loadcachedbuffer(L, buffer + offset, size - offset, lua_tostring(L, -1));
+    lua_remove(L, -2);
+    free(buffer);
+    return status;
+}
@@ -73,8 +73,7 @@ static int rgba(lua_State * L) {
     double alpha = lua_tonumber(L, 4);
     BFColorPaintRef colorPaint;
     
-    colorPaint = BFColorPaintCreate();
-    BFColorPaintSetRGBA(colorPaint, red, green, blue, alpha);
+    colorPaint = BFColorPaintCreateWithRGBA(red, green, blue, alpha);
     bf_lua_push(L, colorPaint, BFColorPaintClassName);
     BFRelease(colorPaint);
     
@@ -84,7 +83,7 @@ static int rgba(lua_State * L) {
 
 static int getComponents(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFColorPaintRef colorPaint = *(BFColorPaintRef *)luaL_checkudata(L, 1, BFColorPaintClassName);
+    BFColorPaintRef colorPaint = bf_lua_checkuserdata(L, 1, BFColorPaintClassName);
     double red = 0;
     double green = 0;
     double blue = 0;
@@ -110,8 +109,8 @@ static int getComponents(lua_State * L) {
 
 static int equals(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFColorPaintRef colorPaint1 = *(BFColorPaintRef *)luaL_checkudata(L, 1, BFColorPaintClassName);
-    BFColorPaintRef colorPaint2 = *(BFColorPaintRef *)luaL_checkudata(L, 2, BFColorPaintClassName);
+    BFColorPaintRef colorPaint1 = bf_lua_checkuserdata(L, 1, BFColorPaintClassName);
+    BFColorPaintRef colorPaint2 = bf_lua_checkuserdata(L, 2, BFColorPaintClassName);
     
     luaL_argcheck(L, colorPaint1, 1, "Color expected");
     luaL_argcheck(L, colorPaint2, 2, "Color expected");
@@ -155,7 +155,7 @@ static int getBoldSystem(lua_State * L) {
 
 static int getName(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     char * name = nil;
     
     luaL_argcheck(L, font, 1, "Font expected");
@@ -170,7 +170,7 @@ static int getName(lua_State * L) {
 
 static int getSize(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     double size = 0;
     
     luaL_argcheck(L, font, 1, "Font expected");
@@ -184,7 +184,7 @@ static int getSize(lua_State * L) {
 
 static int getAscent(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     
     luaL_argcheck(L, font, 1, "Font expected");
     
@@ -197,7 +197,7 @@ static int getAscent(lua_State * L) {
 
 static int getDescent(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     
     luaL_argcheck(L, font, 1, "Font expected");
     
@@ -210,7 +210,7 @@ static int getDescent(lua_State * L) {
 
 static int getHeight(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     
     luaL_argcheck(L, font, 1, "Font expected");
     
@@ -225,7 +225,7 @@ static int getHeight(lua_State * L) {
 
 static int getLeading(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     
     luaL_argcheck(L, font, 1, "Font expected");
     
@@ -238,7 +238,7 @@ static int getLeading(lua_State * L) {
 
 static int getFeatures(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFFontRef font = *(BFFontRef *)luaL_checkudata(L, 1, BFFontClassName);
+    BFFontRef font = bf_lua_checkuserdata(L, 1, BFFontClassName);
     
     luaL_argcheck(L, font, 1, "Font expected");
     
@@ -88,16 +88,13 @@ static int processArray(lua_State * L, BFColorPaintRef ** retColorPaints, double
         locations = malloc(count * sizeof(double));
         colorPaints = malloc(count * sizeof(BFColorPaintRef));
         if (locations && colorPaints) {
-            BFPaintRef * colorUserdata;
-            
             lua_pushnil(L);
             while (lua_next(L, 1) != 0) {
                 if (lua_isnumber(L, -2)) {
                     location = lua_tonumber(L, -2);
                     // TODO: make sure this doesn't say "bad arg #-2 to function"...
-                    colorUserdata = luaL_checkudata(L, -1, BFColorPaintClassName);
+                    colorPaints[index] = bf_lua_checkuserdata(L, -1, BFColorPaintClassName);
                     locations[index] = ((location - locationMin) / (locationMax - locationMin));
-                    colorPaints[index] = (BFColorPaintRef)(*colorUserdata);
                     index++;
                 }
                 lua_pop(L, 1);
@@ -82,7 +82,7 @@ static int new(lua_State * L) {
 
 static int getCanvas(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFIconRef icon = *(BFIconRef *)luaL_checkudata(L, 1, BFIconClassName);
+    BFIconRef icon = bf_lua_checkuserdata(L, 1, BFIconClassName);
     BFCanvasRef canvas = NULL;
     
     canvas = BFIconGetCanvas(icon);
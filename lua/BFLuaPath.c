@@ -28,6 +28,9 @@
 #include "butterfly.h"
 
 static int new(lua_State * L);
+static int polyline(lua_State * L);
+static int polygon(lua_State * L);
+static int spline(lua_State * L);
 
 static int addRect(lua_State * L);
 static int addOval(lua_State * L);
@@ -39,11 +42,16 @@ static int addQuadCurve(lua_State * L);
 static int addArc(lua_State * L);
 static int closeSubpath(lua_State * L);
 static int getComponents(lua_State * L);
+static int bounds(lua_State * L);
+static int controlBounds(lua_State * L);
 
 static const BFLuaClass luaPathLibrary = {
     .libraryName = "Path",
     .methods = {
         {"new", new},
+        {"polyline", polyline},
+        {"polygon", polygon},
+        {"spline", spline},
         {NULL, NULL}
     }
 };
@@ -61,6 +69,8 @@ static const BFLuaClass luaPathClass = {
         {"addArc", addArc},
         {"closeSubpath", closeSubpath},
         {"getComponents", getComponents},
+        {"bounds", bounds},
+        {"controlBounds", controlBounds},
         {NULL, NULL}
     }
 };
@@ -86,27 +96,63 @@ static int new(lua_State * L) {
     return 1;
 }
 
+static BFBufferRef copyPointBuffer(lua_State * L, int narg) {
+    // Buffers are used as they are; a table of interleaved x and y values is copied into a temporary one.
+    BFBufferRef buffer = bf_lua_testuserdata(L, narg, BFBufferClassName);
+    if (buffer) {
+        return BFRetain(buffer);
+    }
+    luaL_checktype(L, narg, LUA_TTABLE);
+    size_t index, count = lua_objlen(L, narg);
+    buffer = BFBufferCreate(kBFBufferTypeDouble, count);
+    if (buffer) {
+        for (index = 0; index < count; index++) {
+            lua_rawgeti(L, narg, (int)index + 1);
+            BFBufferSetValue(buffer, index, lua_tonumber(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    return buffer;
+}
+
+static int pushPathFromPoints(lua_State * L, bool closed, void (* addFunction)(BFPathRef, BFBufferRef, bool)) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFBufferRef buffer = copyPointBuffer(L, 1);
+    BFPathRef path;
+    
+    path = BFPathCreate();
+    if (buffer) {
+        addFunction(path, buffer, closed);
+        BFRelease(buffer);
+    }
+    bf_lua_push(L, path, BFPathClassName);
+    BFRelease(path);
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int polyline(lua_State * L) {
+    return pushPathFromPoints(L, false, &BFPathAddPolyline);
+}
+
+static int polygon(lua_State * L) {
+    return pushPathFromPoints(L, true, &BFPathAddPolyline);
+}
+
+static int spline(lua_State * L) {
+    return pushPathFromPoints(L, lua_toboolean(L, 2), &BFPathAddSpline);
+}
+
 static int addRect(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFRect rect;
     double radius;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "left");
-    rect.left = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "bottom");
-    rect.bottom = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "right");
-    rect.right = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "top");
-    rect.top = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    radius = lua_tonumber(L, 3);
+    radius = lua_tonumber(L, 2 + bf_lua_getrect(L, 2, &rect));
     
     if (radius > 0) {
         BFPathAddRoundedRect(path, rect, radius);
@@ -121,23 +167,12 @@ static int addRect(lua_State * L) {
 
 static int addOval(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFRect rect;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "left");
-    rect.left = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "bottom");
-    rect.bottom = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "right");
-    rect.right = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "top");
-    rect.top = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    bf_lua_getrect(L, 2, &rect);
     
     BFPathAddOvalInRect(path, rect);
     
@@ -148,17 +183,12 @@ static int addOval(lua_State * L) {
 
 static int addLine(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint point;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "x");
-    point.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "y");
-    point.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    bf_lua_getpoint(L, 2, &point);
     
     BFPathAddLineToPoint(path, point);
     
@@ -169,7 +199,7 @@ static int addLine(lua_State * L) {
 
 static int addLineXY(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint point;
     
     luaL_argcheck(L, path, 1, "Path expected");
@@ -186,31 +216,38 @@ static int addLineXY(lua_State * L) {
 
 static int addCurve(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint point, controlPoint1, controlPoint2;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "x");
-    point.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "y");
-    point.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    
-    lua_getfield(L, 2, "cx1");
-    controlPoint1.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "cy1");
-    controlPoint1.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    
-    lua_getfield(L, 2, "cx2");
-    controlPoint2.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "cy2");
-    controlPoint2.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "x");
+        point.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "y");
+        point.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        
+        lua_getfield(L, 2, "cx1");
+        controlPoint1.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "cy1");
+        controlPoint1.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        
+        lua_getfield(L, 2, "cx2");
+        controlPoint2.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "cy2");
+        controlPoint2.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    } else {
+        int narg = 2;
+        narg += bf_lua_getpoint(L, narg, &controlPoint1);
+        narg += bf_lua_getpoint(L, narg, &controlPoint2);
+        bf_lua_getpoint(L, narg, &point);
+    }
     
     BFPathAddCurveToPoint(path, point, controlPoint1, controlPoint2);
     
@@ -221,24 +258,28 @@ static int addCurve(lua_State * L) {
 
 static int addQuadCurve(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint point, controlPoint;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "x");
-    point.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "y");
-    point.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    
-    lua_getfield(L, 2, "cx");
-    controlPoint.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "cy");
-    controlPoint.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "x");
+        point.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "y");
+        point.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        
+        lua_getfield(L, 2, "cx");
+        controlPoint.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "cy");
+        controlPoint.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    } else {
+        bf_lua_getpoint(L, 2 + bf_lua_getpoint(L, 2, &controlPoint), &point);
+    }
     
     BFPathAddQuadCurveToPoint(path, point, controlPoint);
     
@@ -249,21 +290,25 @@ static int addQuadCurve(lua_State * L) {
 
 static int addArc(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint centerPoint;
     double angle;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "cx");
-    centerPoint.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "cy");
-    centerPoint.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "angle");
-    angle = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "cx");
+        centerPoint.x = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "cy");
+        centerPoint.y = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "angle");
+        angle = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    } else {
+        angle = lua_tonumber(L, 2 + bf_lua_getpoint(L, 2, &centerPoint));
+    }
     
     BFPathAddArc(path, centerPoint, angle);
     
@@ -274,17 +319,12 @@ static int addArc(lua_State * L) {
 
 static int addSubpath(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     BFPoint point;
     
     luaL_argcheck(L, path, 1, "Path expected");
     
-    lua_getfield(L, 2, "x");
-    point.x = lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    lua_getfield(L, 2, "y");
-    point.y = lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    bf_lua_getpoint(L, 2, &point);
     
     BFPathMoveToPoint(path, point);
     
@@ -295,7 +335,7 @@ static int addSubpath(lua_State * L) {
 
 static int closeSubpath(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkmutableuserdata(L, 1, BFPathClassName);
     
     luaL_argcheck(L, path, 1, "Path expected");
     
@@ -364,7 +404,7 @@ static void getComponents_iteration(lua_State * L, BFPathComponent component) {
 
 static int getComponents(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFPathRef path = *(BFPathRef *)luaL_checkudata(L, 1, BFPathClassName);
+    BFPathRef path = bf_lua_checkuserdata(L, 1, BFPathClassName);
     
     luaL_argcheck(L, path, 1, "Path expected");
     
@@ -374,3 +414,36 @@ static int getComponents(lua_State * L) {
     BF_LUA_DEBUG_STACK_ENDR(L, 1);
     return 1;
 }
+
+static int pushBounds(lua_State * L, bool (* getBoundsFunction)(BFPathRef, BFRect *)) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFPathRef path = bf_lua_checkuserdata(L, 1, BFPathClassName);
+    BFRect bounds;
+    
+    luaL_argcheck(L, path, 1, "Path expected");
+    
+    if (getBoundsFunction(path, &bounds)) {
+        lua_newtable(L);
+        lua_pushnumber(L, bounds.left);
+        lua_setfield(L, -2, "left");
+        lua_pushnumber(L, bounds.bottom);
+        lua_setfield(L, -2, "bottom");
+        lua_pushnumber(L, bounds.right);
+        lua_setfield(L, -2, "right");
+        lua_pushnumber(L, bounds.top);
+        lua_setfield(L, -2, "top");
+    } else {
+        lua_pushnil(L);
+    }
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int bounds(lua_State * L) {
+    return pushBounds(L, BFPathGetBounds);
+}
+
+static int controlBounds(lua_State * L) {
+    return pushBounds(L, BFPathGetControlBounds);
+}
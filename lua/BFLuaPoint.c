@@ -0,0 +1,122 @@
+//
+//  BFLuaPoint.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include "lua.h"
+#include "BFLua.h"
+
+#include "butterfly.h"
+
+static int new(lua_State * L);
+
+static int getField(lua_State * L);
+
+// Points are tagged like the userdata from bf_lua_push, so recognizing one doesn't need its metatable.
+typedef struct BFLuaPoint {
+    BFPoint point;
+    const void * tag;
+} BFLuaPoint;
+
+static const char bf_lua_pointTag = 0;
+
+static const BFLuaClass luaPointLibrary = {
+    .libraryName = "Point",
+    .methods = {
+        {"new", new},
+        {NULL, NULL}
+    }
+};
+
+static const BFLuaClass luaPointClass = {
+    .metatableName = BFPointClassName,
+    .isValueType = 1,
+    .methods = {
+        {"__index", getField},
+        {NULL, NULL}
+    }
+};
+
+// Global functions
+
+int bf_lua_loadPoint(lua_State * L) {
+    bf_lua_loadmodule(L, &luaPointLibrary, &luaPointClass);
+    return 0;
+}
+
+int bf_lua_getpoint(lua_State * L, int narg, BFPoint * point) {
+    if (lua_type(L, narg) == LUA_TNUMBER) {
+        point->x = lua_tonumber(L, narg);
+        point->y = luaL_checknumber(L, narg + 1);
+        return 2;
+    }
+    
+    BFLuaPoint * userdata = lua_touserdata(L, narg);
+    if (userdata && lua_type(L, narg) == LUA_TUSERDATA && lua_objlen(L, narg) == sizeof(BFLuaPoint) && userdata->tag == &bf_lua_pointTag) {
+        *point = userdata->point;
+        return 1;
+    }
+    
+    lua_getfield(L, narg, "x");
+    point->x = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, narg, "y");
+    point->y = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return 1;
+}
+
+// Local functions
+
+static int new(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFPoint point;
+    
+    bf_lua_getpoint(L, 1, &point);
+    
+    BFLuaPoint * userdata = lua_newuserdata(L, sizeof(BFLuaPoint));
+    userdata->point = point;
+    userdata->tag = &bf_lua_pointTag;
+    luaL_getmetatable(L, BFPointClassName);
+    lua_setmetatable(L, -2);
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int getField(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFPoint * point = luaL_checkudata(L, 1, BFPointClassName);
+    const char * key = lua_tostring(L, 2);
+    
+    BF_LUA_DEBUG_STACK_END(L);
+    if (!key) {
+        lua_pushnil(L);
+    } else if (strcmp(key, "x") == 0) {
+        lua_pushnumber(L, point->x);
+    } else if (strcmp(key, "y") == 0) {
+        lua_pushnumber(L, point->y);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
@@ -0,0 +1,134 @@
+//
+//  BFLuaRect.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include "lua.h"
+#include "BFLua.h"
+
+#include "butterfly.h"
+
+static int new(lua_State * L);
+
+static int getField(lua_State * L);
+
+// Rects are tagged like the userdata from bf_lua_push, so recognizing one doesn't need its metatable.
+typedef struct BFLuaRect {
+    BFRect rect;
+    const void * tag;
+} BFLuaRect;
+
+static const char bf_lua_rectTag = 0;
+
+static const BFLuaClass luaRectLibrary = {
+    .libraryName = "Rect",
+    .methods = {
+        {"new", new},
+        {NULL, NULL}
+    }
+};
+
+static const BFLuaClass luaRectClass = {
+    .metatableName = BFRectClassName,
+    .isValueType = 1,
+    .methods = {
+        {"__index", getField},
+        {NULL, NULL}
+    }
+};
+
+// Global functions
+
+int bf_lua_loadRect(lua_State * L) {
+    bf_lua_loadmodule(L, &luaRectLibrary, &luaRectClass);
+    return 0;
+}
+
+int bf_lua_getrect(lua_State * L, int narg, BFRect * rect) {
+    if (lua_type(L, narg) == LUA_TNUMBER) {
+        rect->left = lua_tonumber(L, narg);
+        rect->bottom = luaL_checknumber(L, narg + 1);
+        rect->right = luaL_checknumber(L, narg + 2);
+        rect->top = luaL_checknumber(L, narg + 3);
+        return 4;
+    }
+    
+    BFLuaRect * userdata = lua_touserdata(L, narg);
+    if (userdata && lua_type(L, narg) == LUA_TUSERDATA && lua_objlen(L, narg) == sizeof(BFLuaRect) && userdata->tag == &bf_lua_rectTag) {
+        *rect = userdata->rect;
+        return 1;
+    }
+    
+    lua_getfield(L, narg, "left");
+    rect->left = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, narg, "bottom");
+    rect->bottom = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, narg, "right");
+    rect->right = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, narg, "top");
+    rect->top = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return 1;
+}
+
+// Local functions
+
+static int new(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFRect rect;
+    
+    bf_lua_getrect(L, 1, &rect);
+    
+    BFLuaRect * userdata = lua_newuserdata(L, sizeof(BFLuaRect));
+    userdata->rect = rect;
+    userdata->tag = &bf_lua_rectTag;
+    luaL_getmetatable(L, BFRectClassName);
+    lua_setmetatable(L, -2);
+    
+    BF_LUA_DEBUG_STACK_ENDR(L, 1);
+    return 1;
+}
+
+static int getField(lua_State * L) {
+    BF_LUA_DEBUG_STACK_BEGIN(L);
+    BFRect * rect = luaL_checkudata(L, 1, BFRectClassName);
+    const char * key = lua_tostring(L, 2);
+    
+    BF_LUA_DEBUG_STACK_END(L);
+    if (!key) {
+        lua_pushnil(L);
+    } else if (strcmp(key, "left") == 0) {
+        lua_pushnumber(L, rect->left);
+    } else if (strcmp(key, "bottom") == 0) {
+        lua_pushnumber(L, rect->bottom);
+    } else if (strcmp(key, "right") == 0) {
+        lua_pushnumber(L, rect->right);
+    } else if (strcmp(key, "top") == 0) {
+        lua_pushnumber(L, rect->top);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
@@ -93,7 +93,7 @@ static int new(lua_State * L) {
 
 static int measure(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
     
     luaL_argcheck(L, styledString, 1, "StyledString expected");
     
@@ -114,7 +114,7 @@ static int measure(lua_State * L) {
 
 static int wrapToWidth(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
     double width = lua_tonumber(L, 2);
     CFIndex length;
     CFIndex position;
@@ -146,7 +146,7 @@ static int wrapToWidth(lua_State * L) {
 
 static int truncateToWidth(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
     double width = lua_tonumber(L, 2);
     BFStyledStringRef truncatedStyledString;
     
@@ -186,7 +186,7 @@ static void getComponents_iteration(lua_State * L, BFStyledStringComponent compo
 
 static int getComponents(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
     
     luaL_argcheck(L, styledString, 1, "StyledString expected");
     
@@ -199,8 +199,8 @@ static int getComponents(lua_State * L) {
 
 static int concat(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString1 = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
-    BFStyledStringRef styledString2 = *(BFStyledStringRef *)luaL_checkudata(L, 2, BFStyledStringClassName);
+    BFStyledStringRef styledString1 = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString2 = bf_lua_checkuserdata(L, 2, BFStyledStringClassName);
     BFStyledStringRef styledString;
         
     styledString = BFStyledStringCreateJoining(styledString1, styledString2);
@@ -213,7 +213,7 @@ static int concat(lua_State * L) {
 
 static int tostring(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFStyledStringRef styledString = *(BFStyledStringRef *)luaL_checkudata(L, 1, BFStyledStringClassName);
+    BFStyledStringRef styledString = bf_lua_checkuserdata(L, 1, BFStyledStringClassName);
     char * cString = NULL;
     
     cString = BFStyledStringCopyString(styledString);
@@ -82,7 +82,7 @@ static int identity(lua_State * L) {
 
 static int rotate(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkmutableuserdata(L, 1, BFTransformationClassName);
     double angle = lua_tonumber(L, 2);
     
     luaL_argcheck(L, transformation, 1, "Transformation expected");
@@ -95,7 +95,7 @@ static int rotate(lua_State * L) {
 
 static int translate(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkmutableuserdata(L, 1, BFTransformationClassName);
     double dx = lua_tonumber(L, 2);
     double dy = lua_tonumber(L, 3);
     
@@ -109,7 +109,7 @@ static int translate(lua_State * L) {
 
 static int scale(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkmutableuserdata(L, 1, BFTransformationClassName);
     double ratio = lua_tonumber(L, 2);
     
     luaL_argcheck(L, transformation, 1, "Transformation expected");
@@ -122,7 +122,7 @@ static int scale(lua_State * L) {
 
 static int invert(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkmutableuserdata(L, 1, BFTransformationClassName);
     
     luaL_argcheck(L, transformation, 1, "Transformation expected");
     BFTransformationInvert(transformation);
@@ -134,11 +134,11 @@ static int invert(lua_State * L) {
 
 static int concat(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation1 = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
-    BFTransformationRef transformation2 = *(BFTransformationRef *)luaL_checkudata(L, 2, BFTransformationClassName);
+    BFTransformationRef transformation1 = bf_lua_checkmutableuserdata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation2 = bf_lua_checkuserdata(L, 2, BFTransformationClassName);
     
     luaL_argcheck(L, transformation1, 1, "Transformation expected");
-    luaL_argcheck(L, transformation1, 2, "Transformation expected");
+    luaL_argcheck(L, transformation2, 2, "Transformation expected");
     BFTransformationConcat(transformation1, transformation2);
     
     BF_LUA_DEBUG_STACK_END(L);
@@ -148,7 +148,7 @@ static int concat(lua_State * L) {
 
 static int transformPoint(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkuserdata(L, 1, BFTransformationClassName);
     double x = lua_tonumber(L, 2);
     double y = lua_tonumber(L, 3);
     
@@ -164,7 +164,7 @@ static int transformPoint(lua_State * L) {
 
 static int transformRect(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkuserdata(L, 1, BFTransformationClassName);
     BFRect rect;
     
     luaL_argcheck(L, transformation, 1, "Transformation expected");
@@ -200,7 +200,7 @@ static int transformRect(lua_State * L) {
 
 static int getComponents(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
-    BFTransformationRef transformation = *(BFTransformationRef *)luaL_checkudata(L, 1, BFTransformationClassName);
+    BFTransformationRef transformation = bf_lua_checkuserdata(L, 1, BFTransformationClassName);
     
     luaL_argcheck(L, transformation, 1, "Transformation expected");
     
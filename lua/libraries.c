@@ -28,14 +28,18 @@
 
 int bf_lua_load(lua_State * L) {
     BF_LUA_DEBUG_STACK_BEGIN(L);
+    bf_lua_loadBuffer(L);
     bf_lua_loadCanvas(L);
     bf_lua_loadCanvasMetrics(L);
     bf_lua_loadColor(L);
+    bf_lua_loadDisplayList(L);
     bf_lua_loadFont(L);
     bf_lua_loadGradient(L);
     bf_lua_loadIcon(L);
     bf_lua_loadPaintMode(L);
     bf_lua_loadPath(L);
+    bf_lua_loadPoint(L);
+    bf_lua_loadRect(L);
     bf_lua_loadStyledString(L);
     bf_lua_loadTransformation(L);
     BF_LUA_DEBUG_STACK_END(L);
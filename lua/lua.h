@@ -29,17 +29,26 @@
 
 int bf_lua_load(lua_State * L);
 
+int bf_lua_loadBuffer(lua_State * L);
 int bf_lua_loadCanvas(lua_State * L);
 int bf_lua_loadCanvasMetrics(lua_State * L);
 int bf_lua_loadColor(lua_State * L);
+int bf_lua_loadDisplayList(lua_State * L);
 int bf_lua_loadFont(lua_State * L);
 int bf_lua_loadGradient(lua_State * L);
 int bf_lua_loadIcon(lua_State * L);
 int bf_lua_loadPaintMode(lua_State * L);
 int bf_lua_loadPath(lua_State * L);
+int bf_lua_loadPoint(lua_State * L);
+int bf_lua_loadRect(lua_State * L);
 int bf_lua_loadStyledString(lua_State * L);
 int bf_lua_loadTransformation(lua_State * L);
 
 void bf_lua_push(lua_State * L, void * data, const char * tname);
 
+int bf_lua_loadcachedbuffer(lua_State * L, const char * buffer, size_t size, const char * chunkName);
+int bf_lua_loadcachedfile(lua_State * L, const char * fileName);
+// Returns 0, and saves nothing, if the directory can't be created or isn't private to this user.
+int bf_lua_setchunkcachedirectory(const char * directory);
+
 #endif /* __BUTTERFLY_LUA_H__ */
@@ -23,6 +23,13 @@
 //
 
 #include <ImageIO/ImageIO.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -30,10 +37,435 @@
 #include <butterfly/lua.h>
 #include <butterfly/quartz.h>
 
+static bool writePNG(CGContextRef context, const char * outputFileName) {
+    CFStringRef outputFileNameString = CFStringCreateWithCString(NULL, outputFileName, kCFStringEncodingUTF8);
+    CFURLRef fileURL = CFURLCreateWithFileSystemPath(NULL, outputFileNameString, kCFURLPOSIXPathStyle, false);
+    CGImageDestinationRef imageDestination = CGImageDestinationCreateWithURL(fileURL, CFSTR("public.png"), 1, NULL);
+    bool success = false;
+    if (imageDestination) {
+        CGImageRef image = CGBitmapContextCreateImage(context);
+        CGImageDestinationAddImage(imageDestination, image, NULL);
+        success = CGImageDestinationFinalize(imageDestination);
+        CGImageRelease(image);
+        CFRelease(imageDestination);
+    }
+    CFRelease(fileURL);
+    CFRelease(outputFileNameString);
+    return success;
+}
+
+// Server mode
+//
+// With -S, lua2png reads render jobs from standard input, one per line, and writes a completion
+// record for each to standard output. With -u it listens on a Unix domain socket instead, and
+// answers each connection's jobs on that connection. A job is a line of tab-separated fields:
+//
+//     <id> <width> <height> <output.png> <input.lua>
+//
+// If the last field is `=<length>` instead of a file name, the script's source follows the line
+// as exactly that many bytes. Each completion record is one line:
+//
+//     <id> ok <load ms> <render ms> <write ms>
+//     <id> error <message>
+//
+// Jobs run concurrently on a pool of threads, each keeping its own Lua state between jobs, so the
+// process startup and `bf_lua_load` only happen once. Bitmaps come from a shared pool and go back
+// to it once written, so rendering the same size again doesn't allocate. Scripts go through the
+// chunk cache, so a script that's been rendered before isn't parsed again. Each script gets its own
+// global table that reads through to the state's globals, so globals one job sets don't leak into
+// the next job on the same thread.
+
+typedef struct Connection {
+    FILE * input;
+    FILE * output;
+    pthread_mutex_t mutex;
+    int references;
+    bool failed;
+} Connection;
+
+typedef struct Job {
+    struct Job * next;
+    Connection * connection;
+    char * identifier;
+    size_t width;
+    size_t height;
+    char * outputFileName;
+    char * inputFileName;
+    char * source;
+    size_t sourceLength;
+} Job;
+
+static pthread_mutex_t jobMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobCondition = PTHREAD_COND_INITIALIZER;
+static Job * firstJob = NULL;
+static Job * lastJob = NULL;
+static bool noMoreJobs = false;
+
+// Larger jobs are refused rather than risking overflow in the size of their bitmaps.
+static const long maximumJobDimension = 16384;
+
+static double currentMilliseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static Connection * connectionCreate(FILE * input, FILE * output) {
+    Connection * connection = calloc(1, sizeof(Connection));
+    if (!connection) {
+        return NULL;
+    }
+    connection->input = input;
+    connection->output = output;
+    pthread_mutex_init(&connection->mutex, NULL);
+    connection->references = 1;
+    return connection;
+}
+
+static void connectionRetain(Connection * connection) {
+    pthread_mutex_lock(&connection->mutex);
+    connection->references++;
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+static void connectionRelease(Connection * connection) {
+    // The connection is closed once its reader has hit the end and every job from it has been answered.
+    pthread_mutex_lock(&connection->mutex);
+    int references = --connection->references;
+    pthread_mutex_unlock(&connection->mutex);
+    if (references == 0) {
+        if (connection->input != stdin) {
+            fclose(connection->input);
+            fclose(connection->output);
+        }
+        pthread_mutex_destroy(&connection->mutex);
+        free(connection);
+    }
+}
+
+static void connectionRespond(Connection * connection, const char * identifier, const char * format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    pthread_mutex_lock(&connection->mutex);
+    // Once a client has gone away, the rest of its answers are dropped.
+    if (!connection->failed) {
+        fprintf(connection->output, "%s\t", identifier);
+        vfprintf(connection->output, format, arguments);
+        fputc('\n', connection->output);
+        connection->failed = (fflush(connection->output) != 0);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+    va_end(arguments);
+}
+
+static void jobFree(Job * job) {
+    connectionRelease(job->connection);
+    free(job->identifier);
+    free(job->outputFileName);
+    free(job->inputFileName);
+    free(job->source);
+    free(job);
+}
+
+static void enqueueJob(Job * job) {
+    pthread_mutex_lock(&jobMutex);
+    if (lastJob) {
+        lastJob->next = job;
+    } else {
+        firstJob = job;
+    }
+    lastJob = job;
+    pthread_cond_signal(&jobCondition);
+    pthread_mutex_unlock(&jobMutex);
+}
+
+static Job * dequeueJob(void) {
+    pthread_mutex_lock(&jobMutex);
+    while (!firstJob && !noMoreJobs) {
+        pthread_cond_wait(&jobCondition, &jobMutex);
+    }
+    Job * job = firstJob;
+    if (job) {
+        firstJob = job->next;
+        if (!firstJob) {
+            lastJob = NULL;
+        }
+    }
+    pthread_mutex_unlock(&jobMutex);
+    return job;
+}
+
+static void * readJobs(void * data) {
+    Connection * connection = data;
+    char * line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    while ((lineLength = getline(&line, &lineCapacity, connection->input)) > 0) {
+        if (line[lineLength - 1] == '\n') {
+            line[--lineLength] = '\0';
+        }
+        if (lineLength == 0) {
+            continue;
+        }
+        char * fields[5];
+        char * cursor = line;
+        int fieldCount = 0;
+        while (fieldCount < 5 && cursor) {
+            fields[fieldCount++] = strsep(&cursor, "\t");
+        }
+        if (fieldCount < 5 || cursor) {
+            connectionRespond(connection, (fieldCount > 0 ? fields[0] : ""), "error\tmalformed job");
+            continue;
+        }
+        Job * job = calloc(1, sizeof(Job));
+        if (!job) {
+            connectionRespond(connection, fields[0], "error\tout of memory");
+            continue;
+        }
+        job->connection = connection;
+        job->identifier = strdup(fields[0]);
+        long width = strtol(fields[1], NULL, 10);
+        long height = strtol(fields[2], NULL, 10);
+        job->outputFileName = strdup(fields[3]);
+        if (fields[4][0] == '=') {
+            long sourceLength = strtol(fields[4] + 1, NULL, 10);
+            if (sourceLength < 0) {
+                connectionRespond(connection, job->identifier, "error\tmalformed job");
+                connectionRetain(connection);
+                jobFree(job);
+                break;
+            }
+            job->sourceLength = sourceLength;
+            job->source = malloc(job->sourceLength + 1);
+            if (!job->source || fread(job->source, 1, job->sourceLength, connection->input) != job->sourceLength) {
+                connectionRespond(connection, job->identifier, "error\tthe script source was cut off");
+                connectionRetain(connection);
+                jobFree(job);
+                break;
+            }
+        } else {
+            job->inputFileName = strdup(fields[4]);
+        }
+        connectionRetain(connection);
+        // The size is checked after any source has been read, so the next line still starts a job.
+        if (width <= 0 || height <= 0 || width > maximumJobDimension || height > maximumJobDimension) {
+            connectionRespond(connection, job->identifier, "error\tthe size must be between 1 and %ld", maximumJobDimension);
+            jobFree(job);
+            continue;
+        }
+        job->width = width;
+        job->height = height;
+        enqueueJob(job);
+    }
+    free(line);
+    connectionRelease(connection);
+    return NULL;
+}
+
+static void runJob(lua_State * L, int environmentMetatable, Job * job) {
+    double startTime = currentMilliseconds();
+
+    // Load the script, which returns the drawing function. Functions it defines share the fresh
+    // environment, so the drawing function's globals are this job's too.
+    int status = (job->inputFileName ? bf_lua_loadcachedfile(L, job->inputFileName) : bf_lua_loadcachedbuffer(L, job->source, job->sourceLength, "=job"));
+    if (!status) {
+        lua_newtable(L);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, environmentMetatable);
+        lua_setmetatable(L, -2);
+        lua_setfenv(L, -2);
+    }
+    if (status || lua_pcall(L, 0, 1, 0)) {
+        connectionRespond(job->connection, job->identifier, "error\t%s", lua_tostring(L, -1));
+        lua_settop(L, 0);
+        return;
+    } else if (!lua_isfunction(L, -1)) {
+        connectionRespond(job->connection, job->identifier, "error\tthe script didn't return a function");
+        lua_settop(L, 0);
+        return;
+    }
+    double loadTime = currentMilliseconds();
+
+    // Take a cleared bitmap from the shared pool. The canvas keeps it out of the pool until the
+    // Lua state collects the canvas, so the pixels can't be reused while it's still reachable.
+    // Lua's collector doesn't know how large the pixels are, so the state is collected after each
+    // job to hand the bitmap back promptly.
+    BFBitmapRef bitmap = BFBitmapPoolCreateBitmap(BFBitmapPoolGetDefault(), job->width, job->height);
+    CGContextRef context = BFBitmapGetCGContext(bitmap);
+    if (!context) {
+        connectionRespond(job->connection, job->identifier, "error\tcouldn't create a %zu x %zu bitmap", job->width, job->height);
+        BFRelease(bitmap);
+        lua_settop(L, 0);
+        return;
+    }
+
+    BFRect bounds = { 0, 0, job->width, job->height };
+    BFCanvasMetricsRef canvasMetrics = BFCanvasMetricsCreate(bounds, 1, 1);
+    BFCanvasRef canvas = BFBitmapCreateCanvas(bitmap, canvasMetrics);
+    bf_lua_push(L, canvas, BFCanvasClassName);
+    status = lua_pcall(L, 1, 0, 0);
+    BFRelease(canvas);
+    BFRelease(canvasMetrics);
+    if (status) {
+        connectionRespond(job->connection, job->identifier, "error\t%s", lua_tostring(L, -1));
+    }
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    if (status) {
+        BFRelease(bitmap);
+        return;
+    }
+    double renderTime = currentMilliseconds();
+
+    bool written = writePNG(context, job->outputFileName);
+    BFRelease(bitmap);
+    if (!written) {
+        connectionRespond(job->connection, job->identifier, "error\tcouldn't write %s", job->outputFileName);
+        return;
+    }
+    double writeTime = currentMilliseconds();
+    connectionRespond(job->connection, job->identifier, "ok\t%.3f\t%.3f\t%.3f", loadTime - startTime, renderTime - loadTime, writeTime - renderTime);
+}
+
+static void * renderJobs(void * data) {
+    lua_State * L = luaL_newstate();
+    bf_lua_load(L);
+    // Jobs' environments look up anything they haven't set in the globals bf_lua_load installed.
+    lua_newtable(L);
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    lua_setfield(L, -2, "__index");
+    int environmentMetatable = luaL_ref(L, LUA_REGISTRYINDEX);
+    Job * job;
+    while ((job = dequeueJob())) {
+        runJob(L, environmentMetatable, job);
+        jobFree(job);
+    }
+    lua_close(L);
+    return NULL;
+}
+
+static int serve(int threadCount, const char * socketPath) {
+    if (threadCount <= 0) {
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    // A client that disconnects before its answers are written must not take the server down.
+    signal(SIGPIPE, SIG_IGN);
+    pthread_t * threads = calloc(threadCount, sizeof(pthread_t));
+    int index;
+    for (index = 0; index < threadCount; index++) {
+        pthread_create(&threads[index], NULL, renderJobs, NULL);
+    }
+
+    if (socketPath) {
+        // Each connection gets its own reader thread; the render threads are shared.
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+        strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socketPath);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) || listen(listener, 16)) {
+            printf("OH NO: couldn't listen on %s\n", socketPath);
+            return 1;
+        }
+        for (;;) {
+            int client = accept(listener, NULL, NULL);
+            if (client < 0) {
+                continue;
+            }
+            // The connection reads and writes through separate streams on copies of the socket.
+            FILE * input = fdopen(client, "r");
+            int outputDescriptor = (input ? dup(client) : -1);
+            FILE * output = (outputDescriptor >= 0 ? fdopen(outputDescriptor, "w") : NULL);
+            Connection * connection = (output ? connectionCreate(input, output) : NULL);
+            if (!connection) {
+                if (output) {
+                    fclose(output);
+                } else if (outputDescriptor >= 0) {
+                    close(outputDescriptor);
+                }
+                if (input) {
+                    fclose(input);
+                } else {
+                    close(client);
+                }
+                continue;
+            }
+            pthread_t reader;
+            if (pthread_create(&reader, NULL, readJobs, connection) == 0) {
+                pthread_detach(reader);
+            } else {
+                connectionRelease(connection);
+            }
+        }
+    }
+
+    // Reading standard input ends at its end, once the jobs already read have finished.
+    Connection * connection = connectionCreate(stdin, stdout);
+    if (connection) {
+        readJobs(connection);
+    }
+    pthread_mutex_lock(&jobMutex);
+    noMoreJobs = true;
+    pthread_cond_broadcast(&jobCondition);
+    pthread_mutex_unlock(&jobMutex);
+    for (index = 0; index < threadCount; index++) {
+        pthread_join(threads[index], NULL);
+    }
+    free(threads);
+    return 0;
+}
+
 int main(int argc, char * argv[]) {
     // Deal with the command-line arguments.
-    if (argc < 5) {
-        printf("usage: lua2png <width> <height> <input.lua> <output.png>\n");
+    // Passing -t renders in tiles on that many threads (0 for one per processor) instead of
+    // drawing through Quartz. -s sets the tile size in pixels, and -d keeps the output identical
+    // regardless of the thread count. -c keeps compiled scripts in a cache directory, so running
+    // the same script again skips parsing it. -S and -u run as a render server (see above), with
+    // -j setting the number of render threads (0, the default, for one per processor).
+    bool tiled = false;
+    bool server = false;
+    char * socketPath = NULL;
+    int jobThreadCount = 0;
+    BFTiledRenderOptions tiledRenderOptions = { .threadCount = 0, .tileSize = 0, .deterministic = false };
+    int option;
+    while ((option = getopt(argc, argv, "t:s:dc:Su:j:")) != -1) {
+        switch (option) {
+            case 't':
+                tiled = true;
+                tiledRenderOptions.threadCount = (int)strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                tiledRenderOptions.tileSize = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'd':
+                tiledRenderOptions.deterministic = true;
+                break;
+            case 'c':
+                if (!bf_lua_setchunkcachedirectory(optarg)) {
+                    // On standard error, since standard output answers jobs in server mode.
+                    fprintf(stderr, "OH NO: %s isn't a private directory, so scripts won't be cached there\n", optarg);
+                }
+                break;
+            case 'S':
+                server = true;
+                break;
+            case 'u':
+                server = true;
+                socketPath = optarg;
+                break;
+            case 'j':
+                jobThreadCount = (int)strtol(optarg, NULL, 10);
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (server && argc > 0) {
+        return serve(jobThreadCount, socketPath);
+    } else if (argc < 5) {
+        printf("usage: lua2png [-t <threads> [-s <tile size>] [-d]] [-c <cache directory>] <width> <height> <input.lua> <output.png>\n");
+        printf("       lua2png -S|-u <socket> [-j <threads>] [-c <cache directory>]\n");
         return 1;
     }
     size_t width = strtol(argv[1], NULL, 10);
@@ -46,7 +478,7 @@ int main(int argc, char * argv[]) {
     bf_lua_load(L);
 
     // Load & run the script, expecting it to return a drawing function.
-    if (luaL_loadfile(L, inputFileName) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
+    if (bf_lua_loadcachedfile(L, inputFileName) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
         printf("OH NO: %s\n", lua_tostring(L, -1));
         return 1;
     } else if (!lua_isfunction(L, -1)) {
@@ -69,9 +501,10 @@ int main(int argc, char * argv[]) {
     CGContextRef context = CGBitmapContextCreate(buffer, width, height, 8, width * 4, colorSpace, kCGImageAlphaPremultipliedLast);
     CGColorSpaceRelease(colorSpace);
 
-    // Create the canvas object for the Lua scripts to draw into.
+    // Create the canvas object for the Lua scripts to draw into. In tiled mode it records the
+    // drawing commands so they can be rasterized afterwards.
     // As above with the canvas metrics, we own the object returned by `BFCanvasCreateForDisplay`.
-    BFCanvasRef canvas = BFCanvasCreateForDisplay(context, canvasMetrics);
+    BFCanvasRef canvas = (tiled ? BFCanvasCreateForRecording(canvasMetrics) : BFCanvasCreateForDisplay(context, canvasMetrics));
 
     // Push `canvas` onto the Lua stack. Note that `bf_lua_push` retains the object
     // on behalf of the Lua state.
@@ -87,13 +520,15 @@ int main(int argc, char * argv[]) {
         return 1;
     }
 
+    // Rasterize the recorded frame tile by tile, straight into the bitmap context's buffer.
+    if (tiled) {
+        BFDisplayListRef displayList = BFCanvasTakeDisplayList(canvas);
+        BFDisplayListRenderTiled(displayList, buffer, width * 4, canvasMetrics, tiledRenderOptions);
+        BFRelease(displayList);
+    }
+
     // Write the output image file.
-    CFStringRef outputFileNameString = CFStringCreateWithCString(NULL, outputFileName, kCFStringEncodingUTF8);
-    CFURLRef fileURL = CFURLCreateWithFileSystemPath(NULL, outputFileNameString, kCFURLPOSIXPathStyle, false);
-    CGImageDestinationRef imageDestination = CGImageDestinationCreateWithURL(fileURL, CFSTR("public.png"), 1, NULL);
-    CGImageRef image = CGBitmapContextCreateImage(context);
-    CGImageDestinationAddImage(imageDestination, image, NULL);
-    CGImageDestinationFinalize(imageDestination);
+    writePNG(context, outputFileName);
 
     return 0;
 }
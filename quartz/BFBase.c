@@ -22,10 +22,28 @@
 //  THE SOFTWARE.
 //
 
+#include <stdlib.h>
+
 #include "butterfly.h"
 
+// Refcounts are atomic so objects can be retained and released from several render threads at once. Builds that only
+// ever touch butterfly objects from one thread can define BF_BASE_THREAD_SAFE to 0 to use plain increments instead.
+#ifndef BF_BASE_THREAD_SAFE
+#define BF_BASE_THREAD_SAFE 1
+#endif
+
+#if BF_BASE_THREAD_SAFE
+#include <stdatomic.h>
+
+_Static_assert(sizeof(atomic_int) == sizeof(int), "BFBase refcounts must be updated in place");
+
+#define BFBaseAtomicRefcount(base) ((atomic_int *)&(base)->_refcount)
+#endif
+
 #define BF_BASE_DEBUG_REFCOUNTS 0
 
+#define kBFBaseImmutableFlag (1 << 0)
+
 #if BF_BASE_DEBUG_REFCOUNTS
 int refcountTotal = 0;
 #endif
@@ -34,6 +52,7 @@ void * BFAlloc(size_t size, const BFBaseFunctions * subclass) {
     BFBaseRef base = malloc(size);
     base->subclass = subclass;
     base->_refcount = 0;
+    base->_flags = 0;
     return base;
 }
 
@@ -46,7 +65,12 @@ void BFDealloc(void * object) {
 void * BFRetain(void * object) {
     BFBaseRef base = object;
     if (base) {
+#if BF_BASE_THREAD_SAFE
+        // Taking a new reference needs no ordering; the caller already holds one.
+        atomic_fetch_add_explicit(BFBaseAtomicRefcount(base), 1, memory_order_relaxed);
+#else
         base->_refcount++;
+#endif
 #if BF_BASE_DEBUG_REFCOUNTS
         printf("Retain %s %p (%d refs remaining)\n", base->subclass->name, base, base->_refcount);
         printf("(%d references total)\n", ++refcountTotal);
@@ -58,12 +82,21 @@ void * BFRetain(void * object) {
 void BFRelease(void * object) {
     BFBaseRef base = object;
     if (base) {
-        base->_refcount--;
+#if BF_BASE_THREAD_SAFE
+        // Every release publishes the thread's writes to the object, and the final one acquires them all before
+        // deallocating.
+        int refcount = atomic_fetch_sub_explicit(BFBaseAtomicRefcount(base), 1, memory_order_release) - 1;
+        if (refcount <= 0) {
+            atomic_thread_fence(memory_order_acquire);
+        }
+#else
+        int refcount = --base->_refcount;
+#endif
 #if BF_BASE_DEBUG_REFCOUNTS
-        printf("Release %s %p (%d refs remaining)\n", base->subclass->name, base, base->_refcount);
+        printf("Release %s %p (%d refs remaining)\n", base->subclass->name, base, refcount);
         printf("(%d references total)\n", --refcountTotal);
 #endif
-        if (base->_refcount <= 0) {
+        if (refcount <= 0) {
             if (base->subclass && base->subclass->dealloc) {
                 base->subclass->dealloc((void *)base);
             }
@@ -71,6 +104,18 @@ void BFRelease(void * object) {
     }
 }
 
+void BFMarkImmutable(void * object) {
+    BFBaseRef base = object;
+    if (base) {
+        base->_flags |= kBFBaseImmutableFlag;
+    }
+}
+
+bool BFIsImmutable(void * object) {
+    BFBaseRef base = object;
+    return (base && (base->_flags & kBFBaseImmutableFlag));
+}
+
 const void * BFSubclassFunctions(void * object) {
     BFBaseRef base = object;
     return base->subclass;
@@ -0,0 +1,273 @@
+//
+//  BFBitmapPool.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "butterfly.h"
+#ifdef __APPLE__
+#include "quartz.h"
+#endif
+
+#include "BFCanvas.h"
+
+// Rows start on cache line boundaries, which also keeps them aligned for vector loads and stores.
+#define BF_BITMAP_ALIGNMENT 64
+#define BF_BITMAP_POOL_DEFAULT_MAXIMUM_BYTE_COUNT (128 * 1024 * 1024)
+
+typedef struct BFBitmapPoolEntry {
+    struct BFBitmapPoolEntry * next;
+    void * pixels;
+    size_t width;
+    size_t height;
+    size_t stride;
+#ifdef __APPLE__
+    CGContextRef context;
+#endif
+} BFBitmapPoolEntry;
+
+struct BFBitmapPool {
+    struct BFBase __base;
+    pthread_mutex_t mutex;
+    BFBitmapPoolEntry * entries;
+    size_t byteCount;
+    size_t maximumByteCount;
+};
+
+struct BFBitmap {
+    struct BFBase __base;
+    BFBitmapPoolRef pool;
+    BFBitmapPoolEntry * entry;
+};
+
+static void BFBitmapPoolInit(BFBitmapPoolRef pool, size_t maximumByteCount);
+static void BFBitmapPoolDealloc(BFBitmapPoolRef pool);
+static void BFBitmapDealloc(BFBitmapRef bitmap);
+
+static const BFBaseFunctions poolBaseFunctions = {
+    .name = BFBitmapPoolClassName,
+    .dealloc = (BFBaseDeallocFunction)&BFBitmapPoolDealloc,
+};
+
+static const BFBaseFunctions bitmapBaseFunctions = {
+    .name = BFBitmapClassName,
+    .dealloc = (BFBaseDeallocFunction)&BFBitmapDealloc,
+};
+
+static BFBitmapPoolRef BFBitmapPoolDefault = NULL;
+static pthread_once_t BFBitmapPoolDefaultOnce = PTHREAD_ONCE_INIT;
+
+BFBitmapPoolRef BFBitmapPoolCreate(size_t maximumByteCount) {
+    BFBitmapPoolRef pool = BFAlloc(sizeof(struct BFBitmapPool), &poolBaseFunctions);
+    if (pool) {
+        BFBitmapPoolInit(pool, maximumByteCount);
+    }
+    return BFRetain(pool);
+}
+
+static void BFBitmapPoolCreateDefault(void) {
+    BFBitmapPoolDefault = BFBitmapPoolCreate(BF_BITMAP_POOL_DEFAULT_MAXIMUM_BYTE_COUNT);
+}
+
+BFBitmapPoolRef BFBitmapPoolGetDefault(void) {
+    pthread_once(&BFBitmapPoolDefaultOnce, &BFBitmapPoolCreateDefault);
+    return BFBitmapPoolDefault;
+}
+
+static void BFBitmapPoolInit(BFBitmapPoolRef pool, size_t maximumByteCount) {
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->entries = NULL;
+    pool->byteCount = 0;
+    pool->maximumByteCount = maximumByteCount;
+}
+
+static void BFBitmapPoolEntryFree(BFBitmapPoolEntry * entry) {
+#ifdef __APPLE__
+    CGContextRelease(entry->context);
+#endif
+    free(entry->pixels);
+    free(entry);
+}
+
+static void BFBitmapPoolDealloc(BFBitmapPoolRef pool) {
+    if (pool) {
+        while (pool->entries) {
+            BFBitmapPoolEntry * next = pool->entries->next;
+            BFBitmapPoolEntryFree(pool->entries);
+            pool->entries = next;
+        }
+        pthread_mutex_destroy(&pool->mutex);
+    }
+    BFDealloc(pool);
+}
+
+static BFBitmapPoolEntry * BFBitmapPoolEntryCreate(size_t width, size_t height) {
+    BFBitmapPoolEntry * entry = malloc(sizeof(BFBitmapPoolEntry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->next = NULL;
+    entry->width = width;
+    entry->height = height;
+    entry->stride = (width * 4 + BF_BITMAP_ALIGNMENT - 1) / BF_BITMAP_ALIGNMENT * BF_BITMAP_ALIGNMENT;
+#ifdef __APPLE__
+    entry->context = NULL;
+#endif
+    size_t byteCount = entry->stride * height;
+    if (posix_memalign(&entry->pixels, BF_BITMAP_ALIGNMENT, (byteCount > 0 ? byteCount : 1))) {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+BFBitmapRef BFBitmapPoolCreateBitmap(BFBitmapPoolRef pool, size_t width, size_t height) {
+    BFBitmapRef bitmap = BFAlloc(sizeof(struct BFBitmap), &bitmapBaseFunctions);
+    if (!bitmap) {
+        return NULL;
+    }
+    BFBitmapPoolEntry * entry = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    BFBitmapPoolEntry ** link;
+    for (link = &pool->entries; *link; link = &(*link)->next) {
+        if ((*link)->width == width && (*link)->height == height) {
+            entry = *link;
+            *link = entry->next;
+            pool->byteCount -= entry->stride * entry->height;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    if (!entry) {
+        entry = BFBitmapPoolEntryCreate(width, height);
+        if (!entry) {
+            BFDealloc(bitmap);
+            return NULL;
+        }
+    }
+    // memset is vectorized by the C library, and only runs over the rows' used bytes.
+    size_t row;
+    if (entry->stride == width * 4) {
+        memset(entry->pixels, 0, entry->stride * height);
+    } else {
+        for (row = 0; row < height; row++) {
+            memset((uint8_t *)entry->pixels + row * entry->stride, 0, width * 4);
+        }
+    }
+    entry->next = NULL;
+    bitmap->pool = BFRetain(pool);
+    bitmap->entry = entry;
+    return BFRetain(bitmap);
+}
+
+static void BFBitmapDealloc(BFBitmapRef bitmap) {
+    if (bitmap) {
+        BFBitmapPoolRef pool = bitmap->pool;
+        BFBitmapPoolEntry * entry = bitmap->entry;
+        size_t byteCount = entry->stride * entry->height;
+#ifdef __APPLE__
+        if (entry->context) {
+            // Put the context's graphics state back the way it was when it was created.
+            CGContextRestoreGState(entry->context);
+            CGContextSaveGState(entry->context);
+        }
+#endif
+        pthread_mutex_lock(&pool->mutex);
+        if (byteCount <= pool->maximumByteCount) {
+            // Make room by dropping the least recently returned buffers, which are at the end.
+            while (pool->byteCount + byteCount > pool->maximumByteCount) {
+                BFBitmapPoolEntry ** link = &pool->entries;
+                while ((*link)->next) {
+                    link = &(*link)->next;
+                }
+                pool->byteCount -= (*link)->stride * (*link)->height;
+                BFBitmapPoolEntryFree(*link);
+                *link = NULL;
+            }
+            entry->next = pool->entries;
+            pool->entries = entry;
+            pool->byteCount += byteCount;
+            entry = NULL;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (entry) {
+            BFBitmapPoolEntryFree(entry);
+        }
+        BFRelease(pool);
+    }
+    BFDealloc(bitmap);
+}
+
+void * BFBitmapGetPixels(BFBitmapRef bitmap) {
+    return bitmap->entry->pixels;
+}
+
+size_t BFBitmapGetStride(BFBitmapRef bitmap) {
+    return bitmap->entry->stride;
+}
+
+size_t BFBitmapGetWidth(BFBitmapRef bitmap) {
+    return bitmap->entry->width;
+}
+
+size_t BFBitmapGetHeight(BFBitmapRef bitmap) {
+    return bitmap->entry->height;
+}
+
+#ifdef __APPLE__
+
+CGContextRef BFBitmapGetCGContext(BFBitmapRef bitmap) {
+    BFBitmapPoolEntry * entry = bitmap->entry;
+    if (!entry->context) {
+        // Kept with the buffer, so a recycled bitmap comes with its context already set up.
+        CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+        entry->context = CGBitmapContextCreate(entry->pixels, entry->width, entry->height, 8, entry->stride, colorSpace, kCGImageAlphaPremultipliedLast);
+        CGColorSpaceRelease(colorSpace);
+        if (entry->context) {
+            CGContextSaveGState(entry->context);
+        }
+    }
+    return entry->context;
+}
+
+#endif
+
+BFCanvasRef BFBitmapCreateCanvas(BFBitmapRef bitmap, BFCanvasMetricsRef metrics) {
+#ifdef __APPLE__
+    CGContextRef context = BFBitmapGetCGContext(bitmap);
+    BFCanvasRef canvas = (context ? BFCanvasCreateForDisplay(context, metrics) : NULL);
+#else
+    // Without Quartz the canvas rasterizes into the pixels itself, so they have to cover the whole bounds rect.
+    BFRect boundsRect = BFCanvasMetricsGetBoundsRect(metrics);
+    double backingScale = BFCanvasMetricsGetBackingScale(metrics);
+    bool fits = (round((boundsRect.right - boundsRect.left) * backingScale) <= bitmap->entry->width && round((boundsRect.top - boundsRect.bottom) * backingScale) <= bitmap->entry->height);
+    BFCanvasRef canvas = (fits ? BFCanvasCreateForBitmap(bitmap->entry->pixels, bitmap->entry->stride, metrics) : NULL);
+#endif
+    if (canvas) {
+        BFCanvasSetBitmapOwner(canvas, bitmap);
+    }
+    return canvas;
+}
@@ -0,0 +1,145 @@
+//
+//  BFBuffer.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <stdlib.h>
+
+#include "butterfly.h"
+
+struct BFBuffer {
+    struct BFBase __base;
+    BFBufferType type;
+    size_t count;
+    void * bytes;
+    BFBufferDeallocFunction deallocFunction;
+    void * info;
+};
+
+static void BFBufferInit(BFBufferRef buffer, BFBufferType type, size_t count, void * bytes, BFBufferDeallocFunction deallocFunction, void * info);
+static void BFBufferDealloc(BFBufferRef buffer);
+static void BFBufferFreeBytes(void * bytes, void * info);
+
+static const BFBaseFunctions baseFunctions = {
+    .name = BFBufferClassName,
+    .dealloc = (BFBaseDeallocFunction)&BFBufferDealloc,
+};
+
+static size_t BFBufferTypeGetSize(BFBufferType type) {
+    return (type == kBFBufferTypeFloat ? sizeof(float) : sizeof(double));
+}
+
+BFBufferRef BFBufferCreate(BFBufferType type, size_t count) {
+    void * bytes = calloc(count ? count : 1, BFBufferTypeGetSize(type));
+    if (!bytes) {
+        return NULL;
+    }
+    BFBufferRef buffer = BFAlloc(sizeof(struct BFBuffer), &baseFunctions);
+    if (buffer) {
+        BFBufferInit(buffer, type, count, bytes, &BFBufferFreeBytes, NULL);
+    } else {
+        free(bytes);
+    }
+    return BFRetain(buffer);
+}
+
+BFBufferRef BFBufferCreateWithBytesNoCopy(void * bytes, BFBufferType type, size_t count, BFBufferDeallocFunction deallocFunction, void * info) {
+    // The bytes are used in place, and handed to the dealloc function (if any) when the buffer goes away.
+    BFBufferRef buffer = BFAlloc(sizeof(struct BFBuffer), &baseFunctions);
+    if (buffer) {
+        BFBufferInit(buffer, type, count, bytes, deallocFunction, info);
+    }
+    return BFRetain(buffer);
+}
+
+static void BFBufferInit(BFBufferRef buffer, BFBufferType type, size_t count, void * bytes, BFBufferDeallocFunction deallocFunction, void * info) {
+    buffer->type = type;
+    buffer->count = count;
+    buffer->bytes = bytes;
+    buffer->deallocFunction = deallocFunction;
+    buffer->info = info;
+}
+
+static void BFBufferDealloc(BFBufferRef buffer) {
+    if (buffer) {
+        if (buffer->deallocFunction) {
+            buffer->deallocFunction(buffer->bytes, buffer->info);
+        }
+    }
+    BFDealloc(buffer);
+}
+
+static void BFBufferFreeBytes(void * bytes, void * info) {
+    free(bytes);
+}
+
+BFBufferType BFBufferGetType(BFBufferRef buffer) {
+    return buffer->type;
+}
+
+size_t BFBufferGetCount(BFBufferRef buffer) {
+    return buffer->count;
+}
+
+void * BFBufferGetBytes(BFBufferRef buffer) {
+    return buffer->bytes;
+}
+
+double BFBufferGetValue(BFBufferRef buffer, size_t index) {
+    if (index >= buffer->count) {
+        return 0;
+    }
+    if (buffer->type == kBFBufferTypeFloat) {
+        return ((const float *)buffer->bytes)[index];
+    } else {
+        return ((const double *)buffer->bytes)[index];
+    }
+}
+
+void BFBufferSetValue(BFBufferRef buffer, size_t index, double value) {
+    if (index >= buffer->count) {
+        return;
+    }
+    if (buffer->type == kBFBufferTypeFloat) {
+        ((float *)buffer->bytes)[index] = value;
+    } else {
+        ((double *)buffer->bytes)[index] = value;
+    }
+}
+
+size_t BFBufferGetPointCount(BFBufferRef buffer) {
+    return buffer->count / 2;
+}
+
+BFPoint BFBufferGetPoint(BFBufferRef buffer, size_t index) {
+    // Points are stored as interleaved x and y values.
+    if (index >= buffer->count / 2) {
+        return (BFPoint){ .x = 0, .y = 0 };
+    }
+    if (buffer->type == kBFBufferTypeFloat) {
+        const float * values = (const float *)buffer->bytes + index * 2;
+        return (BFPoint){ .x = values[0], .y = values[1] };
+    } else {
+        const double * values = (const double *)buffer->bytes + index * 2;
+        return (BFPoint){ .x = values[0], .y = values[1] };
+    }
+}
@@ -22,109 +22,256 @@
 //  THE SOFTWARE.
 //
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
+
+#include "BFCanvas.h"
+#include "BFDisplayList.h"
+#include "BFPaint.h"
+#include "BFPath.h"
+#include "BFRaster.h"
 
 typedef enum BFCanvasType {
     kBFCanvasDisplay,
     kBFCanvasHitTest,
+    kBFCanvasBitmap,
+    kBFCanvasRecording,
 } BFCanvasType;
 
 typedef struct BFCanvasState {
     BFPaintRef paint;
     BFFontRef font;
-    struct BFCanvasState * next;
+    BFTransformationComponents transformation;
+    double thickness;
+    double opacity;
+    BFPaintModeType paintModeType;
+    BFRasterClip clip;
+    uint8_t * hitTestClip;
+    // A pushed state lends its paint, font and hit-test clip to the one above it until they're replaced.
+    bool ownsPaint;
+    bool ownsFont;
+    bool ownsHitTestClip;
+#ifdef __APPLE__
+    // Whether the Quartz graphics state has been saved for this level. Until something that can't be undone
+    // cheaply (a clip or a transformation) happens, popping just resets the line width, alpha and blend mode.
+    bool contextSaved;
+    double contextThickness;
+    double contextOpacity;
+    BFPaintModeType contextPaintModeType;
+#endif
 } BFCanvasState;
 
 struct BFCanvas {
     struct BFBase __base;
     BFCanvasType type;
+#ifdef __APPLE__
     CGContextRef context;
+#endif
     BFCanvasMetricsRef metrics;
     BFRect dirtyRect;
+    BFCanvasCullingStatistics cullingStatistics;
+    unsigned long changeCount;
     BFCanvasState state;
-    unsigned char hitTestData;
+    BFCanvasState * stack;
+    size_t stackCount;
+    size_t stackCapacity;
+    // Pushes that couldn't grow the stack. The pops matching them are ignored, so the pops after them still restore
+    // the right states.
+    size_t failedPushCount;
+    BFPoint * hitTestPoints;
+    size_t hitTestPointCount;
+    uint8_t * hitTestResults;
+    uint8_t * hitTestLastResults;
+    BFRasterBitmap bitmap;
+    BFTransformationComponents deviceTransformation;
+    BFRasterizer * rasterizer;
+    BFDisplayListRef displayList;
+    BFBitmapRef bitmapOwner;
 };
 
-static void BFCanvasInit(BFCanvasRef canvas, BFCanvasType type, CGContextRef context, BFCanvasMetricsRef metrics);
+static void BFCanvasInit(BFCanvasRef canvas, BFCanvasType type, BFCanvasMetricsRef metrics);
 static void BFCanvasDealloc(BFCanvasRef canvas);
 
-CF_RETURNS_RETAINED static CGContextRef BFCanvasNewBitmapContext(void * data);
+#ifdef __APPLE__
 static void BFCanvasStrokeCGPath(BFCanvasRef canvas, CGPathRef path);
 static void BFCanvasFillCGPath(BFCanvasRef canvas, CGPathRef path);
-static void BFCanvasFillClipBoundingBox(BFCanvasRef canvas);
+static void BFCanvasFillClipBoundingBox(BFCanvasRef canvas, BFPaintRef paint, CGRect bounds);
+static void BFCanvasSaveContext(BFCanvasRef canvas);
+#endif
+static BFTransformationComponents BFCanvasGetDeviceTransformation(BFCanvasRef canvas);
+static void BFCanvasRasterFill(BFCanvasRef canvas, BFTransformationComponents transformation);
+static void BFCanvasHitTestFill(BFCanvasRef canvas);
+static void BFCanvasHitTestClip(BFCanvasRef canvas);
+static void BFCanvasRecord(BFCanvasRef canvas, BFDisplayListCommandType type, void * object);
+static void BFCanvasRecordDrawing(BFCanvasRef canvas, BFDisplayListCommand command, BFRect rect, double outset);
 
 static const BFBaseFunctions baseFunctions = {
     .name = BFCanvasClassName,
     .dealloc = (BFBaseDeallocFunction)&BFCanvasDealloc,
 };
 
+#ifdef __APPLE__
+
 BFCanvasRef BFCanvasCreateForDisplay(CGContextRef context, BFCanvasMetricsRef metrics) {
     BFCanvasRef canvas = BFAlloc(sizeof(struct BFCanvas), &baseFunctions);
     if (canvas) {
-        BFCanvasInit(canvas, kBFCanvasDisplay, context, metrics);
+        BFCanvasInit(canvas, kBFCanvasDisplay, metrics);
+        canvas->context = CGContextRetain(context);
+        if (context) {
+            CGContextSetLineCap(context, kCGLineCapButt);
+            CGContextSetLineJoin(context, kCGLineJoinRound);
+            CGContextSetMiterLimit(context, 2);
+        }
+    }
+    return BFRetain(canvas);
+}
+
+#endif
+
+BFCanvasRef BFCanvasCreateForBitmap(void * pixels, size_t stride, BFCanvasMetricsRef metrics) {
+    BFCanvasRef canvas = BFAlloc(sizeof(struct BFCanvas), &baseFunctions);
+    if (canvas) {
+        BFCanvasInit(canvas, kBFCanvasBitmap, metrics);
+        BFRect boundsRect = BFCanvasMetricsGetBoundsRect(metrics);
+        double backingScale = BFCanvasMetricsGetBackingScale(metrics);
+        canvas->bitmap.pixels = pixels;
+        canvas->bitmap.stride = stride;
+        // A canvas without pixels has an empty clip, so everything drawn into it is culled.
+        canvas->bitmap.width = (pixels ? (int)round((boundsRect.right - boundsRect.left) * backingScale) : 0);
+        canvas->bitmap.height = (pixels ? (int)round((boundsRect.top - boundsRect.bottom) * backingScale) : 0);
+        // Pixel rows run top to bottom, so the device space is flipped relative to the bounds rect.
+        canvas->deviceTransformation = BFRasterMatrixMake(backingScale, 0, 0, -backingScale, -boundsRect.left * backingScale, boundsRect.top * backingScale);
+        canvas->state.clip.box = (BFRasterBox){ .left = 0, .top = 0, .right = canvas->bitmap.width, .bottom = canvas->bitmap.height };
+        canvas->rasterizer = BFRasterizerCreate();
+    }
+    return BFRetain(canvas);
+}
+
+BFCanvasRef BFCanvasCreateForRecording(BFCanvasMetricsRef metrics) {
+    BFCanvasRef canvas = BFAlloc(sizeof(struct BFCanvas), &baseFunctions);
+    if (canvas) {
+        BFCanvasInit(canvas, kBFCanvasRecording, metrics);
+        canvas->displayList = BFDisplayListCreate();
     }
     return BFRetain(canvas);
 }
 
 BFCanvasRef BFCanvasCreateForHitTest(BFCanvasMetricsRef metrics) {
+    // The center of the unit square at the origin, which is what the single-pixel hit test used to sample.
+    BFPoint point = { .x = 0.5, .y = 0.5 };
+    return BFCanvasCreateForHitTestPoints(metrics, &point, 1);
+}
+
+BFCanvasRef BFCanvasCreateForHitTestPoints(BFCanvasMetricsRef metrics, const BFPoint points[], size_t pointCount) {
     BFCanvasRef canvas = BFAlloc(sizeof(struct BFCanvas), &baseFunctions);
     if (canvas) {
-        CGContextRef context = BFCanvasNewBitmapContext(&canvas->hitTestData);
-        BFCanvasInit(canvas, kBFCanvasHitTest, context, metrics);
-        CGContextRelease(context);
+        BFCanvasInit(canvas, kBFCanvasHitTest, metrics);
+        canvas->hitTestPoints = malloc(pointCount * sizeof(BFPoint));
+        canvas->hitTestResults = calloc(pointCount, 1);
+        canvas->hitTestLastResults = calloc(pointCount, 1);
+        if (canvas->hitTestPoints && canvas->hitTestResults && canvas->hitTestLastResults) {
+            memcpy(canvas->hitTestPoints, points, pointCount * sizeof(BFPoint));
+            canvas->hitTestPointCount = pointCount;
+        }
+        canvas->rasterizer = BFRasterizerCreate();
     }
     return BFRetain(canvas);
 }
 
-static void BFCanvasInit(BFCanvasRef canvas, BFCanvasType type, CGContextRef context, BFCanvasMetricsRef metrics) {
+static void BFCanvasInit(BFCanvasRef canvas, BFCanvasType type, BFCanvasMetricsRef metrics) {
     canvas->type = type;
-    canvas->context = CGContextRetain(context);
+#ifdef __APPLE__
+    canvas->context = NULL;
+#endif
     canvas->metrics = BFRetain(metrics);
+    canvas->bitmapOwner = NULL;
     BFCanvasSetDirtyRect(canvas, BFCanvasMetricsGetBoundsRect(metrics));
-    BFColorPaintRef colorPaint = BFColorPaintCreate();
-    BFColorPaintSetRGBA(colorPaint, 0, 0, 0, 1);
-    canvas->state.paint = (BFPaintRef)colorPaint;
+    BFCanvasResetCullingStatistics(canvas);
+    canvas->changeCount = 0;
+    canvas->state.paint = (BFPaintRef)BFColorPaintCreateWithRGBA(0, 0, 0, 1);
+#ifdef __APPLE__
     canvas->state.font = BFFontCreate("Helvetica", 14);
-    canvas->state.next = NULL;
-    canvas->hitTestData = 0xff;
-    CGContextSetLineCap(context, kCGLineCapButt);
-    CGContextSetLineJoin(context, kCGLineJoinRound);
-    CGContextSetMiterLimit(context, 2);
+#else
+    // Fonts come from Core Text, so text isn't drawn without it.
+    canvas->state.font = NULL;
+#endif
+    canvas->state.transformation = BFRasterMatrixMake(1, 0, 0, 1, 0, 0);
+    canvas->state.thickness = 1;
+    canvas->state.opacity = 1;
+    canvas->state.paintModeType = kBFPaintModeNormal;
+    canvas->state.clip = (BFRasterClip){ .box = { 0, 0, 0, 0 }, .mask = NULL };
+    canvas->state.hitTestClip = NULL;
+    canvas->state.ownsPaint = true;
+    canvas->state.ownsFont = true;
+    canvas->state.ownsHitTestClip = true;
+#ifdef __APPLE__
+    canvas->state.contextSaved = false;
+#endif
+    canvas->stack = NULL;
+    canvas->stackCount = 0;
+    canvas->stackCapacity = 0;
+    canvas->failedPushCount = 0;
+    canvas->hitTestPoints = NULL;
+    canvas->hitTestPointCount = 0;
+    canvas->hitTestResults = NULL;
+    canvas->hitTestLastResults = NULL;
+    canvas->bitmap = (BFRasterBitmap){ .pixels = NULL, .stride = 0, .width = 0, .height = 0 };
+    canvas->deviceTransformation = BFRasterMatrixMake(1, 0, 0, 1, 0, 0);
+    canvas->rasterizer = NULL;
+    canvas->displayList = NULL;
 }
 
 static void BFCanvasDealloc(BFCanvasRef canvas) {
     if (canvas) {
         BFCanvasNukeStack(canvas);
+        free(canvas->stack);
+#ifdef __APPLE__
         CGContextRelease(canvas->context);
+#endif
         BFRelease(canvas->metrics);
         BFRelease(canvas->state.paint);
         BFRelease(canvas->state.font);
+        BFRelease(canvas->state.clip.mask);
+        free(canvas->state.hitTestClip);
+        free(canvas->hitTestPoints);
+        free(canvas->hitTestResults);
+        free(canvas->hitTestLastResults);
+        BFRasterizerDestroy(canvas->rasterizer);
+        BFRelease(canvas->displayList);
+        BFRelease(canvas->bitmapOwner);
     }
     BFDealloc(canvas);
 }
 
-CF_RETURNS_RETAINED
-static CGContextRef BFCanvasNewBitmapContext(void * data) {
-    CGColorSpaceRef colorSpace;
-    CGContextRef context;
-    
-    colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceGenericGray);
-    context = CGBitmapContextCreate(data, 1, 1, 8, 1, colorSpace, kCGImageAlphaNone);
-    CGColorSpaceRelease(colorSpace);
-    
-    if (context) {
-        CGContextSetShouldAntialias(context, false);
-        CGContextSetShouldSmoothFonts(context, false);
-    }
-    
-    return context;
-}
+#ifdef __APPLE__
 
 CGContextRef BFCanvasGetCGContext(BFCanvasRef canvas) {
     return canvas->context;
 }
 
+void BFCanvasNoteChanged(BFCanvasRef canvas) {
+    canvas->changeCount++;
+}
+
+#endif
+
+unsigned long BFCanvasGetChangeCount(BFCanvasRef canvas) {
+    return canvas->changeCount;
+}
+
+void BFCanvasSetBitmapOwner(BFCanvasRef canvas, BFBitmapRef bitmap) {
+    // Keeps a pooled bitmap from going back to its pool while the canvas can still draw into it.
+    BFRetain(bitmap);
+    BFRelease(canvas->bitmapOwner);
+    canvas->bitmapOwner = bitmap;
+}
+
 BFCanvasMetricsRef BFCanvasGetMetrics(BFCanvasRef canvas) {
     return canvas->metrics;
 }
@@ -137,30 +284,55 @@ BFRect BFCanvasGetDirtyRect(BFCanvasRef canvas) {
     return canvas->dirtyRect;
 }
 
+BFCanvasCullingStatistics BFCanvasGetCullingStatistics(BFCanvasRef canvas) {
+    return canvas->cullingStatistics;
+}
+
+void BFCanvasResetCullingStatistics(BFCanvasRef canvas) {
+    canvas->cullingStatistics = (BFCanvasCullingStatistics){ .drawnCount = 0, .culledCount = 0 };
+}
+
 void BFCanvasSetOpacity(BFCanvasRef canvas, double opacity) {
-    if (canvas->type != kBFCanvasHitTest) {
+    canvas->state.opacity = opacity;
+    if (canvas->type == kBFCanvasDisplay) {
+#ifdef __APPLE__
         CGContextSetAlpha(canvas->context, opacity);
+#endif
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFDisplayListAppendCommand(canvas->displayList, (BFDisplayListCommand){ .type = kBFDisplayListSetOpacity, .value = opacity });
     }
 }
 
 void BFCanvasSetPaint(BFCanvasRef canvas, BFPaintRef paint) {
     if (paint && canvas->type != kBFCanvasHitTest) {
         BFRetain(paint);
-        BFRelease(canvas->state.paint);
+        if (canvas->state.ownsPaint) {
+            BFRelease(canvas->state.paint);
+        }
         canvas->state.paint = paint;
+        canvas->state.ownsPaint = true;
+        BFCanvasRecord(canvas, kBFDisplayListSetPaint, paint);
     }
 }
 
 void BFCanvasSetPaintMode(BFCanvasRef canvas, BFPaintModeRef paintMode) {
-    if (canvas->type != kBFCanvasHitTest) {
+    canvas->state.paintModeType = BFPaintModeGetType(paintMode);
+#ifdef __APPLE__
+    if (canvas->type == kBFCanvasDisplay) {
         CGContextSetBlendMode(canvas->context, BFPaintModeCGBlendMode(paintMode));
     }
+#endif
+    BFCanvasRecord(canvas, kBFDisplayListSetPaintMode, paintMode);
 }
 
 void BFCanvasSetFont(BFCanvasRef canvas, BFFontRef font) {
     BFRetain(font);
-    BFRelease(canvas->state.font);
+    if (canvas->state.ownsFont) {
+        BFRelease(canvas->state.font);
+    }
     canvas->state.font = font;
+    canvas->state.ownsFont = true;
+    BFCanvasRecord(canvas, kBFDisplayListSetFont, font);
 }
 
 BFFontRef BFCanvasGetFont(BFCanvasRef canvas) {
@@ -168,60 +340,212 @@ BFFontRef BFCanvasGetFont(BFCanvasRef canvas) {
 }
 
 void BFCanvasSetThickness(BFCanvasRef canvas, double thickness) {
-    CGContextSetLineWidth(canvas->context, thickness);
+    canvas->state.thickness = thickness;
+    if (canvas->type == kBFCanvasRecording) {
+        BFDisplayListAppendCommand(canvas->displayList, (BFDisplayListCommand){ .type = kBFDisplayListSetThickness, .value = thickness });
+    }
+#ifdef __APPLE__
+    if (canvas->context) {
+        CGContextSetLineWidth(canvas->context, thickness);
+    }
+#endif
 }
 
 void BFCanvasConcatTransformation(BFCanvasRef canvas, BFTransformationRef transformation) {
-    CGContextConcatCTM(canvas->context, BFTransformationGetCGAffineTransform(transformation));
+    canvas->state.transformation = BFRasterMatrixConcat(BFTransformationGetComponents(transformation), canvas->state.transformation);
+#ifdef __APPLE__
+    if (canvas->context) {
+        BFCanvasSaveContext(canvas);
+        CGContextConcatCTM(canvas->context, BFTransformationGetCGAffineTransform(transformation));
+    }
+#endif
+    BFCanvasRecord(canvas, kBFDisplayListConcatTransformation, transformation);
+}
+
+BFTransformationComponents BFCanvasGetTransformationComponents(BFCanvasRef canvas) {
+    return canvas->state.transformation;
+}
+
+static bool BFCanvasIsIntegral(double value) {
+    return (fabs(value) < 1e9 && fabs(value - round(value)) < 1e-6);
 }
 
 void BFCanvasClipRect(BFCanvasRef canvas, BFRect rect) {
-    CGContextClipToRect(canvas->context, BFRectToCGRect(rect));
+    if (canvas->type == kBFCanvasBitmap) {
+        BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+        if (transformation.b == 0 && transformation.c == 0) {
+            // Pixel-aligned rects only need to shrink the clip box.
+            BFPoint corner1 = BFRasterMatrixTransformPoint(transformation, (BFPoint){ .x = rect.left, .y = rect.bottom });
+            BFPoint corner2 = BFRasterMatrixTransformPoint(transformation, (BFPoint){ .x = rect.right, .y = rect.top });
+            if (BFCanvasIsIntegral(corner1.x) && BFCanvasIsIntegral(corner1.y) && BFCanvasIsIntegral(corner2.x) && BFCanvasIsIntegral(corner2.y)) {
+                BFRasterBox box = {
+                    .left = (int)round(fmin(corner1.x, corner2.x)),
+                    .top = (int)round(fmin(corner1.y, corner2.y)),
+                    .right = (int)round(fmax(corner1.x, corner2.x)),
+                    .bottom = (int)round(fmax(corner1.y, corner2.y)),
+                };
+                canvas->state.clip.box = BFRasterBoxIntersect(canvas->state.clip.box, box);
+                return;
+            }
+        }
+        BFRasterizerBeginFill(canvas->rasterizer, transformation);
+        BFRasterizerAddRect(canvas->rasterizer, rect);
+        BFRasterizerClip(canvas->rasterizer, &canvas->state.clip, NULL);
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+        BFRasterizerAddRect(canvas->rasterizer, rect);
+        BFCanvasHitTestClip(canvas);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFDisplayListAppendCommand(canvas->displayList, (BFDisplayListCommand){ .type = kBFDisplayListClipRect, .rect = rect });
+    } else {
+#ifdef __APPLE__
+        BFCanvasSaveContext(canvas);
+        CGContextClipToRect(canvas->context, BFRectToCGRect(rect));
+#endif
+    }
 }
 
 void BFCanvasClipPath(BFCanvasRef canvas, const BFPathRef path) {
-    CGContextAddPath(canvas->context, BFPathGetCGPath(path));
-    if (!CGContextIsPathEmpty(canvas->context)) {
-        CGContextClip(canvas->context);
+    if (canvas->type == kBFCanvasBitmap) {
+        BFRasterizerBeginFill(canvas->rasterizer, BFCanvasGetDeviceTransformation(canvas));
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        if (!BFRasterizerIsEmpty(canvas->rasterizer)) {
+            BFRasterizerClip(canvas->rasterizer, &canvas->state.clip, NULL);
+        }
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        if (!BFRasterizerIsEmpty(canvas->rasterizer)) {
+            BFCanvasHitTestClip(canvas);
+        }
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFCanvasRecord(canvas, kBFDisplayListClipPath, path);
+    } else {
+#ifdef __APPLE__
+        CGContextAddPath(canvas->context, BFPathGetCGPath(path));
+        if (!CGContextIsPathEmpty(canvas->context)) {
+            BFCanvasSaveContext(canvas);
+            CGContextClip(canvas->context);
+        }
+#endif
     }
 }
 
 void BFCanvasClipIcon(BFCanvasRef canvas, const BFIconRef icon, BFRect rect) {
-    CGImageRef image = BFIconCopyCGImage(icon);
-    CGContextClipToMask(canvas->context, BFRectToCGRect(rect), image);
-    CGImageRelease(image);
+    if (canvas->type == kBFCanvasBitmap) {
+        BFRasterImage image = { .rect = rect };
+        if (BFIconGetRasterBitmap(icon, &image.bitmap)) {
+            BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+            BFRasterSource source;
+            BFRasterSourceInitWithImage(&source, &image, BFRasterMatrixInvert(transformation));
+            BFRasterizerBeginFill(canvas->rasterizer, transformation);
+            BFRasterizerAddRect(canvas->rasterizer, rect);
+            BFRasterizerClip(canvas->rasterizer, &canvas->state.clip, &source);
+        }
+    } else if (canvas->type == kBFCanvasHitTest) {
+        // Icons clip to their whole rect; transparent pixels aren't sampled.
+        BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+        BFRasterizerAddRect(canvas->rasterizer, rect);
+        BFCanvasHitTestClip(canvas);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFDisplayListAppendCommand(canvas->displayList, (BFDisplayListCommand){ .type = kBFDisplayListClipIcon, .object = icon, .rect = rect });
+    } else {
+#ifdef __APPLE__
+        CGImageRef image = BFIconCopyCGImage(icon);
+        BFCanvasSaveContext(canvas);
+        CGContextClipToMask(canvas->context, BFRectToCGRect(rect), image);
+        CGImageRelease(image);
+#endif
+    }
 }
 
-void BFCanvasPush(BFCanvasRef canvas) {
-    BFCanvasState * oldState = (BFCanvasState *)malloc(sizeof(BFCanvasState));
-    if (oldState) {
-        oldState->paint = BFRetain(canvas->state.paint);
-        oldState->font = BFRetain(canvas->state.font);
-        oldState->next = canvas->state.next;
-        canvas->state.next = oldState;
+#ifdef __APPLE__
+
+static void BFCanvasSaveContext(BFCanvasRef canvas) {
+    if (canvas->stackCount > 0 && !canvas->state.contextSaved) {
         CGContextSaveGState(canvas->context);
-    } else {
-        // TODO: error!
+        canvas->state.contextSaved = true;
+        canvas->state.contextThickness = canvas->state.thickness;
+        canvas->state.contextOpacity = canvas->state.opacity;
+        canvas->state.contextPaintModeType = canvas->state.paintModeType;
+    }
+}
+
+#endif
+
+void BFCanvasPush(BFCanvasRef canvas) {
+    if (canvas->stackCount == canvas->stackCapacity) {
+        size_t capacity = (canvas->stackCapacity ? canvas->stackCapacity * 2 : 16);
+        BFCanvasState * stack = realloc(canvas->stack, capacity * sizeof(BFCanvasState));
+        if (!stack) {
+            canvas->failedPushCount++;
+            return;
+        }
+        canvas->stack = stack;
+        canvas->stackCapacity = capacity;
     }
+    canvas->stack[canvas->stackCount++] = canvas->state;
+    BFRetain(canvas->state.clip.mask);
+    canvas->state.ownsPaint = false;
+    canvas->state.ownsFont = false;
+    canvas->state.ownsHitTestClip = false;
+#ifdef __APPLE__
+    canvas->state.contextSaved = false;
+#endif
+    BFCanvasRecord(canvas, kBFDisplayListPush, NULL);
 }
 
 void BFCanvasPop(BFCanvasRef canvas) {
-    BFCanvasState * oldState = canvas->state.next;
-    if (canvas->state.next) {
-        BFRelease(canvas->state.paint);
-        BFRelease(canvas->state.font);
-        memcpy(&(canvas->state), oldState, sizeof(BFCanvasState));
-        free(oldState);
-        CGContextRestoreGState(canvas->context);
+    if (canvas->failedPushCount > 0) {
+        canvas->failedPushCount--;
+    } else if (canvas->stackCount > 0) {
+        const BFCanvasState * oldState = &canvas->stack[--canvas->stackCount];
+#ifdef __APPLE__
+        if (canvas->context) {
+            double thickness = canvas->state.thickness;
+            double opacity = canvas->state.opacity;
+            BFPaintModeType paintModeType = canvas->state.paintModeType;
+            if (canvas->state.contextSaved) {
+                CGContextRestoreGState(canvas->context);
+                thickness = canvas->state.contextThickness;
+                opacity = canvas->state.contextOpacity;
+                paintModeType = canvas->state.contextPaintModeType;
+            }
+            if (thickness != oldState->thickness) {
+                CGContextSetLineWidth(canvas->context, oldState->thickness);
+            }
+            if (canvas->type == kBFCanvasDisplay && opacity != oldState->opacity) {
+                CGContextSetAlpha(canvas->context, oldState->opacity);
+            }
+            if (canvas->type == kBFCanvasDisplay && paintModeType != oldState->paintModeType) {
+                CGContextSetBlendMode(canvas->context, BFPaintModeTypeCGBlendMode(oldState->paintModeType));
+            }
+        }
+#endif
+        if (canvas->state.ownsPaint) {
+            BFRelease(canvas->state.paint);
+        }
+        if (canvas->state.ownsFont) {
+            BFRelease(canvas->state.font);
+        }
+        if (canvas->state.ownsHitTestClip) {
+            free(canvas->state.hitTestClip);
+        }
+        BFRelease(canvas->state.clip.mask);
+        canvas->state = *oldState;
+        BFCanvasRecord(canvas, kBFDisplayListPop, NULL);
     }
 }
 
 void BFCanvasNukeStack(BFCanvasRef canvas) {
-    while (canvas->state.next) {
+    canvas->failedPushCount = 0;
+    while (canvas->stackCount > 0) {
         BFCanvasPop(canvas);
     }
 }
 
+#ifdef __APPLE__
+
 static void BFCanvasStrokeCGPath(BFCanvasRef canvas, CGPathRef path) {
     CGContextAddPath(canvas->context, path);
     if (BFPaintSetInContext(canvas->state.paint, canvas->context)) {
@@ -229,8 +553,9 @@ static void BFCanvasStrokeCGPath(BFCanvasRef canvas, CGPathRef path) {
     } else {
         if (!CGContextIsPathEmpty(canvas->context)) {
             CGContextReplacePathWithStrokedPath(canvas->context);
+            CGRect bounds = CGContextGetPathBoundingBox(canvas->context);
             CGContextClip(canvas->context);
-            BFCanvasFillClipBoundingBox(canvas);
+            BFCanvasFillClipBoundingBox(canvas, canvas->state.paint, bounds);
         }
     }
 }
@@ -241,36 +566,528 @@ static void BFCanvasFillCGPath(BFCanvasRef canvas, CGPathRef path) {
         CGContextDrawPath(canvas->context, kCGPathFill);
     } else {
         if (!CGContextIsPathEmpty(canvas->context)) {
+            CGRect bounds = CGContextGetPathBoundingBox(canvas->context);
             CGContextClip(canvas->context);
-            BFCanvasFillClipBoundingBox(canvas);
+            BFCanvasFillClipBoundingBox(canvas, canvas->state.paint, bounds);
+        }
+    }
+}
+
+#endif
+
+static BFTransformationComponents BFCanvasGetDeviceTransformation(BFCanvasRef canvas) {
+    return BFRasterMatrixConcat(canvas->state.transformation, canvas->deviceTransformation);
+}
+
+static void BFCanvasRasterFill(BFCanvasRef canvas, BFTransformationComponents transformation) {
+    BFRasterSource source;
+    if (BFPaintGetRasterSource(canvas->state.paint, BFRasterMatrixInvert(transformation), &source)) {
+        BFRasterizerFill(canvas->rasterizer, &canvas->bitmap, &canvas->state.clip, &source, canvas->state.opacity, canvas->state.paintModeType);
+    }
+}
+
+static void BFCanvasHitTestFill(BFCanvasRef canvas) {
+    size_t index;
+    BFRasterizerHitTest(canvas->rasterizer, canvas->hitTestPoints, canvas->hitTestPointCount, canvas->state.hitTestClip, canvas->hitTestLastResults);
+    for (index = 0; index < canvas->hitTestPointCount; index++) {
+        canvas->hitTestResults[index] |= canvas->hitTestLastResults[index];
+    }
+}
+
+static void BFCanvasHitTestAccumulate(BFCanvasRef canvas, uint8_t * batchResults) {
+    // A batch counts as one drawing call, so its last results are the union of its items'.
+    if (batchResults) {
+        size_t index;
+        for (index = 0; index < canvas->hitTestPointCount; index++) {
+            batchResults[index] |= canvas->hitTestLastResults[index];
+        }
+    }
+}
+
+static void BFCanvasHitTestFinishBatch(BFCanvasRef canvas, uint8_t * batchResults) {
+    if (batchResults) {
+        memcpy(canvas->hitTestLastResults, batchResults, canvas->hitTestPointCount);
+        free(batchResults);
+    }
+}
+
+static void BFCanvasHitTestClip(BFCanvasRef canvas) {
+    if (!canvas->state.hitTestClip || !canvas->state.ownsHitTestClip) {
+        uint8_t * hitTestClip = malloc(canvas->hitTestPointCount);
+        if (!hitTestClip) {
+            return;
+        }
+        if (canvas->state.hitTestClip) {
+            memcpy(hitTestClip, canvas->state.hitTestClip, canvas->hitTestPointCount);
+        } else {
+            memset(hitTestClip, 1, canvas->hitTestPointCount);
         }
+        canvas->state.hitTestClip = hitTestClip;
+        canvas->state.ownsHitTestClip = true;
+    }
+    BFRasterizerHitTest(canvas->rasterizer, canvas->hitTestPoints, canvas->hitTestPointCount, canvas->state.hitTestClip, canvas->state.hitTestClip);
+}
+
+static void BFCanvasRecord(BFCanvasRef canvas, BFDisplayListCommandType type, void * object) {
+    if (canvas->type == kBFCanvasRecording) {
+        BFDisplayListAppendCommand(canvas->displayList, (BFDisplayListCommand){ .type = type, .object = object });
     }
 }
 
+static void BFCanvasRecordDrawing(BFCanvasRef canvas, BFDisplayListCommand command, BFRect rect, double outset) {
+    rect.left -= outset;
+    rect.bottom -= outset;
+    rect.right += outset;
+    rect.top += outset;
+    command.hasBounds = true;
+    command.bounds = BFRasterMatrixTransformRect(canvas->state.transformation, rect);
+    BFDisplayListAppendCommand(canvas->displayList, command);
+}
+
+#ifdef __APPLE__
+
+static void BFCanvasRasterizerAddCGPathElement(BFRasterizer * rasterizer, const CGPathElement * element) {
+    switch (element->type) {
+        case kCGPathElementMoveToPoint:
+            BFRasterizerMoveToPoint(rasterizer, BFPointFromCGPoint(element->points[0]));
+            break;
+        case kCGPathElementAddLineToPoint:
+            BFRasterizerAddLineToPoint(rasterizer, BFPointFromCGPoint(element->points[0]));
+            break;
+        case kCGPathElementAddQuadCurveToPoint:
+            BFRasterizerAddQuadCurveToPoint(rasterizer, BFPointFromCGPoint(element->points[1]), BFPointFromCGPoint(element->points[0]));
+            break;
+        case kCGPathElementAddCurveToPoint:
+            BFRasterizerAddCurveToPoint(rasterizer, BFPointFromCGPoint(element->points[2]), BFPointFromCGPoint(element->points[0]), BFPointFromCGPoint(element->points[1]));
+            break;
+        case kCGPathElementCloseSubpath:
+            BFRasterizerCloseSubpath(rasterizer);
+            break;
+    }
+}
+
+static void BFCanvasRasterDrawStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point, bool stroke) {
+    BFTransformationComponents translation = BFRasterMatrixMake(1, 0, 0, 1, point.x, point.y);
+    BFTransformationComponents transformation = BFRasterMatrixConcat(translation, BFCanvasGetDeviceTransformation(canvas));
+    if (stroke) {
+        BFRasterizerBeginStroke(canvas->rasterizer, transformation, canvas->state.thickness);
+    } else {
+        BFRasterizerBeginFill(canvas->rasterizer, transformation);
+    }
+    CGPathApply(BFStyledStringGetCGPath(styledString), canvas->rasterizer, (CGPathApplierFunction)&BFCanvasRasterizerAddCGPathElement);
+    BFCanvasRasterFill(canvas, transformation);
+}
+
+#endif
+
+static bool BFCanvasRectsIntersect(BFRect rect1, BFRect rect2) {
+    return (rect1.left < rect2.right && rect2.left < rect1.right && rect1.bottom < rect2.top && rect2.bottom < rect1.top);
+}
+
+static bool BFCanvasIsRectVisible(BFCanvasRef canvas, BFRect rect, double outset) {
+    // Drawing outside the dirty rect or the clip can't change any pixels, so it's skipped before any flattening or
+    // Quartz work. Hit tests and recordings see every primitive.
+    if (canvas->type != kBFCanvasBitmap && canvas->type != kBFCanvasDisplay) {
+        return true;
+    }
+    rect = (BFRect){
+        .left = fmin(rect.left, rect.right) - outset,
+        .bottom = fmin(rect.bottom, rect.top) - outset,
+        .right = fmax(rect.left, rect.right) + outset,
+        .top = fmax(rect.bottom, rect.top) + outset,
+    };
+    bool visible = BFCanvasRectsIntersect(BFRasterMatrixTransformRect(canvas->state.transformation, rect), canvas->dirtyRect);
+    if (visible && canvas->type == kBFCanvasBitmap) {
+        BFRect deviceRect = BFRasterMatrixTransformRect(BFCanvasGetDeviceTransformation(canvas), rect);
+        BFRasterBox box = canvas->state.clip.box;
+        visible = (deviceRect.left < box.right && box.left < deviceRect.right && deviceRect.bottom < box.bottom && box.top < deviceRect.top);
+    } else if (visible) {
+#ifdef __APPLE__
+        CGRect clipRect = CGContextGetClipBoundingBox(canvas->context);
+        visible = BFCanvasRectsIntersect(rect, BFRectFromCGRect(clipRect));
+#endif
+    }
+    if (visible) {
+        canvas->cullingStatistics.drawnCount++;
+    } else {
+        canvas->cullingStatistics.culledCount++;
+    }
+    return visible;
+}
+
+static BFRect BFCanvasOffsetRect(BFRect rect, BFPoint offset) {
+    return (BFRect){ .left = rect.left + offset.x, .bottom = rect.bottom + offset.y, .right = rect.right + offset.x, .top = rect.top + offset.y };
+}
+
+static bool BFCanvasIsPathVisible(BFCanvasRef canvas, const BFPathRef path, double outset) {
+    // Empty paths draw nothing, but a hit test still needs the call to clear its last results.
+    BFRect rect;
+    if (!BFPathGetBounds(path, &rect)) {
+        return (canvas->type != kBFCanvasBitmap && canvas->type != kBFCanvasDisplay);
+    }
+    return BFCanvasIsRectVisible(canvas, rect, outset);
+}
+
+static bool BFCanvasIsTransformedPathVisible(BFCanvasRef canvas, const BFPathRef path, BFTransformationRef transformation) {
+    BFRect rect;
+    if (transformation && BFPathGetBounds(path, &rect)) {
+        return BFCanvasIsRectVisible(canvas, BFTransformationTransformRect(transformation, rect), 0);
+    }
+    return BFCanvasIsPathVisible(canvas, path, 0);
+}
+
 void BFCanvasStrokePath(BFCanvasRef canvas, const BFPathRef path) {
-    CGContextSaveGState(canvas->context);
-    BFCanvasStrokeCGPath(canvas, BFPathGetCGPath(path));
-    CGContextRestoreGState(canvas->context);
+    if (!BFCanvasIsPathVisible(canvas, path, canvas->state.thickness / 2)) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+        BFRasterizerBeginStroke(canvas->rasterizer, transformation, canvas->state.thickness);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        BFCanvasRasterFill(canvas, transformation);
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFRasterizerBeginStroke(canvas->rasterizer, canvas->state.transformation, canvas->state.thickness);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        BFCanvasHitTestFill(canvas);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFRect rect;
+        if (BFPathGetBounds(path, &rect)) {
+            BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = kBFDisplayListStrokePath, .object = path }, rect, canvas->state.thickness / 2);
+        }
+    } else {
+#ifdef __APPLE__
+        CGContextSaveGState(canvas->context);
+        BFCanvasStrokeCGPath(canvas, BFPathGetCGPath(path));
+        CGContextRestoreGState(canvas->context);
+#endif
+    }
 }
 
 void BFCanvasFillPath(BFCanvasRef canvas, const BFPathRef path) {
-    CGContextSaveGState(canvas->context);
-    BFCanvasFillCGPath(canvas, BFPathGetCGPath(path));
-    CGContextRestoreGState(canvas->context);
+    if (!BFCanvasIsPathVisible(canvas, path, 0)) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+        BFRasterizerBeginFill(canvas->rasterizer, transformation);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        BFCanvasRasterFill(canvas, transformation);
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        BFCanvasHitTestFill(canvas);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFRect rect;
+        if (BFPathGetBounds(path, &rect)) {
+            BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = kBFDisplayListFillPath, .object = path }, rect, 0);
+        }
+    } else {
+#ifdef __APPLE__
+        CGContextSaveGState(canvas->context);
+        BFCanvasFillCGPath(canvas, BFPathGetCGPath(path));
+        CGContextRestoreGState(canvas->context);
+#endif
+    }
+}
+
+// Batches draw each item as its own fill, exactly as separate calls would, but set up the paint and Quartz state
+// once for the whole batch.
+
+#ifdef __APPLE__
+
+static void BFCanvasBatchFillCGPath(BFCanvasRef canvas, CGPathRef path, BFPaintRef paint, bool painted) {
+    CGContextAddPath(canvas->context, path);
+    if (painted) {
+        CGContextDrawPath(canvas->context, kCGPathFill);
+    } else if (!CGContextIsPathEmpty(canvas->context)) {
+        CGRect bounds = CGContextGetPathBoundingBox(canvas->context);
+        CGContextSaveGState(canvas->context);
+        CGContextClip(canvas->context);
+        BFCanvasFillClipBoundingBox(canvas, paint, bounds);
+        CGContextRestoreGState(canvas->context);
+    }
+}
+
+#endif
+
+void BFCanvasFillRects(BFCanvasRef canvas, const BFRect rects[], size_t count) {
+    size_t index;
+    if (count == 0) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+        BFRasterSource source;
+        if (BFPaintGetRasterSource(canvas->state.paint, BFRasterMatrixInvert(transformation), &source)) {
+            for (index = 0; index < count; index++) {
+                if (!BFCanvasIsRectVisible(canvas, rects[index], 0)) {
+                    continue;
+                }
+                BFRasterizerBeginFill(canvas->rasterizer, transformation);
+                BFRasterizerAddRect(canvas->rasterizer, rects[index]);
+                BFRasterizerFill(canvas->rasterizer, &canvas->bitmap, &canvas->state.clip, &source, canvas->state.opacity, canvas->state.paintModeType);
+            }
+        }
+    } else if (canvas->type == kBFCanvasHitTest) {
+        uint8_t * batchResults = calloc(canvas->hitTestPointCount, 1);
+        for (index = 0; index < count; index++) {
+            BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+            BFRasterizerAddRect(canvas->rasterizer, rects[index]);
+            BFCanvasHitTestFill(canvas);
+            BFCanvasHitTestAccumulate(canvas, batchResults);
+        }
+        BFCanvasHitTestFinishBatch(canvas, batchResults);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFRect bounds = { .left = INFINITY, .bottom = INFINITY, .right = -INFINITY, .top = -INFINITY };
+        for (index = 0; index < count; index++) {
+            bounds.left = fmin(bounds.left, fmin(rects[index].left, rects[index].right));
+            bounds.bottom = fmin(bounds.bottom, fmin(rects[index].bottom, rects[index].top));
+            bounds.right = fmax(bounds.right, fmax(rects[index].left, rects[index].right));
+            bounds.top = fmax(bounds.top, fmax(rects[index].bottom, rects[index].top));
+        }
+        BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = kBFDisplayListFillRects, .count = count, .rects = (BFRect *)rects }, bounds, 0);
+    } else {
+#ifdef __APPLE__
+        CGContextSaveGState(canvas->context);
+        bool painted = BFPaintSetInContext(canvas->state.paint, canvas->context);
+        for (index = 0; index < count; index++) {
+            if (!BFCanvasIsRectVisible(canvas, rects[index], 0)) {
+                continue;
+            }
+            if (painted) {
+                CGContextFillRect(canvas->context, BFRectToCGRect(rects[index]));
+            } else {
+                CGContextSaveGState(canvas->context);
+                CGContextClipToRect(canvas->context, BFRectToCGRect(rects[index]));
+                BFCanvasFillClipBoundingBox(canvas, canvas->state.paint, BFRectToCGRect(rects[index]));
+                CGContextRestoreGState(canvas->context);
+            }
+        }
+        CGContextRestoreGState(canvas->context);
+#endif
+    }
+}
+
+void BFCanvasFillPaths(BFCanvasRef canvas, const BFPathRef paths[], const BFTransformationRef transformations[], size_t count) {
+    size_t index;
+    if (count == 0) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFTransformationComponents deviceTransformation = BFCanvasGetDeviceTransformation(canvas);
+        for (index = 0; index < count; index++) {
+            BFTransformationComponents transformation = deviceTransformation;
+            if (transformations && transformations[index]) {
+                transformation = BFRasterMatrixConcat(BFTransformationGetComponents(transformations[index]), deviceTransformation);
+            }
+            if (!BFCanvasIsTransformedPathVisible(canvas, paths[index], (transformations ? transformations[index] : NULL))) {
+                continue;
+            }
+            BFRasterizerBeginFill(canvas->rasterizer, transformation);
+            BFRasterizerAddPath(canvas->rasterizer, paths[index]);
+            BFCanvasRasterFill(canvas, transformation);
+        }
+    } else if (canvas->type == kBFCanvasHitTest) {
+        uint8_t * batchResults = calloc(canvas->hitTestPointCount, 1);
+        for (index = 0; index < count; index++) {
+            BFTransformationComponents transformation = canvas->state.transformation;
+            if (transformations && transformations[index]) {
+                transformation = BFRasterMatrixConcat(BFTransformationGetComponents(transformations[index]), transformation);
+            }
+            BFRasterizerBeginFill(canvas->rasterizer, transformation);
+            BFRasterizerAddPath(canvas->rasterizer, paths[index]);
+            BFCanvasHitTestFill(canvas);
+            BFCanvasHitTestAccumulate(canvas, batchResults);
+        }
+        BFCanvasHitTestFinishBatch(canvas, batchResults);
+    } else if (canvas->type == kBFCanvasRecording) {
+        // Each path is recorded on its own so replay can cull them individually.
+        for (index = 0; index < count; index++) {
+            if (transformations && transformations[index]) {
+                BFCanvasPush(canvas);
+                BFCanvasConcatTransformation(canvas, transformations[index]);
+                BFCanvasFillPath(canvas, paths[index]);
+                BFCanvasPop(canvas);
+            } else {
+                BFCanvasFillPath(canvas, paths[index]);
+            }
+        }
+    } else {
+#ifdef __APPLE__
+        CGContextSaveGState(canvas->context);
+        bool painted = BFPaintSetInContext(canvas->state.paint, canvas->context);
+        for (index = 0; index < count; index++) {
+            if (!BFCanvasIsTransformedPathVisible(canvas, paths[index], (transformations ? transformations[index] : NULL))) {
+                continue;
+            }
+            if (transformations && transformations[index]) {
+                CGContextSaveGState(canvas->context);
+                CGContextConcatCTM(canvas->context, BFTransformationGetCGAffineTransform(transformations[index]));
+                BFCanvasBatchFillCGPath(canvas, BFPathGetCGPath(paths[index]), canvas->state.paint, painted);
+                CGContextRestoreGState(canvas->context);
+            } else {
+                BFCanvasBatchFillCGPath(canvas, BFPathGetCGPath(paths[index]), canvas->state.paint, painted);
+            }
+        }
+        CGContextRestoreGState(canvas->context);
+#endif
+    }
+}
+
+void BFCanvasDrawInstances(BFCanvasRef canvas, const BFPathRef path, const BFPoint points[], const BFPaintRef paints[], size_t count) {
+    size_t index;
+    if (count == 0) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap || canvas->type == kBFCanvasHitTest) {
+        // The path is flattened once at the origin, then the edges are offset to each instance in device space.
+        BFTransformationComponents transformation = (canvas->type == kBFCanvasBitmap ? BFCanvasGetDeviceTransformation(canvas) : canvas->state.transformation);
+        uint8_t * batchResults = (canvas->type == kBFCanvasHitTest ? calloc(canvas->hitTestPointCount, 1) : NULL);
+        BFRect rect = { .left = 0, .bottom = 0, .right = 0, .top = 0 };
+        if (!BFPathGetBounds(path, &rect) && canvas->type == kBFCanvasBitmap) {
+            return;
+        }
+        BFRasterizerBeginFill(canvas->rasterizer, transformation);
+        BFRasterizerAddPath(canvas->rasterizer, path);
+        for (index = 0; index < count; index++) {
+            if (!BFCanvasIsRectVisible(canvas, BFCanvasOffsetRect(rect, points[index]), 0)) {
+                continue;
+            }
+            BFTransformationComponents instanceTransformation = transformation;
+            instanceTransformation.tx = transformation.a * points[index].x + transformation.c * points[index].y + transformation.tx;
+            instanceTransformation.ty = transformation.b * points[index].x + transformation.d * points[index].y + transformation.ty;
+            BFRasterizerSetOffset(canvas->rasterizer, (BFPoint){ .x = instanceTransformation.tx - transformation.tx, .y = instanceTransformation.ty - transformation.ty });
+            if (canvas->type == kBFCanvasBitmap) {
+                BFRasterSource source;
+                if (BFPaintGetRasterSource((paints ? paints[index] : canvas->state.paint), BFRasterMatrixInvert(instanceTransformation), &source)) {
+                    BFRasterizerFill(canvas->rasterizer, &canvas->bitmap, &canvas->state.clip, &source, canvas->state.opacity, canvas->state.paintModeType);
+                }
+            } else {
+                BFCanvasHitTestFill(canvas);
+                BFCanvasHitTestAccumulate(canvas, batchResults);
+            }
+        }
+        if (canvas->type == kBFCanvasHitTest) {
+            BFCanvasHitTestFinishBatch(canvas, batchResults);
+        }
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFRect rect;
+        if (BFPathGetBounds(path, &rect)) {
+            BFRect bounds = { .left = INFINITY, .bottom = INFINITY, .right = -INFINITY, .top = -INFINITY };
+            for (index = 0; index < count; index++) {
+                bounds.left = fmin(bounds.left, rect.left + points[index].x);
+                bounds.bottom = fmin(bounds.bottom, rect.bottom + points[index].y);
+                bounds.right = fmax(bounds.right, rect.right + points[index].x);
+                bounds.top = fmax(bounds.top, rect.top + points[index].y);
+            }
+            BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = kBFDisplayListDrawInstances, .object = path, .count = count, .points = (BFPoint *)points, .paints = (BFPaintRef *)paints }, bounds, 0);
+        }
+    } else {
+#ifdef __APPLE__
+        // Quartz has no instancing, but the CGPath is built once and only the CTM moves between instances. Each
+        // instance is translated inside its own saved state, so the next one is still culled against the untranslated
+        // clip.
+        BFRect rect;
+        if (!BFPathGetBounds(path, &rect)) {
+            return;
+        }
+        CGPathRef cgPath = BFPathGetCGPath(path);
+        CGContextSaveGState(canvas->context);
+        bool painted = BFPaintSetInContext(canvas->state.paint, canvas->context);
+        for (index = 0; index < count; index++) {
+            BFPaintRef paint = canvas->state.paint;
+            bool instancePainted = painted;
+            if (!BFCanvasIsRectVisible(canvas, BFCanvasOffsetRect(rect, points[index]), 0)) {
+                continue;
+            }
+            CGContextSaveGState(canvas->context);
+            if (paints) {
+                paint = paints[index];
+                instancePainted = BFPaintSetInContext(paint, canvas->context);
+            }
+            CGContextTranslateCTM(canvas->context, points[index].x, points[index].y);
+            BFCanvasBatchFillCGPath(canvas, cgPath, paint, instancePainted);
+            CGContextRestoreGState(canvas->context);
+        }
+        CGContextRestoreGState(canvas->context);
+#endif
+    }
+}
+
+#ifdef __APPLE__
+
+static void BFCanvasHitTestStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point, bool stroke) {
+    // Text is tested against its typographic box rather than its glyph outlines.
+    BFRect rect = BFStyledStringMeasure(styledString);
+    double outset = (stroke ? canvas->state.thickness / 2 : 0);
+    rect.left += point.x - outset;
+    rect.bottom += point.y - outset;
+    rect.right += point.x + outset;
+    rect.top += point.y + outset;
+    BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+    BFRasterizerAddRect(canvas->rasterizer, rect);
+    BFCanvasHitTestFill(canvas);
+}
+
+static void BFCanvasRecordStyledString(BFCanvasRef canvas, BFDisplayListCommandType type, BFStyledStringRef styledString, BFPoint point) {
+    // Typographic bounds don't cover glyph overhangs, so leave some slack around them.
+    BFRect rect = BFStyledStringMeasure(styledString);
+    rect.left += point.x;
+    rect.bottom += point.y;
+    rect.right += point.x;
+    rect.top += point.y;
+    double outset = (rect.top - rect.bottom) / 2 + (type == kBFDisplayListStrokeStyledString ? canvas->state.thickness / 2 : 0);
+    BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = type, .object = styledString, .point = point }, rect, outset);
+}
+
+static bool BFCanvasIsStyledStringVisible(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point, bool stroke) {
+    // The same slack as recorded text, for glyph overhangs.
+    BFRect rect = BFCanvasOffsetRect(BFStyledStringMeasure(styledString), point);
+    return BFCanvasIsRectVisible(canvas, rect, (rect.top - rect.bottom) / 2 + (stroke ? canvas->state.thickness / 2 : 0));
 }
 
 static bool BFCanvasIsCGAffineTransformRotated(CGAffineTransform affineTransform) {
     return (affineTransform.b != 0 || affineTransform.c != 0);
 }
 
+static void BFCanvasShowStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point, CGAffineTransform ctm, bool stroke) {
+    // Paints Quartz can't set directly, like gradients, clip to the glyphs as they're shown and then fill the clip,
+    // so the text never has to be converted to a path.
+    bool painted = BFPaintSetInContext(canvas->state.paint, canvas->context);
+    CGContextSetTextDrawingMode(canvas->context, (stroke ? (painted ? kCGTextStroke : kCGTextStrokeClip) : (painted ? kCGTextFill : kCGTextClip)));
+    CGContextSetTextMatrix(canvas->context, CGAffineTransformIdentity);
+    CGContextSetTextPosition(canvas->context, point.x + round(ctm.tx) - ctm.tx, point.y + round(ctm.ty) - ctm.ty);
+    BFStyledStringDrawInCGContext(styledString, canvas->context);
+    if (!painted) {
+        CGContextSetTextDrawingMode(canvas->context, kCGTextFill);
+        BFCanvasFillClipBoundingBox(canvas, canvas->state.paint, CGRectInfinite);
+    }
+}
+
 void BFCanvasDrawStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point) {
+    if (!BFCanvasIsStyledStringVisible(canvas, styledString, point, false)) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFCanvasRasterDrawStyledString(canvas, styledString, point, false);
+        return;
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFCanvasHitTestStyledString(canvas, styledString, point, false);
+        return;
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFCanvasRecordStyledString(canvas, kBFDisplayListDrawStyledString, styledString, point);
+        return;
+    }
     CGContextSaveGState(canvas->context);
     CGAffineTransform ctm = CGContextGetCTM(canvas->context);
-    if (!BFCanvasIsCGAffineTransformRotated(ctm) && BFPaintSetInContext(canvas->state.paint, canvas->context)) {
-        CGContextSetTextDrawingMode(canvas->context, kCGTextFill);
-        CGContextSetTextMatrix(canvas->context, CGAffineTransformIdentity);
-        CGContextSetTextPosition(canvas->context, point.x + round(ctm.tx) - ctm.tx, point.y + round(ctm.ty) - ctm.ty);
-        BFStyledStringDrawInCGContext(styledString, canvas->context);
+    if (!BFCanvasIsCGAffineTransformRotated(ctm)) {
+        BFCanvasShowStyledString(canvas, styledString, point, ctm, false);
     } else {
         CGAffineTransform transform = CGAffineTransformIdentity;
         transform.tx = point.x;
@@ -282,13 +1099,24 @@ void BFCanvasDrawStyledString(BFCanvasRef canvas, BFStyledStringRef styledString
 }
 
 void BFCanvasStrokeStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point) {
+    if (!BFCanvasIsStyledStringVisible(canvas, styledString, point, true)) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFCanvasRasterDrawStyledString(canvas, styledString, point, true);
+        return;
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFCanvasHitTestStyledString(canvas, styledString, point, true);
+        return;
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFCanvasRecordStyledString(canvas, kBFDisplayListStrokeStyledString, styledString, point);
+        return;
+    }
     CGContextSaveGState(canvas->context);
     CGAffineTransform ctm = CGContextGetCTM(canvas->context);
-    if (!BFCanvasIsCGAffineTransformRotated(ctm) && BFPaintSetInContext(canvas->state.paint, canvas->context)) {
-        CGContextSetTextDrawingMode(canvas->context, kCGTextStroke);
-        CGContextSetTextMatrix(canvas->context, CGAffineTransformIdentity);
-        CGContextSetTextPosition(canvas->context, point.x + round(ctm.tx) - ctm.tx, point.y + round(ctm.ty) - ctm.ty);
-        BFStyledStringDrawInCGContext(styledString, canvas->context);
+    if (!BFCanvasIsCGAffineTransformRotated(ctm)) {
+        BFCanvasShowStyledString(canvas, styledString, point, ctm, true);
     } else {
         CGAffineTransform transform = CGAffineTransformIdentity;
         transform.tx = point.x;
@@ -300,25 +1128,92 @@ void BFCanvasStrokeStyledString(BFCanvasRef canvas, BFStyledStringRef styledStri
     CGContextRestoreGState(canvas->context);
 }
 
+#endif
+
 void BFCanvasDrawIcon(BFCanvasRef canvas, const BFIconRef icon, BFRect rect) {
-    CGImageRef image = BFIconCopyCGImage(icon);
-    CGContextDrawImage(canvas->context, BFRectToCGRect(rect), image);
-    CGImageRelease(image);
+    if (!BFCanvasIsRectVisible(canvas, rect, 0)) {
+        return;
+    }
+    canvas->changeCount++;
+    if (canvas->type == kBFCanvasBitmap) {
+        BFRasterImage image = { .rect = rect };
+        if (BFIconGetRasterBitmap(icon, &image.bitmap)) {
+            BFTransformationComponents transformation = BFCanvasGetDeviceTransformation(canvas);
+            BFRasterSource source;
+            BFRasterSourceInitWithImage(&source, &image, BFRasterMatrixInvert(transformation));
+            BFRasterizerBeginFill(canvas->rasterizer, transformation);
+            BFRasterizerAddRect(canvas->rasterizer, rect);
+            BFRasterizerFill(canvas->rasterizer, &canvas->bitmap, &canvas->state.clip, &source, canvas->state.opacity, canvas->state.paintModeType);
+        }
+    } else if (canvas->type == kBFCanvasHitTest) {
+        BFRasterizerBeginFill(canvas->rasterizer, canvas->state.transformation);
+        BFRasterizerAddRect(canvas->rasterizer, rect);
+        BFCanvasHitTestFill(canvas);
+    } else if (canvas->type == kBFCanvasRecording) {
+        BFCanvasRecordDrawing(canvas, (BFDisplayListCommand){ .type = kBFDisplayListDrawIcon, .object = icon, .rect = rect }, rect, 0);
+    } else {
+#ifdef __APPLE__
+        CGImageRef image = BFIconCopyCGImage(icon);
+        CGContextDrawImage(canvas->context, BFRectToCGRect(rect), image);
+        CGImageRelease(image);
+#endif
+    }
 }
 
-static void BFCanvasFillClipBoundingBox(BFCanvasRef canvas) {
-    // TODO: this works, but the bounding box will grow when converted to & from device space, if the user space is rotated.
-    CGRect deviceRect = CGContextConvertRectToDeviceSpace(canvas->context, CGContextGetClipBoundingBox(canvas->context));
-    CGRect integralDeviceRect;
-    integralDeviceRect.origin = CGPointMake(floor(CGRectGetMinX(deviceRect)), floor(CGRectGetMinY(deviceRect)));
-    integralDeviceRect.size = CGSizeMake(ceil(CGRectGetMaxX(deviceRect)) - integralDeviceRect.origin.x, ceil(CGRectGetMaxY(deviceRect)) - integralDeviceRect.origin.y);
-    BFPaintFillRectInContext(canvas->state.paint, canvas->context, CGContextConvertRectToUserSpace(canvas->context, integralDeviceRect));
+#ifdef __APPLE__
+
+static void BFCanvasFillClipBoundingBox(BFCanvasRef canvas, BFPaintRef paint, CGRect bounds) {
+    // Staying in user space keeps the box from growing the way a round trip through an axis-aligned device space
+    // rect would when the user space is rotated, and the bounds of the shape being filled limit it further.
+    // Outsetting by a device pixel covers the antialiased edge pixels fully.
+    CGRect rect = CGRectIntersection(CGContextGetClipBoundingBox(canvas->context), bounds);
+    if (CGRectIsNull(rect)) {
+        return;
+    }
+    CGSize pixelSize = CGContextConvertSizeToUserSpace(canvas->context, CGSizeMake(1, 1));
+    double outset = fmax(fabs(pixelSize.width), fabs(pixelSize.height));
+    BFPaintFillRectInContext(paint, canvas->context, CGRectInset(rect, -outset, -outset));
 }
 
+#endif
+
 bool BFCanvasIsHitTest(BFCanvasRef canvas) {
     return (canvas->type == kBFCanvasHitTest);
 }
 
 bool BFCanvasPerformHitTest(BFCanvasRef canvas) {
-    return (canvas->type == kBFCanvasHitTest && canvas->hitTestData != 0xff);
+    size_t index;
+    for (index = 0; index < canvas->hitTestPointCount; index++) {
+        if (canvas->hitTestResults[index]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t BFCanvasGetHitTestPointCount(BFCanvasRef canvas) {
+    return canvas->hitTestPointCount;
+}
+
+bool BFCanvasGetHitTestResult(BFCanvasRef canvas, size_t index) {
+    return (index < canvas->hitTestPointCount && canvas->hitTestResults[index]);
+}
+
+bool BFCanvasGetLastHitTestResult(BFCanvasRef canvas, size_t index) {
+    return (index < canvas->hitTestPointCount && canvas->hitTestLastResults[index]);
+}
+
+bool BFCanvasIsRecording(BFCanvasRef canvas) {
+    return (canvas->type == kBFCanvasRecording);
+}
+
+BFDisplayListRef BFCanvasTakeDisplayList(BFCanvasRef canvas) {
+    BFDisplayListRef displayList = NULL;
+    if (canvas->type == kBFCanvasRecording) {
+        // Hand over the commands recorded so far and keep recording into a fresh list, so the taken list never changes.
+        displayList = canvas->displayList;
+        BFMarkImmutable(displayList);
+        canvas->displayList = BFDisplayListCreate();
+    }
+    return displayList;
 }
@@ -0,0 +1,42 @@
+//
+//  BFCanvas.h
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef __BF_CANVAS_H__
+#define __BF_CANVAS_H__
+
+#include "butterfly.h"
+
+BFTransformationComponents BFCanvasGetTransformationComponents(BFCanvasRef canvas);
+void BFCanvasSetBitmapOwner(BFCanvasRef canvas, BFBitmapRef bitmap);
+
+// Counts the drawing calls into a canvas, and BFCanvasNoteChanged calls, so a cached copy of its pixels can tell
+// whether they might have changed.
+unsigned long BFCanvasGetChangeCount(BFCanvasRef canvas);
+
+// BFIcon
+
+// An immutable copy of the icon's current pixels, shared until something is drawn into the icon again.
+BFIconRef BFIconCopySnapshot(BFIconRef icon);
+
+#endif /* __BF_CANVAS_H__ */
@@ -22,30 +22,56 @@
 //  THE SOFTWARE.
 //
 
+#include <pthread.h>
+#include <string.h>
+
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
 #include "BFPaint.h"
 
+// Colors made by BFColorPaintCreateWithRGBA are kept in a small direct-mapped table, so asking for the same
+// components again returns the same object. A newer color evicts whatever was in its slot.
+#define BF_COLOR_PAINT_INTERNED_COUNT 256
+
 struct BFColorPaint {
     struct BFPaint __base;
+    double components[4];
+    // The components packed as a premultiplied pixel for the raster backend.
+    uint8_t pixel[4];
+#ifdef __APPLE__
+    // Created the first time Quartz needs it.
     CGColorRef color;
+#endif
 };
 
 static void BFColorPaintInit(BFColorPaintRef colorPaint);
 static void BFColorPaintDealloc(BFColorPaintRef colorPaint);
+#ifdef __APPLE__
 static void BFColorPaintSetInContext(BFColorPaintRef colorPaint, CGContextRef context);
 static void BFColorPaintFillRectInContext(BFColorPaintRef colorPaint, CGContextRef context, CGRect rect);
+#endif
+static void BFColorPaintShadeSpan(BFColorPaintRef colorPaint, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span);
+static BFColorPaintRef BFColorPaintCreateSnapshot(BFColorPaintRef colorPaint);
 
 static const BFPaintFunctions baseFunctions = {
     .__base = {
         .name = BFColorPaintClassName,
         .dealloc = (BFBaseDeallocFunction)&BFColorPaintDealloc,
     },
+#ifdef __APPLE__
     .setInContext = (BFPaintSetInContextFunction)&BFColorPaintSetInContext,
     .fillRectInContext = (BFPaintFillRectInContextFunction)&BFColorPaintFillRectInContext,
+#endif
+    .shadeSpan = (BFPaintShadeSpanFunction)&BFColorPaintShadeSpan,
+    .createSnapshot = (BFPaintCreateSnapshotFunction)&BFColorPaintCreateSnapshot,
 };
 
+static BFColorPaintRef BFColorPaintInterned[BF_COLOR_PAINT_INTERNED_COUNT];
+static pthread_mutex_t BFColorPaintInternedMutex = PTHREAD_MUTEX_INITIALIZER;
+
 BFColorPaintRef BFColorPaintCreate(void) {
     BFColorPaintRef colorPaint = BFAlloc(sizeof(struct BFColorPaint), (const BFBaseFunctions *)&baseFunctions);
     if (colorPaint) {
@@ -54,53 +80,131 @@ BFColorPaintRef BFColorPaintCreate(void) {
     return BFRetain(colorPaint);
 }
 
+static size_t BFColorPaintHashComponents(const double components[4]) {
+    // FNV-1a over the components' bytes.
+    const uint8_t * bytes = (const uint8_t *)components;
+    uint32_t hash = 2166136261u;
+    size_t index;
+    for (index = 0; index < 4 * sizeof(double); index++) {
+        hash = (hash ^ bytes[index]) * 16777619u;
+    }
+    return hash % BF_COLOR_PAINT_INTERNED_COUNT;
+}
+
+BFColorPaintRef BFColorPaintCreateWithRGBA(double r, double g, double b, double a) {
+    // Adding zero turns -0 into 0, so both hash alike.
+    const double components[4] = { r + 0.0, g + 0.0, b + 0.0, a + 0.0 };
+    size_t slot = BFColorPaintHashComponents(components);
+    pthread_mutex_lock(&BFColorPaintInternedMutex);
+    BFColorPaintRef colorPaint = BFColorPaintInterned[slot];
+    if (colorPaint && memcmp(colorPaint->components, components, sizeof(components)) == 0) {
+        BFRetain(colorPaint);
+    } else {
+        colorPaint = BFColorPaintCreate();
+        if (colorPaint) {
+            BFColorPaintSetRGBA(colorPaint, r, g, b, a);
+            BFMarkImmutable(colorPaint);
+            BFRelease(BFColorPaintInterned[slot]);
+            BFColorPaintInterned[slot] = BFRetain(colorPaint);
+        }
+    }
+    pthread_mutex_unlock(&BFColorPaintInternedMutex);
+    return colorPaint;
+}
+
 static void BFColorPaintInit(BFColorPaintRef colorPaint) {
+    colorPaint->components[0] = colorPaint->components[1] = colorPaint->components[2] = colorPaint->components[3] = 0;
+    memset(colorPaint->pixel, 0, 4);
+#ifdef __APPLE__
     colorPaint->color = NULL;
+#endif
 }
 
 static void BFColorPaintDealloc(BFColorPaintRef colorPaint) {
+#ifdef __APPLE__
     if (colorPaint) {
         CGColorRelease(colorPaint->color);
     }
+#endif
     BFPaintDealloc(colorPaint);
 }
 
 void BFColorPaintSetRGBA(BFColorPaintRef colorPaint, double r, double g, double b, double a) {
-    const CGFloat components[] = {r, g, b, a};
-    CGColorSpaceRef srgbColorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
-    CGColorRelease(colorPaint->color);
-    colorPaint->color = CGColorCreate(srgbColorSpace, components);
-    CGColorSpaceRelease(srgbColorSpace);
+    if (BFIsImmutable(colorPaint)) {
+        return;
+    }
+    colorPaint->components[0] = r + 0.0;
+    colorPaint->components[1] = g + 0.0;
+    colorPaint->components[2] = b + 0.0;
+    colorPaint->components[3] = a + 0.0;
+    BFRasterPackColor(r, g, b, a, colorPaint->pixel);
+#ifdef __APPLE__
+    CGColorRelease(__atomic_exchange_n(&colorPaint->color, NULL, __ATOMIC_ACQ_REL));
+#endif
+}
+
+static BFColorPaintRef BFColorPaintCreateSnapshot(BFColorPaintRef colorPaint) {
+    // Interned colors are immutable.
+    const double * components = colorPaint->components;
+    return BFColorPaintCreateWithRGBA(components[0], components[1], components[2], components[3]);
 }
 
 void BFColorPaintGetRGBA(BFColorPaintRef colorPaint, double * r, double * g, double * b, double * a) {
-    const CGFloat * components = CGColorGetComponents(colorPaint->color);
-    if (CGColorGetNumberOfComponents(colorPaint->color) == 4) {
-        *r = *(components++);
-        *g = *(components++);
-        *b = *(components++);
-        *a = *(components);
-    }
+    *r = colorPaint->components[0];
+    *g = colorPaint->components[1];
+    *b = colorPaint->components[2];
+    *a = colorPaint->components[3];
 }
 
+#ifdef __APPLE__
+
 void BFColorPaintSetInContext(BFColorPaintRef colorPaint, CGContextRef context) {
-    if (colorPaint->color) {
-        CGContextSetFillColorWithColor(context, colorPaint->color);
-        CGContextSetStrokeColorWithColor(context, colorPaint->color);
+    CGColorRef color = BFColorPaintGetCGColor(colorPaint);
+    if (color) {
+        CGContextSetFillColorWithColor(context, color);
+        CGContextSetStrokeColorWithColor(context, color);
     }
 }
 
 void BFColorPaintFillRectInContext(BFColorPaintRef colorPaint, CGContextRef context, CGRect rect) {
-    if (colorPaint->color) {
-        CGContextSetFillColorWithColor(context, colorPaint->color);
+    CGColorRef color = BFColorPaintGetCGColor(colorPaint);
+    if (color) {
+        CGContextSetFillColorWithColor(context, color);
         CGContextFillRect(context, rect);
     }
 }
 
+#endif
+
+static void BFColorPaintShadeSpan(BFColorPaintRef colorPaint, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span) {
+    int index;
+    for (index = 0; index < count; index++, span += 4) {
+        memcpy(span, colorPaint->pixel, 4);
+    }
+}
+
+#ifdef __APPLE__
+
 CGColorRef BFColorPaintGetCGColor(BFColorPaintRef colorPaint) {
-    return colorPaint->color;
+    // Interned colors are shared between threads, so whichever thread loses the race to create the color
+    // releases its own copy.
+    CGColorRef color = __atomic_load_n(&colorPaint->color, __ATOMIC_ACQUIRE);
+    if (!color) {
+        const CGFloat components[] = { colorPaint->components[0], colorPaint->components[1], colorPaint->components[2], colorPaint->components[3] };
+        CGColorSpaceRef srgbColorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+        CGColorRef newColor = CGColorCreate(srgbColorSpace, components);
+        CGColorSpaceRelease(srgbColorSpace);
+        if (__atomic_compare_exchange_n(&colorPaint->color, &color, newColor, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            color = newColor;
+        } else {
+            CGColorRelease(newColor);
+        }
+    }
+    return color;
 }
 
+#endif
+
 bool BFColorPaintEquals(BFColorPaintRef colorPaint1, BFColorPaintRef colorPaint2) {
-    return CGColorEqualToColor(colorPaint1->color, colorPaint2->color);
+    return (colorPaint1 == colorPaint2 || memcmp(colorPaint1->components, colorPaint2->components, sizeof(colorPaint1->components)) == 0);
 }
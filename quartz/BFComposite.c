@@ -0,0 +1,374 @@
+//
+//  BFComposite.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "butterfly.h"
+
+#include "BFComposite.h"
+
+typedef struct {
+    float r;
+    float g;
+    float b;
+    float a;
+} BFCompositeColor;
+
+static float BFCompositeMin(float value1, float value2) {
+    return (value1 < value2 ? value1 : value2);
+}
+
+static float BFCompositeMax(float value1, float value2) {
+    return (value1 > value2 ? value1 : value2);
+}
+
+static float BFCompositeClamp(float value) {
+    return BFCompositeMin(BFCompositeMax(value, 0), 1);
+}
+
+// Separable blend functions, as defined by the W3C Compositing and Blending spec. All values are unpremultiplied.
+
+static float BFCompositeBlendScreen(float cb, float cs) {
+    return cb + cs - cb * cs;
+}
+
+static float BFCompositeBlendHardLight(float cb, float cs) {
+    if (cs <= 0.5f) {
+        return cb * 2 * cs;
+    } else {
+        return BFCompositeBlendScreen(cb, 2 * cs - 1);
+    }
+}
+
+static float BFCompositeBlendSoftLight(float cb, float cs) {
+    if (cs <= 0.5f) {
+        return cb - (1 - 2 * cs) * cb * (1 - cb);
+    } else {
+        float d = (cb <= 0.25f ? ((16 * cb - 12) * cb + 4) * cb : sqrtf(cb));
+        return cb + (2 * cs - 1) * (d - cb);
+    }
+}
+
+static float BFCompositeBlendChannel(BFPaintModeType paintModeType, float cb, float cs) {
+    switch (paintModeType) {
+        case kBFPaintModeMultiply:
+            return cb * cs;
+        case kBFPaintModeScreen:
+            return BFCompositeBlendScreen(cb, cs);
+        case kBFPaintModeOverlay:
+            return BFCompositeBlendHardLight(cs, cb);
+        case kBFPaintModeDarken:
+            return BFCompositeMin(cb, cs);
+        case kBFPaintModeLighten:
+            return BFCompositeMax(cb, cs);
+        case kBFPaintModeColorDodge:
+            if (cb <= 0) {
+                return 0;
+            } else if (cs >= 1) {
+                return 1;
+            } else {
+                return BFCompositeMin(1, cb / (1 - cs));
+            }
+        case kBFPaintModeColorBurn:
+            if (cb >= 1) {
+                return 1;
+            } else if (cs <= 0) {
+                return 0;
+            } else {
+                return 1 - BFCompositeMin(1, (1 - cb) / cs);
+            }
+        case kBFPaintModeSoftLight:
+            return BFCompositeBlendSoftLight(cb, cs);
+        case kBFPaintModeHardLight:
+            return BFCompositeBlendHardLight(cb, cs);
+        case kBFPaintModeDifference:
+            return fabsf(cb - cs);
+        case kBFPaintModeExclusion:
+            return cb + cs - 2 * cb * cs;
+        default:
+            return cs;
+    }
+}
+
+// Non-separable blend functions, also from the W3C spec.
+
+static float BFCompositeLum(const float c[3]) {
+    return 0.3f * c[0] + 0.59f * c[1] + 0.11f * c[2];
+}
+
+static void BFCompositeClipColor(float c[3]) {
+    float l = BFCompositeLum(c);
+    float n = BFCompositeMin(c[0], BFCompositeMin(c[1], c[2]));
+    float x = BFCompositeMax(c[0], BFCompositeMax(c[1], c[2]));
+    int index;
+    for (index = 0; index < 3; index++) {
+        if (n < 0 && l - n > 0) {
+            c[index] = l + (c[index] - l) * l / (l - n);
+        }
+        if (x > 1 && x - l > 0) {
+            c[index] = l + (c[index] - l) * (1 - l) / (x - l);
+        }
+    }
+}
+
+static void BFCompositeSetLum(float c[3], float l) {
+    float d = l - BFCompositeLum(c);
+    c[0] += d;
+    c[1] += d;
+    c[2] += d;
+    BFCompositeClipColor(c);
+}
+
+static float BFCompositeSat(const float c[3]) {
+    return BFCompositeMax(c[0], BFCompositeMax(c[1], c[2])) - BFCompositeMin(c[0], BFCompositeMin(c[1], c[2]));
+}
+
+static void BFCompositeSetSat(float c[3], float s) {
+    int max = 0, mid = 1, min = 2, swap;
+    if (c[max] < c[mid]) { swap = max; max = mid; mid = swap; }
+    if (c[mid] < c[min]) { swap = mid; mid = min; min = swap; }
+    if (c[max] < c[mid]) { swap = max; max = mid; mid = swap; }
+    if (c[max] > c[min]) {
+        c[mid] = (c[mid] - c[min]) * s / (c[max] - c[min]);
+        c[max] = s;
+    } else {
+        c[mid] = 0;
+        c[max] = 0;
+    }
+    c[min] = 0;
+}
+
+static void BFCompositeBlendNonSeparable(BFPaintModeType paintModeType, const float cb[3], const float cs[3], float result[3]) {
+    int index;
+    switch (paintModeType) {
+        case kBFPaintModeHue:
+            for (index = 0; index < 3; index++) result[index] = cs[index];
+            BFCompositeSetSat(result, BFCompositeSat(cb));
+            BFCompositeSetLum(result, BFCompositeLum(cb));
+            break;
+        case kBFPaintModeSaturation:
+            for (index = 0; index < 3; index++) result[index] = cb[index];
+            BFCompositeSetSat(result, BFCompositeSat(cs));
+            BFCompositeSetLum(result, BFCompositeLum(cb));
+            break;
+        case kBFPaintModeColor:
+            for (index = 0; index < 3; index++) result[index] = cs[index];
+            BFCompositeSetLum(result, BFCompositeLum(cb));
+            break;
+        default:
+            for (index = 0; index < 3; index++) result[index] = cb[index];
+            BFCompositeSetLum(result, BFCompositeLum(cs));
+            break;
+    }
+}
+
+static BFCompositeColor BFCompositeBlend(BFPaintModeType paintModeType, BFCompositeColor s, BFCompositeColor d) {
+    // Blends in the usual way: result = s * (1 - Da) + d * (1 - Sa) + Sa * Da * B(Cb, Cs).
+    float cs[3] = { 0, 0, 0 }, cb[3] = { 0, 0, 0 }, blended[3];
+    if (s.a > 0) {
+        cs[0] = BFCompositeClamp(s.r / s.a);
+        cs[1] = BFCompositeClamp(s.g / s.a);
+        cs[2] = BFCompositeClamp(s.b / s.a);
+    }
+    if (d.a > 0) {
+        cb[0] = BFCompositeClamp(d.r / d.a);
+        cb[1] = BFCompositeClamp(d.g / d.a);
+        cb[2] = BFCompositeClamp(d.b / d.a);
+    }
+    if (paintModeType >= kBFPaintModeHue) {
+        BFCompositeBlendNonSeparable(paintModeType, cb, cs, blended);
+    } else {
+        int index;
+        for (index = 0; index < 3; index++) {
+            blended[index] = BFCompositeBlendChannel(paintModeType, cb[index], cs[index]);
+        }
+    }
+    float both = s.a * d.a;
+    BFCompositeColor result = {
+        .r = s.r * (1 - d.a) + d.r * (1 - s.a) + both * blended[0],
+        .g = s.g * (1 - d.a) + d.g * (1 - s.a) + both * blended[1],
+        .b = s.b * (1 - d.a) + d.b * (1 - s.a) + both * blended[2],
+        .a = s.a + d.a - both,
+    };
+    return result;
+}
+
+static BFCompositeColor BFCompositePorterDuff(BFCompositeColor s, float fs, BFCompositeColor d, float fd) {
+    BFCompositeColor result = {
+        .r = s.r * fs + d.r * fd,
+        .g = s.g * fs + d.g * fd,
+        .b = s.b * fs + d.b * fd,
+        .a = s.a * fs + d.a * fd,
+    };
+    return result;
+}
+
+static BFCompositeColor BFCompositePixel(BFPaintModeType paintModeType, BFCompositeColor s, BFCompositeColor d) {
+    switch (paintModeType) {
+        case kBFPaintModeNormal:
+            return BFCompositePorterDuff(s, 1, d, 1 - s.a);
+        case kBFPaintModeClear:
+            return (BFCompositeColor){ 0, 0, 0, 0 };
+        case kBFPaintModeCopy:
+            return s;
+        case kBFPaintModeSourceIn:
+            return BFCompositePorterDuff(s, d.a, d, 0);
+        case kBFPaintModeSourceOut:
+            return BFCompositePorterDuff(s, 1 - d.a, d, 0);
+        case kBFPaintModeSourceAtop:
+            return BFCompositePorterDuff(s, d.a, d, 1 - s.a);
+        case kBFPaintModeDestinationOver:
+            return BFCompositePorterDuff(s, 1 - d.a, d, 1);
+        case kBFPaintModeDestinationIn:
+            return BFCompositePorterDuff(s, 0, d, s.a);
+        case kBFPaintModeDestinationOut:
+            return BFCompositePorterDuff(s, 0, d, 1 - s.a);
+        case kBFPaintModeDestinationAtop:
+            return BFCompositePorterDuff(s, 1 - d.a, d, s.a);
+        case kBFPaintModeXOR:
+            return BFCompositePorterDuff(s, 1 - d.a, d, 1 - s.a);
+        case kBFPaintModePlusLighter: {
+            BFCompositeColor result = {
+                .r = BFCompositeMin(1, s.r + d.r),
+                .g = BFCompositeMin(1, s.g + d.g),
+                .b = BFCompositeMin(1, s.b + d.b),
+                .a = BFCompositeMin(1, s.a + d.a),
+            };
+            return result;
+        }
+        case kBFPaintModePlusDarker: {
+            float a = BFCompositeMin(1, s.a + d.a);
+            BFCompositeColor result = {
+                .r = BFCompositeMax(0, a - (d.a - d.r) - (s.a - s.r)),
+                .g = BFCompositeMax(0, a - (d.a - d.g) - (s.a - s.g)),
+                .b = BFCompositeMax(0, a - (d.a - d.b) - (s.a - s.b)),
+                .a = a,
+            };
+            return result;
+        }
+        default:
+            return BFCompositeBlend(paintModeType, s, d);
+    }
+}
+
+static float BFCompositeLoad(uint8_t value) {
+    return value * (1.0f / 255);
+}
+
+static uint8_t BFCompositeStore(float value) {
+    return (uint8_t)(BFCompositeClamp(value) * 255 + 0.5f);
+}
+
+void BFCompositeSpanReference(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count) {
+    int index;
+    for (index = 0; index < count; index++, destination += 4, source += 4) {
+        uint8_t pixelCoverage = coverage[index];
+        if (pixelCoverage == 0) {
+            continue;
+        }
+        if (paintModeType == kBFPaintModeNormal && pixelCoverage == 0xff && source[3] == 0xff) {
+            memcpy(destination, source, 4);
+            continue;
+        }
+        BFCompositeColor s = { BFCompositeLoad(source[0]), BFCompositeLoad(source[1]), BFCompositeLoad(source[2]), BFCompositeLoad(source[3]) };
+        BFCompositeColor d = { BFCompositeLoad(destination[0]), BFCompositeLoad(destination[1]), BFCompositeLoad(destination[2]), BFCompositeLoad(destination[3]) };
+        BFCompositeColor result = BFCompositePixel(paintModeType, s, d);
+        float c = BFCompositeLoad(pixelCoverage);
+        destination[0] = BFCompositeStore(d.r + c * (result.r - d.r));
+        destination[1] = BFCompositeStore(d.g + c * (result.g - d.g));
+        destination[2] = BFCompositeStore(d.b + c * (result.b - d.b));
+        destination[3] = BFCompositeStore(d.a + c * (result.a - d.a));
+    }
+}
+
+void BFCompositeFloatSpan(BFPaintModeType paintModeType, float * destination, const float * source, const float * coverage, int count) {
+    int index;
+    for (index = 0; index < count; index++, destination += 4, source += 4) {
+        float c = coverage[index];
+        if (c == 0) {
+            continue;
+        }
+        BFCompositeColor s = { source[0], source[1], source[2], source[3] };
+        BFCompositeColor d = { destination[0], destination[1], destination[2], destination[3] };
+        BFCompositeColor result = BFCompositePixel(paintModeType, s, d);
+        destination[0] = d.r + c * (result.r - d.r);
+        destination[1] = d.g + c * (result.g - d.g);
+        destination[2] = d.b + c * (result.b - d.b);
+        destination[3] = d.a + c * (result.a - d.a);
+    }
+}
+
+// Dispatch. The vector kernels in BFCompositeVector.c cover the Porter-Duff modes, the plus modes and the separable
+// modes with simple premultiplied forms. The modes that need division, square roots or HSL conversion use the
+// reference implementation above.
+
+typedef void (* BFCompositeSpanFunction)(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count);
+
+typedef void (* BFCompositeLookUpSpanFunction)(const uint8_t * table, double scale, double t0, double step, uint8_t * span, int count);
+
+static BFCompositeSpanFunction BFCompositeSpanImplementation = &BFCompositeSpanVector;
+static BFCompositeLookUpSpanFunction BFCompositeLookUpSpanImplementation = &BFCompositeLookUpSpanVector;
+static pthread_once_t BFCompositeSpanImplementationOnce = PTHREAD_ONCE_INIT;
+
+static void BFCompositeChooseSpanImplementation(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        BFCompositeSpanImplementation = &BFCompositeSpanAVX2;
+        BFCompositeLookUpSpanImplementation = &BFCompositeLookUpSpanAVX2;
+    }
+#endif
+}
+
+static bool BFCompositeVectorModeIsSupported(BFPaintModeType paintModeType) {
+    switch (paintModeType) {
+        case kBFPaintModeOverlay:
+        case kBFPaintModeColorDodge:
+        case kBFPaintModeColorBurn:
+        case kBFPaintModeSoftLight:
+        case kBFPaintModeHardLight:
+        case kBFPaintModeHue:
+        case kBFPaintModeSaturation:
+        case kBFPaintModeColor:
+        case kBFPaintModeLuminosity:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void BFCompositeSpan(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count) {
+    if (!BFCompositeVectorModeIsSupported(paintModeType)) {
+        BFCompositeSpanReference(paintModeType, destination, source, coverage, count);
+        return;
+    }
+    pthread_once(&BFCompositeSpanImplementationOnce, &BFCompositeChooseSpanImplementation);
+    BFCompositeSpanImplementation(paintModeType, destination, source, coverage, count);
+}
+
+void BFCompositeLookUpSpan(const uint8_t * table, double scale, double t0, double step, uint8_t * span, int count) {
+    pthread_once(&BFCompositeSpanImplementationOnce, &BFCompositeChooseSpanImplementation);
+    BFCompositeLookUpSpanImplementation(table, scale, t0, step, span, count);
+}
@@ -0,0 +1,51 @@
+//
+//  BFComposite.h
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef __BF_COMPOSITE_H__
+#define __BF_COMPOSITE_H__
+
+#include <stdint.h>
+
+#include "butterfly.h"
+
+// Composites premultiplied RGBA spans. BFCompositeSpan picks the fastest kernel the processor supports;
+// BFCompositeSpanReference is the plain floating-point implementation it's checked against.
+void BFCompositeSpan(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count);
+void BFCompositeSpanReference(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count);
+void BFCompositeFloatSpan(BFPaintModeType paintModeType, float * destination, const float * source, const float * coverage, int count);
+
+// Fills a span with colors interpolated from a table of premultiplied pixels. Each pixel's parameter, t0 + index * step
+// clamped to [0, 1], is multiplied by scale and rounded: the integer part over 256 picks an entry, and the low 8 bits
+// weight the entry after it, so the table needs one more entry than the largest it can pick.
+void BFCompositeLookUpSpan(const uint8_t * table, double scale, double t0, double step, uint8_t * span, int count);
+
+// The vector kernels behind BFCompositeSpan, for the modes it sends to them.
+void BFCompositeSpanVector(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count);
+void BFCompositeLookUpSpanVector(const uint8_t * table, double scale, double t0, double step, uint8_t * span, int count);
+#if defined(__x86_64__) || defined(__i386__)
+void BFCompositeSpanAVX2(BFPaintModeType paintModeType, uint8_t * destination, const uint8_t * source, const uint8_t * coverage, int count);
+void BFCompositeLookUpSpanAVX2(const uint8_t * table, double scale, double t0, double step, uint8_t * span, int count);
+#endif
+
+#endif /* __BF_COMPOSITE_H__ */
@@ -0,0 +1,293 @@
+//
+//  BFDisplayList.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "butterfly.h"
+#ifdef __APPLE__
+#include "quartz.h"
+#endif
+
+#include "BFCanvas.h"
+#include "BFDisplayList.h"
+#include "BFPaint.h"
+#include "BFRaster.h"
+
+struct BFDisplayList {
+    struct BFBase __base;
+    BFDisplayListCommand * commands;
+    size_t commandCount;
+    size_t commandCapacity;
+    bool hasBounds;
+    BFRect bounds;
+};
+
+static void BFDisplayListInit(BFDisplayListRef displayList);
+static void BFDisplayListDealloc(BFDisplayListRef displayList);
+
+static const BFBaseFunctions baseFunctions = {
+    .name = BFDisplayListClassName,
+    .dealloc = (BFBaseDeallocFunction)&BFDisplayListDealloc,
+};
+
+BFDisplayListRef BFDisplayListCreate(void) {
+    BFDisplayListRef displayList = BFAlloc(sizeof(struct BFDisplayList), &baseFunctions);
+    if (displayList) {
+        BFDisplayListInit(displayList);
+    }
+    return BFRetain(displayList);
+}
+
+static void BFDisplayListInit(BFDisplayListRef displayList) {
+    displayList->commands = NULL;
+    displayList->commandCount = 0;
+    displayList->commandCapacity = 0;
+    displayList->hasBounds = false;
+    displayList->bounds = (BFRect){ .left = 0, .bottom = 0, .right = 0, .top = 0 };
+}
+
+static void BFDisplayListDealloc(BFDisplayListRef displayList) {
+    if (displayList) {
+        size_t index;
+        for (index = 0; index < displayList->commandCount; index++) {
+            BFDisplayListCommand * command = &displayList->commands[index];
+            BFRelease(command->object);
+            if (command->paints) {
+                size_t paintIndex;
+                for (paintIndex = 0; paintIndex < command->count; paintIndex++) {
+                    BFRelease(command->paints[paintIndex]);
+                }
+            }
+            free(command->rects);
+            free(command->points);
+            free(command->paints);
+        }
+        free(displayList->commands);
+    }
+    BFDealloc(displayList);
+}
+
+static void * BFDisplayListCopyArray(const void * array, size_t count, size_t elementSize) {
+    void * copy = malloc(count * elementSize);
+    if (copy) {
+        memcpy(copy, array, count * elementSize);
+    }
+    return copy;
+}
+
+static bool BFDisplayListCopyArrays(BFDisplayListCommand * command) {
+    BFRect * rects = NULL;
+    BFPoint * points = NULL;
+    BFPaintRef * paints = NULL;
+    if (command->rects && !(rects = BFDisplayListCopyArray(command->rects, command->count, sizeof(BFRect)))) {
+        return false;
+    }
+    if (command->points && !(points = BFDisplayListCopyArray(command->points, command->count, sizeof(BFPoint)))) {
+        free(rects);
+        return false;
+    }
+    if (command->paints && !(paints = BFDisplayListCopyArray(command->paints, command->count, sizeof(BFPaintRef)))) {
+        free(rects);
+        free(points);
+        return false;
+    }
+    if (paints) {
+        size_t index;
+        for (index = 0; index < command->count; index++) {
+            paints[index] = BFPaintCopySnapshot(paints[index]);
+        }
+    }
+    command->rects = rects;
+    command->points = points;
+    command->paints = paints;
+    return true;
+}
+
+void BFDisplayListAppendCommand(BFDisplayListRef displayList, BFDisplayListCommand command) {
+    if (displayList->commandCount == displayList->commandCapacity) {
+        size_t capacity = (displayList->commandCapacity ? displayList->commandCapacity * 2 : 64);
+        BFDisplayListCommand * commands = realloc(displayList->commands, capacity * sizeof(BFDisplayListCommand));
+        if (!commands) {
+            return;
+        }
+        displayList->commands = commands;
+        displayList->commandCapacity = capacity;
+    }
+    // Paths, transformations, paints and icons are mutable, so the list keeps its own copies, as it does of batch
+    // arrays. Immutable paints and icons are shared, so recording the same one again doesn't copy it again.
+    if (!BFDisplayListCopyArrays(&command)) {
+        return;
+    }
+    switch (command.type) {
+        case kBFDisplayListClipPath:
+        case kBFDisplayListFillPath:
+        case kBFDisplayListStrokePath:
+        case kBFDisplayListDrawInstances:
+            command.object = BFPathCreateCopy(command.object);
+            break;
+        case kBFDisplayListConcatTransformation: {
+            BFTransformationRef transformation = BFTransformationCreate();
+            BFTransformationConcat(transformation, command.object);
+            command.object = transformation;
+            break;
+        }
+        case kBFDisplayListSetPaint:
+            command.object = BFPaintCopySnapshot(command.object);
+            break;
+        case kBFDisplayListClipIcon:
+        case kBFDisplayListDrawIcon:
+            command.object = BFIconCopySnapshot(command.object);
+            break;
+        default:
+            BFRetain(command.object);
+            break;
+    }
+    if (command.hasBounds) {
+        if (displayList->hasBounds) {
+            displayList->bounds.left = fmin(displayList->bounds.left, command.bounds.left);
+            displayList->bounds.bottom = fmin(displayList->bounds.bottom, command.bounds.bottom);
+            displayList->bounds.right = fmax(displayList->bounds.right, command.bounds.right);
+            displayList->bounds.top = fmax(displayList->bounds.top, command.bounds.top);
+        } else {
+            displayList->bounds = command.bounds;
+            displayList->hasBounds = true;
+        }
+    }
+    displayList->commands[displayList->commandCount++] = command;
+}
+
+size_t BFDisplayListGetCommandCount(BFDisplayListRef displayList) {
+    return displayList->commandCount;
+}
+
+BFRect BFDisplayListGetBounds(BFDisplayListRef displayList) {
+    return displayList->bounds;
+}
+
+void BFDisplayListPrepareForConcurrentReplay(BFDisplayListRef displayList) {
+#ifdef __APPLE__
+    // Styled strings build their glyph outlines lazily, which isn't safe to race on.
+    size_t index;
+    for (index = 0; index < displayList->commandCount; index++) {
+        const BFDisplayListCommand * command = &displayList->commands[index];
+        if (command->type == kBFDisplayListDrawStyledString || command->type == kBFDisplayListStrokeStyledString) {
+            BFStyledStringGetCGPath(command->object);
+        }
+    }
+#endif
+}
+
+static bool BFDisplayListRectsIntersect(BFRect rect1, BFRect rect2) {
+    return (rect1.left < rect2.right && rect2.left < rect1.right && rect1.bottom < rect2.top && rect2.bottom < rect1.top);
+}
+
+void BFDisplayListReplay(BFDisplayListRef displayList, BFCanvasRef canvas) {
+    // Command bounds are in the recording canvas's base space; map them into the target's, then skip anything
+    // outside its dirty rect.
+    BFTransformationComponents transformation = BFCanvasGetTransformationComponents(canvas);
+    BFRect dirtyRect = BFCanvasGetDirtyRect(canvas);
+    int depth = 0;
+    size_t index;
+    
+    BFCanvasPush(canvas);
+    for (index = 0; index < displayList->commandCount; index++) {
+        const BFDisplayListCommand * command = &displayList->commands[index];
+        if (command->hasBounds && !BFDisplayListRectsIntersect(BFRasterMatrixTransformRect(transformation, command->bounds), dirtyRect)) {
+            continue;
+        }
+        switch (command->type) {
+            case kBFDisplayListSetOpacity:
+                BFCanvasSetOpacity(canvas, command->value);
+                break;
+            case kBFDisplayListSetPaint:
+                BFCanvasSetPaint(canvas, command->object);
+                break;
+            case kBFDisplayListSetPaintMode:
+                BFCanvasSetPaintMode(canvas, command->object);
+                break;
+            case kBFDisplayListSetFont:
+                BFCanvasSetFont(canvas, command->object);
+                break;
+            case kBFDisplayListSetThickness:
+                BFCanvasSetThickness(canvas, command->value);
+                break;
+            case kBFDisplayListConcatTransformation:
+                BFCanvasConcatTransformation(canvas, command->object);
+                break;
+            case kBFDisplayListClipRect:
+                BFCanvasClipRect(canvas, command->rect);
+                break;
+            case kBFDisplayListClipPath:
+                BFCanvasClipPath(canvas, command->object);
+                break;
+            case kBFDisplayListClipIcon:
+                BFCanvasClipIcon(canvas, command->object, command->rect);
+                break;
+            case kBFDisplayListPush:
+                BFCanvasPush(canvas);
+                depth++;
+                break;
+            case kBFDisplayListPop:
+                if (depth > 0) {
+                    BFCanvasPop(canvas);
+                    depth--;
+                }
+                break;
+            case kBFDisplayListFillPath:
+                BFCanvasFillPath(canvas, command->object);
+                break;
+            case kBFDisplayListStrokePath:
+                BFCanvasStrokePath(canvas, command->object);
+                break;
+#ifdef __APPLE__
+            case kBFDisplayListDrawStyledString:
+                BFCanvasDrawStyledString(canvas, command->object, command->point);
+                break;
+            case kBFDisplayListStrokeStyledString:
+                BFCanvasStrokeStyledString(canvas, command->object, command->point);
+                break;
+#else
+            case kBFDisplayListDrawStyledString:
+            case kBFDisplayListStrokeStyledString:
+                // Styled strings need Core Text, so a list can't hold one here.
+                break;
+#endif
+            case kBFDisplayListDrawIcon:
+                BFCanvasDrawIcon(canvas, command->object, command->rect);
+                break;
+            case kBFDisplayListFillRects:
+                BFCanvasFillRects(canvas, command->rects, command->count);
+                break;
+            case kBFDisplayListDrawInstances:
+                BFCanvasDrawInstances(canvas, command->object, command->points, command->paints, command->count);
+                break;
+        }
+    }
+    while (depth-- > 0) {
+        BFCanvasPop(canvas);
+    }
+    BFCanvasPop(canvas);
+}
@@ -0,0 +1,72 @@
+//
+//  BFDisplayList.h
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef __BF_DISPLAY_LIST_H__
+#define __BF_DISPLAY_LIST_H__
+
+#include "butterfly.h"
+
+typedef enum BFDisplayListCommandType {
+    kBFDisplayListSetOpacity,
+    kBFDisplayListSetPaint,
+    kBFDisplayListSetPaintMode,
+    kBFDisplayListSetFont,
+    kBFDisplayListSetThickness,
+    kBFDisplayListConcatTransformation,
+    kBFDisplayListClipRect,
+    kBFDisplayListClipPath,
+    kBFDisplayListClipIcon,
+    kBFDisplayListPush,
+    kBFDisplayListPop,
+    kBFDisplayListFillPath,
+    kBFDisplayListStrokePath,
+    kBFDisplayListDrawStyledString,
+    kBFDisplayListStrokeStyledString,
+    kBFDisplayListDrawIcon,
+    kBFDisplayListFillRects,
+    kBFDisplayListDrawInstances,
+} BFDisplayListCommandType;
+
+typedef struct BFDisplayListCommand {
+    BFDisplayListCommandType type;
+    bool hasBounds;
+    void * object;
+    union {
+        double value;
+        BFPoint point;
+        BFRect rect;
+    };
+    BFRect bounds;
+    size_t count;
+    BFRect * rects;
+    BFPoint * points;
+    BFPaintRef * paints;
+} BFDisplayListCommand;
+
+BFDisplayListRef BFDisplayListCreate(void);
+
+void BFDisplayListAppendCommand(BFDisplayListRef displayList, BFDisplayListCommand command);
+void BFDisplayListPrepareForConcurrentReplay(BFDisplayListRef displayList);
+
+#endif /* __BF_DISPLAY_LIST_H__ */
@@ -22,6 +22,9 @@
 //  THE SOFTWARE.
 //
 
+#include <pthread.h>
+#include <string.h>
+
 #include "butterfly.h"
 #include "quartz.h"
 
@@ -44,17 +47,180 @@ static const BFBaseFunctions baseFunctions = {
     .dealloc = (BFBaseDeallocFunction)&BFFontDealloc,
 };
 
+// Fonts are immutable, so equal requests share one instance. The cache keeps its own reference to each font, in
+// hash buckets and a most-recently-used list; past the entry limit the least recently used reference is dropped.
+
+#define BF_FONT_CACHE_BUCKET_COUNT 256
+#define BF_FONT_CACHE_DEFAULT_ENTRY_LIMIT 128
+
+typedef enum BFFontCacheKind {
+    kBFFontCacheNamed,
+    kBFFontCacheSystem,
+    kBFFontCacheBoldSystem,
+} BFFontCacheKind;
+
+typedef struct BFFontCacheEntry {
+    BFFontCacheKind kind;
+    char * name;
+    double size;
+    BFFontFeatures features;
+    unsigned long hash;
+    BFFontRef font;
+    struct BFFontCacheEntry * bucketNext;
+    struct BFFontCacheEntry * newer;
+    struct BFFontCacheEntry * older;
+} BFFontCacheEntry;
+
+static pthread_mutex_t BFFontCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static BFFontCacheEntry * BFFontCacheBuckets[BF_FONT_CACHE_BUCKET_COUNT];
+static BFFontCacheEntry * BFFontCacheNewest = NULL;
+static BFFontCacheEntry * BFFontCacheOldest = NULL;
+static size_t BFFontCacheEntryLimit = BF_FONT_CACHE_DEFAULT_ENTRY_LIMIT;
+static BFFontCacheStatistics BFFontCacheCurrentStatistics = { 0 };
+
+static unsigned long BFFontCacheHash(BFFontCacheKind kind, const char * name, double size, BFFontFeatures features) {
+    unsigned long hash = 5381 + kind;
+    for (; *name; name++) {
+        hash = hash * 33 + (unsigned char)*name;
+    }
+    hash = hash * 33 + (unsigned long)(size * 64);
+    hash = hash * 33 + (features.smallCaps | features.lowercaseNumbers << 1 | features.uppercaseNumbers << 2 | features.monospacedNumbers << 3 | features.proportionalNumbers << 4);
+    return hash;
+}
+
+static bool BFFontFeaturesEqual(BFFontFeatures features1, BFFontFeatures features2) {
+    return (features1.smallCaps == features2.smallCaps &&
+            features1.lowercaseNumbers == features2.lowercaseNumbers &&
+            features1.uppercaseNumbers == features2.uppercaseNumbers &&
+            features1.monospacedNumbers == features2.monospacedNumbers &&
+            features1.proportionalNumbers == features2.proportionalNumbers);
+}
+
+static void BFFontCacheUnlink(BFFontCacheEntry * entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        BFFontCacheNewest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        BFFontCacheOldest = entry->newer;
+    }
+}
+
+static void BFFontCacheLinkNewest(BFFontCacheEntry * entry) {
+    entry->older = BFFontCacheNewest;
+    entry->newer = NULL;
+    if (BFFontCacheNewest) {
+        BFFontCacheNewest->newer = entry;
+    } else {
+        BFFontCacheOldest = entry;
+    }
+    BFFontCacheNewest = entry;
+}
+
+static void BFFontCacheTrim(size_t entryLimit) {
+    while (BFFontCacheOldest && BFFontCacheCurrentStatistics.entryCount > entryLimit) {
+        BFFontCacheEntry * entry = BFFontCacheOldest;
+        BFFontCacheEntry ** link = &BFFontCacheBuckets[entry->hash % BF_FONT_CACHE_BUCKET_COUNT];
+        while (*link != entry) {
+            link = &(*link)->bucketNext;
+        }
+        *link = entry->bucketNext;
+        BFFontCacheUnlink(entry);
+        BFFontCacheCurrentStatistics.entryCount--;
+        BFFontCacheCurrentStatistics.evictionCount++;
+        BFRelease(entry->font);
+        free(entry->name);
+        free(entry);
+    }
+}
+
+static BFFontRef BFFontCacheCopyFont(BFFontCacheKind kind, const char * name, double size, BFFontFeatures features, unsigned long hash) {
+    BFFontRef font = NULL;
+    pthread_mutex_lock(&BFFontCacheMutex);
+    BFFontCacheEntry * entry = BFFontCacheBuckets[hash % BF_FONT_CACHE_BUCKET_COUNT];
+    while (entry && !(entry->hash == hash && entry->kind == kind && entry->size == size && BFFontFeaturesEqual(entry->features, features) && strcmp(entry->name, name) == 0)) {
+        entry = entry->bucketNext;
+    }
+    if (entry) {
+        BFFontCacheCurrentStatistics.hitCount++;
+        BFFontCacheUnlink(entry);
+        BFFontCacheLinkNewest(entry);
+        font = BFRetain(entry->font);
+    } else {
+        BFFontCacheCurrentStatistics.missCount++;
+    }
+    pthread_mutex_unlock(&BFFontCacheMutex);
+    return font;
+}
+
+static void BFFontCacheAddFont(BFFontCacheKind kind, const char * name, double size, BFFontFeatures features, unsigned long hash, BFFontRef font) {
+    if (!font || BFFontCacheEntryLimit == 0) {
+        return;
+    }
+    BFFontCacheEntry * entry = malloc(sizeof(BFFontCacheEntry));
+    char * nameCopy = strdup(name);
+    if (!entry || !nameCopy) {
+        free(entry);
+        free(nameCopy);
+        return;
+    }
+    entry->kind = kind;
+    entry->name = nameCopy;
+    entry->size = size;
+    entry->features = features;
+    entry->hash = hash;
+    entry->font = BFRetain(font);
+    pthread_mutex_lock(&BFFontCacheMutex);
+    // If another thread created the same font meanwhile, both stay valid; the newer entry just shadows the older one
+    // until it ages out.
+    BFFontCacheEntry ** bucket = &BFFontCacheBuckets[hash % BF_FONT_CACHE_BUCKET_COUNT];
+    entry->bucketNext = *bucket;
+    *bucket = entry;
+    BFFontCacheLinkNewest(entry);
+    BFFontCacheCurrentStatistics.entryCount++;
+    BFFontCacheTrim(BFFontCacheEntryLimit);
+    pthread_mutex_unlock(&BFFontCacheMutex);
+}
+
+BFFontCacheStatistics BFFontCacheGetStatistics(void) {
+    pthread_mutex_lock(&BFFontCacheMutex);
+    BFFontCacheStatistics statistics = BFFontCacheCurrentStatistics;
+    pthread_mutex_unlock(&BFFontCacheMutex);
+    return statistics;
+}
+
+void BFFontCacheSetEntryLimit(size_t entryLimit) {
+    pthread_mutex_lock(&BFFontCacheMutex);
+    BFFontCacheEntryLimit = entryLimit;
+    BFFontCacheTrim(entryLimit);
+    pthread_mutex_unlock(&BFFontCacheMutex);
+}
+
+void BFFontCachePurge(void) {
+    pthread_mutex_lock(&BFFontCacheMutex);
+    BFFontCacheTrim(0);
+    pthread_mutex_unlock(&BFFontCacheMutex);
+}
+
 BFFontRef BFFontCreate(const char * name, double size) {
     BFFontFeatures noFeatures = {};
     return BFFontCreateWithFeatures(name, size, noFeatures);
 }
 
 BFFontRef BFFontCreateWithFeatures(const char * name, double size, BFFontFeatures featuresStruct) {
-    BFFontRef font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
+    if (!name) {
+        name = "";
+    }
+    unsigned long hash = BFFontCacheHash(kBFFontCacheNamed, name, size, featuresStruct);
+    BFFontRef font = BFFontCacheCopyFont(kBFFontCacheNamed, name, size, featuresStruct, hash);
+    if (font) {
+        return font;
+    }
+    font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
     if (font) {
-        if (!name) {
-            name = "";
-        }
         CFStringRef fontName = CFStringCreateWithCString(NULL, name, kCFStringEncodingUTF8);
         CFArrayRef features = BFFontCreateFontFeaturesCFArray(featuresStruct);
         const void * keys[2] = { kCTFontNameAttribute, kCTFontFeatureSettingsAttribute };
@@ -69,27 +235,43 @@ BFFontRef BFFontCreateWithFeatures(const char * name, double size, BFFontFeature
         CFRelease(fontDescriptor);
         BFFontInit(font, fontRef, featuresStruct);
     }
-    return BFRetain(font);
+    font = BFRetain(font);
+    BFFontCacheAddFont(kBFFontCacheNamed, name, size, featuresStruct, hash, font);
+    return font;
 }
 
 BFFontRef BFFontCreateSystem(double size) {
-    BFFontRef font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
+    BFFontFeatures features = {};
+    unsigned long hash = BFFontCacheHash(kBFFontCacheSystem, "", size, features);
+    BFFontRef font = BFFontCacheCopyFont(kBFFontCacheSystem, "", size, features, hash);
+    if (font) {
+        return font;
+    }
+    font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
     if (font) {
         CTFontRef fontRef = CTFontCreateUIFontForLanguage(kCTFontUIFontSystem, size, NULL);
-        BFFontFeatures features = {};
         BFFontInit(font, fontRef, features);
     }
-    return BFRetain(font);
+    font = BFRetain(font);
+    BFFontCacheAddFont(kBFFontCacheSystem, "", size, features, hash, font);
+    return font;
 }
 
 BFFontRef BFFontCreateBoldSystem(double size) {
-    BFFontRef font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
+    BFFontFeatures features = {};
+    unsigned long hash = BFFontCacheHash(kBFFontCacheBoldSystem, "", size, features);
+    BFFontRef font = BFFontCacheCopyFont(kBFFontCacheBoldSystem, "", size, features, hash);
+    if (font) {
+        return font;
+    }
+    font = BFAlloc(sizeof(struct BFFont), &baseFunctions);
     if (font) {
         CTFontRef fontRef = CTFontCreateUIFontForLanguage(kCTFontUIFontEmphasizedSystem, size, NULL);
-        BFFontFeatures features = {};
         BFFontInit(font, fontRef, features);
     }
-    return BFRetain(font);
+    font = BFRetain(font);
+    BFFontCacheAddFont(kBFFontCacheBoldSystem, "", size, features, hash, font);
+    return font;
 }
 
 BFFontRef BFFontCreateWithCTFont(CTFontRef fontRef) {
@@ -104,6 +286,7 @@ BFFontRef BFFontCreateWithCTFont(CTFontRef fontRef) {
 static void BFFontInit(BFFontRef font, CTFontRef fontRef, BFFontFeatures features) {
     font->fontRef = fontRef;
     font->features = features;
+    BFMarkImmutable(font);
 }
 
 static void BFFontDealloc(BFFontRef font) {
@@ -0,0 +1,250 @@
+//
+//  BFGlyphCache.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <pthread.h>
+
+#include "butterfly.h"
+#include "quartz.h"
+
+#include "BFGlyphCache.h"
+
+#define BF_GLYPH_CACHE_DEFAULT_MEMORY_LIMIT (4 * 1024 * 1024)
+#define BF_GLYPH_CACHE_INITIAL_BUCKET_COUNT 256
+
+// Outlines are stored in font units, so one entry serves every size of the same font. Entries are chained into
+// hash buckets and into a most-recently-used list that eviction trims from the tail.
+typedef struct BFGlyphCacheEntry {
+    CFStringRef fontName;
+    CGGlyph glyph;
+    CFHashCode hash;
+    CGPathRef outline;
+    size_t memoryUsage;
+    struct BFGlyphCacheEntry * bucketNext;
+    struct BFGlyphCacheEntry * newer;
+    struct BFGlyphCacheEntry * older;
+} BFGlyphCacheEntry;
+
+static pthread_mutex_t BFGlyphCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static BFGlyphCacheEntry ** BFGlyphCacheBuckets = NULL;
+static size_t BFGlyphCacheBucketCount = 0;
+static BFGlyphCacheEntry * BFGlyphCacheNewest = NULL;
+static BFGlyphCacheEntry * BFGlyphCacheOldest = NULL;
+static size_t BFGlyphCacheMemoryLimit = BF_GLYPH_CACHE_DEFAULT_MEMORY_LIMIT;
+static BFGlyphCacheStatistics BFGlyphCacheCurrentStatistics = { 0 };
+
+static void BFGlyphCacheCountElement(size_t * count, const CGPathElement * element) {
+    (*count)++;
+}
+
+static size_t BFGlyphCacheEstimateMemoryUsage(CGPathRef outline) {
+    size_t elementCount = 0;
+    if (outline) {
+        CGPathApply(outline, &elementCount, (CGPathApplierFunction)&BFGlyphCacheCountElement);
+    }
+    return sizeof(BFGlyphCacheEntry) + elementCount * (sizeof(CGPathElement) + 3 * sizeof(CGPoint));
+}
+
+static void BFGlyphCacheUnlink(BFGlyphCacheEntry * entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        BFGlyphCacheNewest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        BFGlyphCacheOldest = entry->newer;
+    }
+    entry->newer = entry->older = NULL;
+}
+
+static void BFGlyphCacheLinkNewest(BFGlyphCacheEntry * entry) {
+    entry->older = BFGlyphCacheNewest;
+    entry->newer = NULL;
+    if (BFGlyphCacheNewest) {
+        BFGlyphCacheNewest->newer = entry;
+    } else {
+        BFGlyphCacheOldest = entry;
+    }
+    BFGlyphCacheNewest = entry;
+}
+
+static void BFGlyphCacheRemove(BFGlyphCacheEntry * entry) {
+    BFGlyphCacheEntry ** link = &BFGlyphCacheBuckets[entry->hash & (BFGlyphCacheBucketCount - 1)];
+    while (*link != entry) {
+        link = &(*link)->bucketNext;
+    }
+    *link = entry->bucketNext;
+    BFGlyphCacheUnlink(entry);
+    BFGlyphCacheCurrentStatistics.entryCount--;
+    BFGlyphCacheCurrentStatistics.memoryUsage -= entry->memoryUsage;
+    CFRelease(entry->fontName);
+    CGPathRelease(entry->outline);
+    free(entry);
+}
+
+static void BFGlyphCacheTrim(size_t memoryLimit) {
+    while (BFGlyphCacheOldest && BFGlyphCacheCurrentStatistics.memoryUsage > memoryLimit) {
+        BFGlyphCacheRemove(BFGlyphCacheOldest);
+        BFGlyphCacheCurrentStatistics.evictionCount++;
+    }
+}
+
+static void BFGlyphCacheGrow(void) {
+    size_t bucketCount = (BFGlyphCacheBucketCount ? BFGlyphCacheBucketCount * 2 : BF_GLYPH_CACHE_INITIAL_BUCKET_COUNT);
+    BFGlyphCacheEntry ** buckets = calloc(bucketCount, sizeof(BFGlyphCacheEntry *));
+    if (!buckets) {
+        return;
+    }
+    size_t index;
+    for (index = 0; index < BFGlyphCacheBucketCount; index++) {
+        BFGlyphCacheEntry * entry = BFGlyphCacheBuckets[index];
+        while (entry) {
+            BFGlyphCacheEntry * next = entry->bucketNext;
+            BFGlyphCacheEntry ** bucket = &buckets[entry->hash & (bucketCount - 1)];
+            entry->bucketNext = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(BFGlyphCacheBuckets);
+    BFGlyphCacheBuckets = buckets;
+    BFGlyphCacheBucketCount = bucketCount;
+}
+
+CF_RETURNS_RETAINED
+static CGPathRef BFGlyphCacheCreateOutline(CTFontRef font, CGGlyph glyph) {
+    // Rendering at one em per point gives the outline in font units, without the font's own matrix.
+    CTFontRef unitFont = CTFontCreateCopyWithAttributes(font, CTFontGetUnitsPerEm(font), &CGAffineTransformIdentity, NULL);
+    CGPathRef outline = NULL;
+    if (unitFont) {
+        outline = CTFontCreatePathForGlyph(unitFont, glyph, NULL);
+        CFRelease(unitFont);
+    }
+    return outline;
+}
+
+static BFGlyphCacheEntry * BFGlyphCacheFind(CFStringRef fontName, CGGlyph glyph, CFHashCode hash) {
+    BFGlyphCacheEntry * entry = NULL;
+    if (BFGlyphCacheBucketCount) {
+        entry = BFGlyphCacheBuckets[hash & (BFGlyphCacheBucketCount - 1)];
+        while (entry && !(entry->hash == hash && entry->glyph == glyph && CFEqual(entry->fontName, fontName))) {
+            entry = entry->bucketNext;
+        }
+    }
+    return entry;
+}
+
+CF_RETURNS_RETAINED
+static CGPathRef BFGlyphCacheCopyOutline(CTFontRef font, CFStringRef fontName, CFHashCode fontHash, CGGlyph glyph) {
+    CFHashCode hash = fontHash * 31 + glyph;
+    CGPathRef outline = NULL;
+    
+    pthread_mutex_lock(&BFGlyphCacheMutex);
+    BFGlyphCacheEntry * entry = BFGlyphCacheFind(fontName, glyph, hash);
+    if (entry) {
+        BFGlyphCacheCurrentStatistics.hitCount++;
+        BFGlyphCacheUnlink(entry);
+        BFGlyphCacheLinkNewest(entry);
+        outline = CGPathRetain(entry->outline);
+        pthread_mutex_unlock(&BFGlyphCacheMutex);
+        return outline;
+    }
+    BFGlyphCacheCurrentStatistics.missCount++;
+    pthread_mutex_unlock(&BFGlyphCacheMutex);
+    
+    // Extract the outline without holding the lock. If another thread raced us to it and added it first, keep theirs.
+    outline = BFGlyphCacheCreateOutline(font, glyph);
+    
+    pthread_mutex_lock(&BFGlyphCacheMutex);
+    entry = BFGlyphCacheFind(fontName, glyph, hash);
+    if (entry) {
+        BFGlyphCacheUnlink(entry);
+        BFGlyphCacheLinkNewest(entry);
+        CGPathRelease(outline);
+        outline = CGPathRetain(entry->outline);
+        pthread_mutex_unlock(&BFGlyphCacheMutex);
+        return outline;
+    }
+    if (BFGlyphCacheCurrentStatistics.entryCount >= BFGlyphCacheBucketCount * 3 / 4) {
+        BFGlyphCacheGrow();
+    }
+    entry = (BFGlyphCacheBucketCount ? malloc(sizeof(BFGlyphCacheEntry)) : NULL);
+    if (entry) {
+        entry->fontName = CFRetain(fontName);
+        entry->glyph = glyph;
+        entry->hash = hash;
+        entry->outline = CGPathRetain(outline);
+        entry->memoryUsage = BFGlyphCacheEstimateMemoryUsage(outline);
+        BFGlyphCacheEntry ** bucket = &BFGlyphCacheBuckets[hash & (BFGlyphCacheBucketCount - 1)];
+        entry->bucketNext = *bucket;
+        *bucket = entry;
+        BFGlyphCacheLinkNewest(entry);
+        BFGlyphCacheCurrentStatistics.entryCount++;
+        BFGlyphCacheCurrentStatistics.memoryUsage += entry->memoryUsage;
+        BFGlyphCacheTrim(BFGlyphCacheMemoryLimit);
+    }
+    pthread_mutex_unlock(&BFGlyphCacheMutex);
+    return outline;
+}
+
+void BFGlyphCacheAddGlyphsToPath(CGMutablePathRef path, CTFontRef font, const CGGlyph * glyphs, const CGPoint * positions, CFIndex glyphCount, double baselineOffset) {
+    // The font's key and transform are the same for every glyph in the run.
+    CFStringRef fontName = CTFontCopyPostScriptName(font);
+    CFHashCode fontHash = CFHash(fontName);
+    double scale = CTFontGetSize(font) / CTFontGetUnitsPerEm(font);
+    CGAffineTransform fontTransform = CGAffineTransformConcat(CGAffineTransformMakeScale(scale, scale), CTFontGetMatrix(font));
+    CFIndex glyphIndex;
+    for (glyphIndex = 0; glyphIndex < glyphCount; glyphIndex++) {
+        CGPathRef outline = BFGlyphCacheCopyOutline(font, fontName, fontHash, glyphs[glyphIndex]);
+        if (outline) {
+            CGAffineTransform glyphTransform = fontTransform;
+            glyphTransform.tx += positions[glyphIndex].x;
+            glyphTransform.ty += positions[glyphIndex].y + baselineOffset;
+            CGPathAddPath(path, &glyphTransform, outline);
+            CGPathRelease(outline);
+        }
+    }
+    CFRelease(fontName);
+}
+
+BFGlyphCacheStatistics BFGlyphCacheGetStatistics(void) {
+    pthread_mutex_lock(&BFGlyphCacheMutex);
+    BFGlyphCacheStatistics statistics = BFGlyphCacheCurrentStatistics;
+    pthread_mutex_unlock(&BFGlyphCacheMutex);
+    return statistics;
+}
+
+void BFGlyphCacheSetMemoryLimit(size_t memoryLimit) {
+    pthread_mutex_lock(&BFGlyphCacheMutex);
+    BFGlyphCacheMemoryLimit = memoryLimit;
+    BFGlyphCacheTrim(memoryLimit);
+    pthread_mutex_unlock(&BFGlyphCacheMutex);
+}
+
+void BFGlyphCachePurge(void) {
+    pthread_mutex_lock(&BFGlyphCacheMutex);
+    BFGlyphCacheTrim(0);
+    pthread_mutex_unlock(&BFGlyphCacheMutex);
+}
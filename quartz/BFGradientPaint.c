@@ -22,11 +22,22 @@
 //  THE SOFTWARE.
 //
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
+#include "BFComposite.h"
 #include "BFPaint.h"
 
+// The raster backend looks colors up in a table of premultiplied pixels sampled evenly between t = 0 and 1,
+// interpolating between neighboring entries. The extra entry at the end saves a bounds check.
+#define BF_GRADIENT_PAINT_TABLE_SIZE 1024
+
 typedef enum BFGradientPaintType {
     kBFGradientPaintLinear,
     kBFGradientPaintRadial,
@@ -34,22 +45,38 @@ typedef enum BFGradientPaintType {
 
 struct BFGradientPaint {
     struct BFPaint __base;
+#ifdef __APPLE__
     CGGradientRef gradient;
+#endif
     BFGradientPaintType type;
-    CGPoint locationPoints[2];
+    BFPoint locationPoints[2];
     double locationFloats[2];
+    int stopCount;
+    double * stopLocations;
+    double * stopComponents;
+    uint8_t * colorTable;
 };
 
 static void BFGradientPaintInit(BFGradientPaintRef gradientPaint);
 static void BFGradientPaintDealloc(BFGradientPaintRef gradientPaint);
+#ifdef __APPLE__
 static void BFGradientPaintFillRectInContext(BFGradientPaintRef gradientPaint, CGContextRef context, CGRect rect);
+#endif
+static void BFGradientPaintShadeSpan(BFGradientPaintRef gradientPaint, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span);
+static BFGradientPaintRef BFGradientPaintCreateSnapshot(BFGradientPaintRef gradientPaint);
+
+static void BFGradientPaintGetColor(BFGradientPaintRef gradientPaint, double t, uint8_t * pixel);
 
 static const BFPaintFunctions baseFunctions = {
     .__base = {
         .name = BFGradientPaintClassName,
         .dealloc = (BFBaseDeallocFunction)&BFGradientPaintDealloc,
     },
+#ifdef __APPLE__
     .fillRectInContext = (BFPaintFillRectInContextFunction)&BFGradientPaintFillRectInContext,
+#endif
+    .shadeSpan = (BFPaintShadeSpanFunction)&BFGradientPaintShadeSpan,
+    .createSnapshot = (BFPaintCreateSnapshotFunction)&BFGradientPaintCreateSnapshot,
 };
 
 BFGradientPaintRef BFGradientPaintCreate(void) {
@@ -61,52 +88,261 @@ BFGradientPaintRef BFGradientPaintCreate(void) {
 }
 
 static void BFGradientPaintInit(BFGradientPaintRef gradientPaint) {
+#ifdef __APPLE__
     gradientPaint->gradient = NULL;
+#endif
+    gradientPaint->type = kBFGradientPaintLinear;
+    gradientPaint->locationPoints[0] = (BFPoint){ .x = 0, .y = 0 };
+    gradientPaint->locationPoints[1] = (BFPoint){ .x = 0, .y = 0 };
+    gradientPaint->stopCount = 0;
+    gradientPaint->stopLocations = NULL;
+    gradientPaint->stopComponents = NULL;
+    gradientPaint->colorTable = NULL;
 }
 
 static void BFGradientPaintDealloc(BFGradientPaintRef gradientPaint) {
     if (gradientPaint) {
+#ifdef __APPLE__
         CGGradientRelease(gradientPaint->gradient);
+#endif
+        free(gradientPaint->stopLocations);
+        free(gradientPaint->stopComponents);
+        free(gradientPaint->colorTable);
     }
     BFPaintDealloc(gradientPaint);
 }
 
+static void * BFGradientPaintCopyArray(const void * array, size_t size) {
+    void * copy = (array ? malloc(size) : NULL);
+    if (copy) {
+        memcpy(copy, array, size);
+    }
+    return copy;
+}
+
+static BFGradientPaintRef BFGradientPaintCreateSnapshot(BFGradientPaintRef gradientPaint) {
+    BFGradientPaintRef snapshot = BFGradientPaintCreate();
+    if (snapshot) {
+#ifdef __APPLE__
+        snapshot->gradient = CGGradientRetain(gradientPaint->gradient);
+#endif
+        snapshot->type = gradientPaint->type;
+        memcpy(snapshot->locationPoints, gradientPaint->locationPoints, sizeof(snapshot->locationPoints));
+        memcpy(snapshot->locationFloats, gradientPaint->locationFloats, sizeof(snapshot->locationFloats));
+        snapshot->stopLocations = BFGradientPaintCopyArray(gradientPaint->stopLocations, gradientPaint->stopCount * sizeof(double));
+        snapshot->stopComponents = BFGradientPaintCopyArray(gradientPaint->stopComponents, gradientPaint->stopCount * 4 * sizeof(double));
+        snapshot->stopCount = ((snapshot->stopLocations && snapshot->stopComponents) ? gradientPaint->stopCount : 0);
+        snapshot->colorTable = BFGradientPaintCopyArray(gradientPaint->colorTable, (BF_GRADIENT_PAINT_TABLE_SIZE + 1) * 4);
+        BFMarkImmutable(snapshot);
+    }
+    return snapshot;
+}
+
 void BFGradientPaintSetColors(BFGradientPaintRef gradientPaint, int count, const BFColorPaintRef * colorPaints, const double * locations) {
-    CGColorRef objects[count];
+    if (BFIsImmutable(gradientPaint)) {
+        return;
+    }
     int index;
+#ifdef __APPLE__
+    CGColorRef objects[count];
     for (index = 0; index < count; index++) {
         objects[index] = BFColorPaintGetCGColor(colorPaints[index]);
     }
     CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceGenericRGB);
     CFArrayRef colors = CFArrayCreate(NULL, (const void **)objects, count, &kCFTypeArrayCallBacks);
+    CGGradientRelease(gradientPaint->gradient);
     gradientPaint->gradient = CGGradientCreateWithColors(colorSpace, colors, locations);
     CGColorSpaceRelease(colorSpace);
     CFRelease(colors);
+#endif
+    
+    // Keep the stops sorted by location for the raster backend.
+    free(gradientPaint->stopLocations);
+    free(gradientPaint->stopComponents);
+    gradientPaint->stopCount = 0;
+    gradientPaint->stopLocations = malloc(count * sizeof(double));
+    gradientPaint->stopComponents = malloc(count * 4 * sizeof(double));
+    if (gradientPaint->stopLocations && gradientPaint->stopComponents) {
+        for (index = 0; index < count; index++) {
+            double location = (locations ? locations[index] : (count > 1 ? (double)index / (count - 1) : 0));
+            int position = gradientPaint->stopCount++;
+            while (position > 0 && gradientPaint->stopLocations[position - 1] > location) {
+                gradientPaint->stopLocations[position] = gradientPaint->stopLocations[position - 1];
+                memcpy(&gradientPaint->stopComponents[position * 4], &gradientPaint->stopComponents[(position - 1) * 4], 4 * sizeof(double));
+                position--;
+            }
+            double * components = &gradientPaint->stopComponents[position * 4];
+            gradientPaint->stopLocations[position] = location;
+            BFColorPaintGetRGBA(colorPaints[index], &components[0], &components[1], &components[2], &components[3]);
+        }
+    }
+
+    free(gradientPaint->colorTable);
+    gradientPaint->colorTable = NULL;
+    if (gradientPaint->stopCount > 0) {
+        gradientPaint->colorTable = malloc((BF_GRADIENT_PAINT_TABLE_SIZE + 1) * 4);
+    }
+    if (gradientPaint->colorTable) {
+        for (index = 0; index < BF_GRADIENT_PAINT_TABLE_SIZE; index++) {
+            BFGradientPaintGetColor(gradientPaint, (double)index / (BF_GRADIENT_PAINT_TABLE_SIZE - 1), &gradientPaint->colorTable[index * 4]);
+        }
+        memcpy(&gradientPaint->colorTable[BF_GRADIENT_PAINT_TABLE_SIZE * 4], &gradientPaint->colorTable[(BF_GRADIENT_PAINT_TABLE_SIZE - 1) * 4], 4);
+    }
 }
 
 void BFGradientPaintSetLinearLocation(BFGradientPaintRef gradientPaint, BFPoint startPoint, BFPoint endPoint) {
+    if (BFIsImmutable(gradientPaint)) {
+        return;
+    }
     gradientPaint->type = kBFGradientPaintLinear;
-    gradientPaint->locationPoints[0] = BFPointToCGPoint(startPoint);
-    gradientPaint->locationPoints[1] = BFPointToCGPoint(endPoint);
+    gradientPaint->locationPoints[0] = startPoint;
+    gradientPaint->locationPoints[1] = endPoint;
 }
 
 void BFGradientPaintSetRadialLocation(BFGradientPaintRef gradientPaint, BFPoint startCenter, double startRadius, BFPoint endCenter, double endRadius) {
+    if (BFIsImmutable(gradientPaint)) {
+        return;
+    }
     gradientPaint->type = kBFGradientPaintRadial;
-    gradientPaint->locationPoints[0] = BFPointToCGPoint(startCenter);
+    gradientPaint->locationPoints[0] = startCenter;
     gradientPaint->locationFloats[0] = startRadius;
-    gradientPaint->locationPoints[1] = BFPointToCGPoint(endCenter);
+    gradientPaint->locationPoints[1] = endCenter;
     gradientPaint->locationFloats[1] = endRadius;
 }
 
+#ifdef __APPLE__
+
 void BFGradientPaintFillRectInContext(BFGradientPaintRef gradientPaint, CGContextRef context, CGRect rect) {
     if (gradientPaint->gradient) {
+        // Quartz shades gradients across the whole clip, so limit it to the rect being filled.
+        CGContextSaveGState(context);
+        CGContextClipToRect(context, rect);
         switch (gradientPaint->type) {
             case kBFGradientPaintLinear:
-                CGContextDrawLinearGradient(context, gradientPaint->gradient, gradientPaint->locationPoints[0], gradientPaint->locationPoints[1], kCGGradientDrawsBeforeStartLocation | kCGGradientDrawsAfterEndLocation);
+                CGContextDrawLinearGradient(context, gradientPaint->gradient, BFPointToCGPoint(gradientPaint->locationPoints[0]), BFPointToCGPoint(gradientPaint->locationPoints[1]), kCGGradientDrawsBeforeStartLocation | kCGGradientDrawsAfterEndLocation);
                 break;
             case kBFGradientPaintRadial:
-                CGContextDrawRadialGradient(context, gradientPaint->gradient, gradientPaint->locationPoints[0], gradientPaint->locationFloats[0], gradientPaint->locationPoints[1], gradientPaint->locationFloats[1], kCGGradientDrawsBeforeStartLocation | kCGGradientDrawsAfterEndLocation);
+                CGContextDrawRadialGradient(context, gradientPaint->gradient, BFPointToCGPoint(gradientPaint->locationPoints[0]), gradientPaint->locationFloats[0], BFPointToCGPoint(gradientPaint->locationPoints[1]), gradientPaint->locationFloats[1], kCGGradientDrawsBeforeStartLocation | kCGGradientDrawsAfterEndLocation);
                 break;
         }
+        CGContextRestoreGState(context);
+    }
+}
+
+#endif
+
+static bool BFGradientPaintGetParameter(BFGradientPaintRef gradientPaint, BFPoint point, double * t) {
+    BFPoint start = gradientPaint->locationPoints[0];
+    BFPoint end = gradientPaint->locationPoints[1];
+    double dx = end.x - start.x, dy = end.y - start.y;
+    double px = point.x - start.x, py = point.y - start.y;
+    if (gradientPaint->type == kBFGradientPaintLinear) {
+        double lengthSquared = dx * dx + dy * dy;
+        *t = (lengthSquared > 0 ? (px * dx + py * dy) / lengthSquared : 0);
+        return true;
+    }
+    // Two-point conical gradient: find the largest t where the point lies on the circle interpolated at t.
+    double startRadius = gradientPaint->locationFloats[0];
+    double dr = gradientPaint->locationFloats[1] - startRadius;
+    double a = dx * dx + dy * dy - dr * dr;
+    double b = px * dx + py * dy + startRadius * dr;
+    double c = px * px + py * py - startRadius * startRadius;
+    if (fabs(a) < 1e-9) {
+        if (b == 0) {
+            return false;
+        }
+        *t = c / (2 * b);
+        return (startRadius + *t * dr >= 0);
+    }
+    double discriminant = b * b - a * c;
+    if (discriminant < 0) {
+        return false;
+    }
+    double root = sqrt(discriminant);
+    double t1 = (b + root) / a, t2 = (b - root) / a;
+    if (t1 < t2) {
+        double swap = t1;
+        t1 = t2;
+        t2 = swap;
+    }
+    if (startRadius + t1 * dr >= 0) {
+        *t = t1;
+        return true;
+    } else if (startRadius + t2 * dr >= 0) {
+        *t = t2;
+        return true;
+    }
+    return false;
+}
+
+static void BFGradientPaintGetColor(BFGradientPaintRef gradientPaint, double t, uint8_t * pixel) {
+    const double * locations = gradientPaint->stopLocations;
+    const double * components = gradientPaint->stopComponents;
+    int last = gradientPaint->stopCount - 1;
+    if (t <= locations[0]) {
+        BFRasterPackColor(components[0], components[1], components[2], components[3], pixel);
+    } else if (t >= locations[last]) {
+        components += last * 4;
+        BFRasterPackColor(components[0], components[1], components[2], components[3], pixel);
+    } else {
+        int index = 0;
+        while (index < last - 1 && t > locations[index + 1]) {
+            index++;
+        }
+        double range = locations[index + 1] - locations[index];
+        double fraction = (range > 0 ? (t - locations[index]) / range : 1);
+        const double * c0 = components + index * 4, * c1 = c0 + 4;
+        BFRasterPackColor(c0[0] + (c1[0] - c0[0]) * fraction,
+                          c0[1] + (c1[1] - c0[1]) * fraction,
+                          c0[2] + (c1[2] - c0[2]) * fraction,
+                          c0[3] + (c1[3] - c0[3]) * fraction,
+                          pixel);
+    }
+}
+
+static inline void BFGradientPaintLookUpColor(const uint8_t * colorTable, double t, uint8_t * pixel) {
+    // The position in the table is split into an entry and an 8-bit fraction of the way to the next one.
+    t = (t > 0 ? (t < 1 ? t : 1) : 0);
+    int position = (int)(t * ((BF_GRADIENT_PAINT_TABLE_SIZE - 1) * 256) + 0.5);
+    const uint8_t * color0 = &colorTable[(position >> 8) * 4];
+    const uint8_t * color1 = color0 + 4;
+    int fraction = position & 255;
+    int channel;
+    for (channel = 0; channel < 4; channel++) {
+        pixel[channel] = (uint8_t)((color0[channel] * (256 - fraction) + color1[channel] * fraction + 128) >> 8);
+    }
+}
+
+static void BFGradientPaintShadeSpan(BFGradientPaintRef gradientPaint, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span) {
+    if (!gradientPaint->colorTable) {
+        memset(span, 0, count * 4);
+        return;
+    }
+    const uint8_t * colorTable = gradientPaint->colorTable;
+    BFPoint point = {
+        .x = deviceToUser->a * (x + 0.5) + deviceToUser->c * (y + 0.5) + deviceToUser->tx,
+        .y = deviceToUser->b * (x + 0.5) + deviceToUser->d * (y + 0.5) + deviceToUser->ty,
+    };
+    int index;
+    if (gradientPaint->type == kBFGradientPaintLinear) {
+        // t is linear along the span, so only its step is needed.
+        BFPoint start = gradientPaint->locationPoints[0];
+        BFPoint end = gradientPaint->locationPoints[1];
+        double dx = end.x - start.x, dy = end.y - start.y;
+        double lengthSquared = dx * dx + dy * dy;
+        double t0, step = (lengthSquared > 0 ? (deviceToUser->a * dx + deviceToUser->b * dy) / lengthSquared : 0);
+        BFGradientPaintGetParameter(gradientPaint, point, &t0);
+        BFCompositeLookUpSpan(colorTable, (BF_GRADIENT_PAINT_TABLE_SIZE - 1) * 256, t0, step, span, count);
+        return;
+    }
+    for (index = 0; index < count; index++, span += 4) {
+        double t;
+        if (BFGradientPaintGetParameter(gradientPaint, point, &t)) {
+            BFGradientPaintLookUpColor(colorTable, t, span);
+        } else {
+            memset(span, 0, 4);
+        }
+        point.x += deviceToUser->a;
+        point.y += deviceToUser->b;
     }
 }
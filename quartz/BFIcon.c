@@ -23,17 +23,36 @@
 //
 
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
+
+#include "BFCanvas.h"
+#include "BFRaster.h"
+
+#include <pthread.h>
+#include <string.h>
 
 struct BFIcon {
     struct BFBase __base;
+    BFRect boundsRect;
+    BFBitmapRef bitmap;
     BFCanvasRef canvas;
+#ifdef __APPLE__
+    // The last image copied from the canvas, reused until something is drawn into the canvas again.
+    CGImageRef image;
+    unsigned long imageChangeCount;
+#endif
+    size_t imageGenerationCount;
+    // The last immutable copy handed to a display list, reused the same way.
+    BFIconRef snapshot;
+    unsigned long snapshotChangeCount;
 };
 
-static void BFIconInit(BFIconRef icon, BFCanvasRef canvas);
-static void BFIconDealloc(BFIconRef icon);
+static pthread_mutex_t BFIconImageMutex = PTHREAD_MUTEX_INITIALIZER;
 
-static BFCanvasRef BFIconNewCanvas(BFRect boundsRect, size_t pixelWidth, size_t pixelHeight);
+static void BFIconInit(BFIconRef icon, BFRect boundsRect, size_t pixelWidth, size_t pixelHeight);
+static void BFIconDealloc(BFIconRef icon);
 
 static const BFBaseFunctions baseFunctions = {
     .name = BFIconClassName,
@@ -43,58 +62,150 @@ static const BFBaseFunctions baseFunctions = {
 BFIconRef BFIconCreate(BFRect boundsRect) {
     BFIconRef icon = BFAlloc(sizeof(struct BFIcon), &baseFunctions);
     if (icon) {
-        BFCanvasRef canvas = BFIconNewCanvas(boundsRect, boundsRect.right - boundsRect.left, boundsRect.top - boundsRect.bottom);
-        BFIconInit(icon, canvas);
+        BFIconInit(icon, boundsRect, boundsRect.right - boundsRect.left, boundsRect.top - boundsRect.bottom);
     }
     return BFRetain(icon);
 }
 
+#ifdef __APPLE__
+
 BFIconRef BFIconCreateWithCGImage(CGImageRef image, double width, double height) {
     BFIconRef icon = BFAlloc(sizeof(struct BFIcon), &baseFunctions);
     if (icon) {
         BFRect boundsRect = { .left = 0, .bottom = 0, .right = width, .top = height };
-        BFCanvasRef canvas = BFIconNewCanvas(boundsRect, CGImageGetWidth(image), CGImageGetHeight(image));
-        CGContextRef context = BFCanvasGetCGContext(canvas);
+        BFIconInit(icon, boundsRect, CGImageGetWidth(image), CGImageGetHeight(image));
+        CGContextRef context = BFCanvasGetCGContext(icon->canvas);
         CGContextDrawImage(context, BFRectToCGRect(boundsRect), image);
-        BFIconInit(icon, canvas);
+        BFCanvasNoteChanged(icon->canvas);
     }
     return BFRetain(icon);
 }
 
-static void BFIconInit(BFIconRef icon, BFCanvasRef canvas) {
-    icon->canvas = canvas;
+#endif
+
+static void BFIconInit(BFIconRef icon, BFRect boundsRect, size_t pixelWidth, size_t pixelHeight) {
+    // The pixels come from the shared pool, and go back to it once the canvas is released.
+    BFBitmapRef bitmap = BFBitmapPoolCreateBitmap(BFBitmapPoolGetDefault(), pixelWidth, pixelHeight);
+#ifdef __APPLE__
+    CGContextRef context = (bitmap ? BFBitmapGetCGContext(bitmap) : NULL);
+    CGContextScaleCTM(context, pixelWidth / (boundsRect.right - boundsRect.left), pixelHeight / (boundsRect.top - boundsRect.bottom));
+#endif
+    BFCanvasMetricsRef metrics = BFCanvasMetricsCreate(boundsRect, 1, 1);
+    icon->boundsRect = boundsRect;
+    icon->canvas = (bitmap ? BFBitmapCreateCanvas(bitmap, metrics) : NULL);
+    icon->bitmap = (icon->canvas ? bitmap : NULL);
+    if (!icon->canvas) {
+        // Empty or oversized icons get no bitmap context, but still need a canvas to draw into.
+#ifdef __APPLE__
+        icon->canvas = BFCanvasCreateForDisplay(NULL, metrics);
+#else
+        icon->canvas = BFCanvasCreateForBitmap(NULL, 0, metrics);
+#endif
+        BFRelease(bitmap);
+    }
+#ifdef __APPLE__
+    icon->image = NULL;
+    icon->imageChangeCount = 0;
+#endif
+    icon->imageGenerationCount = 0;
+    icon->snapshot = NULL;
+    icon->snapshotChangeCount = 0;
+    BFRelease(metrics);
 }
 
 static void BFIconDealloc(BFIconRef icon) {
     if (icon) {
         BFRelease(icon->canvas);
+        BFRelease(icon->bitmap);
+#ifdef __APPLE__
+        CGImageRelease(icon->image);
+#endif
+        BFRelease(icon->snapshot);
     }
     BFDealloc(icon);
 }
 
-static BFCanvasRef BFIconNewCanvas(BFRect boundsRect, size_t pixelWidth, size_t pixelHeight) {
-    CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
-    CGContextRef context = CGBitmapContextCreate(NULL,
-                                                 pixelWidth,
-                                                 pixelHeight,
-                                                 8,
-                                                 4 * pixelWidth,
-                                                 colorSpace,
-                                                 kCGImageAlphaPremultipliedLast);
-    CGContextScaleCTM(context, pixelWidth / (boundsRect.right - boundsRect.left), pixelHeight / (boundsRect.top - boundsRect.bottom));
-    CGColorSpaceRelease(colorSpace);
-    BFCanvasMetricsRef metrics = BFCanvasMetricsCreate(boundsRect, 1, 1);
-    BFCanvasRef canvas = BFCanvasCreateForDisplay(context, metrics);
-    CGContextRelease(context);
-    BFRelease(metrics);
-    return canvas;
-}
-
 BFCanvasRef BFIconGetCanvas(BFIconRef icon) {
     return icon->canvas;
 }
 
+size_t BFIconGetImageGenerationCount(BFIconRef icon) {
+    pthread_mutex_lock(&BFIconImageMutex);
+    size_t count = icon->imageGenerationCount;
+    pthread_mutex_unlock(&BFIconImageMutex);
+    return count;
+}
+
+#ifdef __APPLE__
+
 CGImageRef BFIconCopyCGImage(BFIconRef icon) {
-    CGContextRef context = BFCanvasGetCGContext(icon->canvas);
-    return CGBitmapContextCreateImage(context);
+    // Quartz copies the bitmap lazily, when the context is next drawn into, so while the icon is unchanged
+    // every draw shares one image.
+    pthread_mutex_lock(&BFIconImageMutex);
+    unsigned long changeCount = BFCanvasGetChangeCount(icon->canvas);
+    if (!icon->image || icon->imageChangeCount != changeCount) {
+        CGImageRelease(icon->image);
+        icon->image = CGBitmapContextCreateImage(BFCanvasGetCGContext(icon->canvas));
+        icon->imageChangeCount = changeCount;
+        icon->imageGenerationCount++;
+    }
+    CGImageRef image = CGImageRetain(icon->image);
+    pthread_mutex_unlock(&BFIconImageMutex);
+    return image;
+}
+
+#endif
+
+BFIconRef BFIconCopySnapshot(BFIconRef icon) {
+    if (BFIsImmutable(icon)) {
+        return BFRetain(icon);
+    }
+    pthread_mutex_lock(&BFIconImageMutex);
+    unsigned long changeCount = BFCanvasGetChangeCount(icon->canvas);
+    if (icon->snapshot && icon->snapshotChangeCount == changeCount) {
+        BFIconRef snapshot = BFRetain(icon->snapshot);
+        pthread_mutex_unlock(&BFIconImageMutex);
+        return snapshot;
+    }
+    pthread_mutex_unlock(&BFIconImageMutex);
+
+    // Copy the pixels into a fresh icon of the same size. An icon without pixels of its own can't be copied, and
+    // is shared as it is.
+    BFRasterBitmap bitmap, snapshotBitmap;
+    if (!BFIconGetRasterBitmap(icon, &bitmap)) {
+        return BFRetain(icon);
+    }
+    BFIconRef snapshot = BFAlloc(sizeof(struct BFIcon), &baseFunctions);
+    if (snapshot) {
+        BFIconInit(snapshot, icon->boundsRect, bitmap.width, bitmap.height);
+        snapshot = BFRetain(snapshot);
+    }
+    if (!snapshot || !BFIconGetRasterBitmap(snapshot, &snapshotBitmap)) {
+        BFRelease(snapshot);
+        return BFRetain(icon);
+    }
+    int row;
+    for (row = 0; row < bitmap.height; row++) {
+        memcpy(snapshotBitmap.pixels + row * snapshotBitmap.stride, bitmap.pixels + row * bitmap.stride, bitmap.width * 4);
+    }
+    BFMarkImmutable(snapshot);
+
+    pthread_mutex_lock(&BFIconImageMutex);
+    BFRelease(icon->snapshot);
+    icon->snapshot = BFRetain(snapshot);
+    icon->snapshotChangeCount = changeCount;
+    pthread_mutex_unlock(&BFIconImageMutex);
+    return snapshot;
+}
+
+bool BFIconGetRasterBitmap(BFIconRef icon, BFRasterBitmap * bitmap) {
+    // The canvas draws straight into the pooled pixels, whichever backend it uses.
+    if (icon->bitmap) {
+        bitmap->pixels = BFBitmapGetPixels(icon->bitmap);
+        bitmap->stride = BFBitmapGetStride(icon->bitmap);
+        bitmap->width = (int)BFBitmapGetWidth(icon->bitmap);
+        bitmap->height = (int)BFBitmapGetHeight(icon->bitmap);
+        return true;
+    }
+    return false;
 }
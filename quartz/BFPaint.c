@@ -23,7 +23,9 @@
 //
 
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
 #include "BFPaint.h"
 
@@ -31,6 +33,8 @@ void BFPaintDealloc(void * object) {
     BFDealloc(object);
 }
 
+#ifdef __APPLE__
+
 bool BFPaintSetInContext(BFPaintRef paint, CGContextRef context) {
     bool result = false;
     const BFPaintFunctions * subclass = BFSubclassFunctions(paint);
@@ -47,3 +51,24 @@ void BFPaintFillRectInContext(BFPaintRef paint, CGContextRef context, CGRect rec
         subclass->fillRectInContext(paint, context, rect);
     }
 }
+
+#endif
+
+BFPaintRef BFPaintCopySnapshot(BFPaintRef paint) {
+    const BFPaintFunctions * subclass = (paint ? BFSubclassFunctions(paint) : NULL);
+    if (!BFIsImmutable(paint) && subclass && subclass->createSnapshot) {
+        return subclass->createSnapshot(paint);
+    }
+    return BFRetain(paint);
+}
+
+bool BFPaintGetRasterSource(BFPaintRef paint, BFTransformationComponents deviceToUser, BFRasterSource * source) {
+    const BFPaintFunctions * subclass = BFSubclassFunctions(paint);
+    if (subclass && subclass->shadeSpan) {
+        source->shade = (BFRasterShadeFunction)subclass->shadeSpan;
+        source->object = paint;
+        source->deviceToUser = deviceToUser;
+        return true;
+    }
+    return false;
+}
@@ -25,18 +25,30 @@
 #ifndef __BF_PAINT_H__
 #define __BF_PAINT_H__
 
+#ifdef __APPLE__
 #include <CoreGraphics/CoreGraphics.h>
+#endif
 
 #include "butterfly.h"
 
+#include "BFRaster.h"
+
 typedef void (* BFPaintDeallocFunction)(void *);
+#ifdef __APPLE__
 typedef void (* BFPaintSetInContextFunction)(void *, CGContextRef);
 typedef void (* BFPaintFillRectInContextFunction)(void *, CGContextRef, CGRect);
+#endif
+typedef void (* BFPaintShadeSpanFunction)(void *, const BFTransformationComponents *, int, int, int, uint8_t *);
+typedef void * (* BFPaintCreateSnapshotFunction)(void *);
 typedef struct BFPaintFunctions {
     BFBaseFunctions __base;
     BFPaintDeallocFunction dealloc;
+#ifdef __APPLE__
     BFPaintSetInContextFunction setInContext;
     BFPaintFillRectInContextFunction fillRectInContext;
+#endif
+    BFPaintShadeSpanFunction shadeSpan;
+    BFPaintCreateSnapshotFunction createSnapshot;
 } BFPaintFunctions;
 
 struct BFPaint {
@@ -45,4 +57,9 @@ struct BFPaint {
 
 void BFPaintDealloc(void * paint);
 
+// An immutable paint that draws the same as this one does now. Immutable paints are returned as they are.
+BFPaintRef BFPaintCopySnapshot(BFPaintRef paint);
+
+bool BFPaintGetRasterSource(BFPaintRef paint, BFTransformationComponents deviceToUser, BFRasterSource * source);
+
 #endif /* __BF_PAINT_H__ */
@@ -23,7 +23,9 @@
 //
 
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
 struct BFPaintMode {
     struct BFBase __base;
@@ -56,8 +58,18 @@ static void BFPaintModeDealloc(BFPaintModeRef paintMode) {
     BFDealloc(paintMode);
 }
 
+BFPaintModeType BFPaintModeGetType(BFPaintModeRef paintMode) {
+    return paintMode->type;
+}
+
+#ifdef __APPLE__
+
 CGBlendMode BFPaintModeCGBlendMode(BFPaintModeRef paintMode) {
-    switch (paintMode->type) {
+    return BFPaintModeTypeCGBlendMode(paintMode->type);
+}
+
+CGBlendMode BFPaintModeTypeCGBlendMode(BFPaintModeType paintModeType) {
+    switch (paintModeType) {
         case kBFPaintModeNormal:
             return kCGBlendModeNormal;
         case kBFPaintModeMultiply:
@@ -118,3 +130,5 @@ CGBlendMode BFPaintModeCGBlendMode(BFPaintModeRef paintMode) {
             return kCGBlendModeNormal;
     }
 }
+
+#endif
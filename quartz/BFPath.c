@@ -22,28 +22,70 @@
 //  THE SOFTWARE.
 //
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <tgmath.h>
 
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
-#include "BFQuartzTypes.h"
+#include "BFPath.h"
+
+// Enough for a path drawn at one scale and hit-tested at another.
+#define BF_PATH_FLATTENED_CACHE_SIZE 2
 
 struct BFPath {
     struct BFBase __base;
+    uint8_t * verbs;
+    size_t verbCount;
+    size_t verbCapacity;
+    BFPoint * points;
+    size_t pointCount;
+    size_t pointCapacity;
+    bool hasCurrentPoint;
+    BFPoint startPoint;
+    BFPoint currentPoint;
+    BFRect bounds;
+    BFRect controlBounds;
+#ifdef __APPLE__
     CGMutablePathRef pathRef;
+#endif
+    BFFlattenedPathRef flattenedPaths[BF_PATH_FLATTENED_CACHE_SIZE];
+};
+
+struct BFFlattenedPath {
+    struct BFBase __base;
+    double tolerance;
+    int scaleBucket;
+    BFPoint * points;
+    size_t pointCount;
+    size_t pointCapacity;
+    BFFlattenedSubpath * subpaths;
+    size_t subpathCount;
+    size_t subpathCapacity;
 };
 
 static void BFPathInit(BFPathRef path);
 static void BFPathDealloc(BFPathRef path);
-
-static void BFPathCGPathElementToComponent(BFFunctionUserData * userData, const CGPathElement * element);
+static bool BFPathReserve(BFPathRef path, size_t verbCount, size_t pointCount);
+static void BFPathClearFlattenedPaths(BFPathRef path);
+static void BFFlattenedPathDealloc(BFFlattenedPathRef flattenedPath);
 
 static const BFBaseFunctions baseFunctions = {
     .name = BFPathClassName,
     .dealloc = (BFBaseDeallocFunction)&BFPathDealloc,
 };
 
+static const BFBaseFunctions flattenedPathBaseFunctions = {
+    .name = BFFlattenedPathClassName,
+    .dealloc = (BFBaseDeallocFunction)&BFFlattenedPathDealloc,
+};
+
+static pthread_mutex_t BFPathFlattenedCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
 BFPathRef BFPathCreate(void) {
     BFPathRef path = BFAlloc(sizeof(struct BFPath), &baseFunctions);
     if (path) {
@@ -52,106 +94,703 @@ BFPathRef BFPathCreate(void) {
     return BFRetain(path);
 }
 
+BFPathRef BFPathCreateCopy(BFPathRef path) {
+    BFPathRef copy = BFPathCreate();
+    if (copy && BFPathReserve(copy, path->verbCount, path->pointCount)) {
+        memcpy(copy->verbs, path->verbs, path->verbCount);
+        memcpy(copy->points, path->points, path->pointCount * sizeof(BFPoint));
+        copy->verbCount = path->verbCount;
+        copy->pointCount = path->pointCount;
+        copy->hasCurrentPoint = path->hasCurrentPoint;
+        copy->startPoint = path->startPoint;
+        copy->currentPoint = path->currentPoint;
+        copy->bounds = path->bounds;
+        copy->controlBounds = path->controlBounds;
+        // The copy has the same geometry, so it can share the flattened results.
+        pthread_mutex_lock(&BFPathFlattenedCacheMutex);
+        int index;
+        for (index = 0; index < BF_PATH_FLATTENED_CACHE_SIZE; index++) {
+            copy->flattenedPaths[index] = BFRetain(path->flattenedPaths[index]);
+        }
+        pthread_mutex_unlock(&BFPathFlattenedCacheMutex);
+    }
+    return copy;
+}
+
 static void BFPathInit(BFPathRef path) {
-    path->pathRef = CGPathCreateMutable();
+    path->verbs = NULL;
+    path->verbCount = 0;
+    path->verbCapacity = 0;
+    path->points = NULL;
+    path->pointCount = 0;
+    path->pointCapacity = 0;
+    path->hasCurrentPoint = false;
+    path->startPoint = (BFPoint){ .x = 0, .y = 0 };
+    path->currentPoint = (BFPoint){ .x = 0, .y = 0 };
+    path->bounds = (BFRect){ .left = 0, .bottom = 0, .right = 0, .top = 0 };
+    path->controlBounds = path->bounds;
+#ifdef __APPLE__
+    path->pathRef = NULL;
+#endif
+    memset(path->flattenedPaths, 0, sizeof(path->flattenedPaths));
 }
 
 static void BFPathDealloc(BFPathRef path) {
     if (path) {
+        free(path->verbs);
+        free(path->points);
+#ifdef __APPLE__
         CGPathRelease(path->pathRef);
+#endif
+        BFPathClearFlattenedPaths(path);
     }
     BFDealloc(path);
 }
 
+int BFPathVerbPointCount(BFPathComponentType verb) {
+    switch (verb) {
+        case kBFPathComponentMove:
+        case kBFPathComponentAddLine:
+            return 1;
+        case kBFPathComponentAddQuadCurve:
+            return 2;
+        case kBFPathComponentAddCurve:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static bool BFPathReserve(BFPathRef path, size_t verbCount, size_t pointCount) {
+    // Every change to a path reserves room first, so refusing here keeps an immutable path's storage in place for
+    // the threads reading it.
+    if (BFIsImmutable(path)) {
+        return false;
+    }
+    if (path->verbCount + verbCount > path->verbCapacity) {
+        size_t capacity = (path->verbCapacity ? path->verbCapacity * 2 : 16);
+        while (capacity < path->verbCount + verbCount) {
+            capacity *= 2;
+        }
+        uint8_t * verbs = realloc(path->verbs, capacity);
+        if (!verbs) {
+            return false;
+        }
+        path->verbs = verbs;
+        path->verbCapacity = capacity;
+    }
+    if (path->pointCount + pointCount > path->pointCapacity) {
+        size_t capacity = (path->pointCapacity ? path->pointCapacity * 2 : 16);
+        while (capacity < path->pointCount + pointCount) {
+            capacity *= 2;
+        }
+        BFPoint * points = realloc(path->points, capacity * sizeof(BFPoint));
+        if (!points) {
+            return false;
+        }
+        path->points = points;
+        path->pointCapacity = capacity;
+    }
+    return true;
+}
+
+static void BFPathIncludePoint(BFRect * rect, BFPoint point) {
+    rect->left = fmin(rect->left, point.x);
+    rect->bottom = fmin(rect->bottom, point.y);
+    rect->right = fmax(rect->right, point.x);
+    rect->top = fmax(rect->top, point.y);
+}
+
+static int BFPathCurveExtrema(double p0, double p1, double p2, double p3, double * t) {
+    // Roots in (0, 1) of the derivative a t^2 + b t + c, scaled by 1/3.
+    double a = p3 - p0 + 3 * (p1 - p2), b = 2 * (p0 - 2 * p1 + p2), c = p1 - p0;
+    int count = 0;
+    if (fabs(a) < 1e-12) {
+        if (b != 0) {
+            t[count++] = -c / b;
+        }
+    } else {
+        double discriminant = b * b - 4 * a * c;
+        if (discriminant >= 0) {
+            double root = sqrt(discriminant);
+            t[count++] = (-b + root) / (2 * a);
+            t[count++] = (-b - root) / (2 * a);
+        }
+    }
+    int index, inside = 0;
+    for (index = 0; index < count; index++) {
+        if (t[index] > 0 && t[index] < 1) {
+            t[inside++] = t[index];
+        }
+    }
+    return inside;
+}
+
+static void BFPathUpdateBounds(BFPathRef path, BFPathComponentType verb, const BFPoint * points) {
+    // Kept up to date as segments are added, so both bounds are free to query.
+    int index, pointCount = BFPathVerbPointCount(verb);
+    if (path->pointCount == (size_t)pointCount) {
+        path->bounds = path->controlBounds = (BFRect){ .left = points[0].x, .bottom = points[0].y, .right = points[0].x, .top = points[0].y };
+    }
+    for (index = 0; index < pointCount; index++) {
+        BFPathIncludePoint(&path->controlBounds, points[index]);
+    }
+    BFPathIncludePoint(&path->bounds, points[pointCount - 1]);
+    if (verb == kBFPathComponentAddQuadCurve || verb == kBFPathComponentAddCurve) {
+        // A quad is the cubic with control points two thirds of the way to its control point.
+        BFPoint p0 = path->currentPoint;
+        BFPoint p1 = points[0], p2 = points[1], p3 = points[pointCount - 1];
+        if (verb == kBFPathComponentAddQuadCurve) {
+            p1 = (BFPoint){ .x = p0.x + 2.0 / 3.0 * (points[0].x - p0.x), .y = p0.y + 2.0 / 3.0 * (points[0].y - p0.y) };
+            p2 = (BFPoint){ .x = p3.x + 2.0 / 3.0 * (points[0].x - p3.x), .y = p3.y + 2.0 / 3.0 * (points[0].y - p3.y) };
+        }
+        double t[4];
+        int count = BFPathCurveExtrema(p0.x, p1.x, p2.x, p3.x, t);
+        count += BFPathCurveExtrema(p0.y, p1.y, p2.y, p3.y, t + count);
+        for (index = 0; index < count; index++) {
+            double mt = 1 - t[index];
+            double a = mt * mt * mt, b = 3 * mt * mt * t[index], c = 3 * mt * t[index] * t[index], d = t[index] * t[index] * t[index];
+            BFPathIncludePoint(&path->bounds, (BFPoint){
+                .x = a * p0.x + b * p1.x + c * p2.x + d * p3.x,
+                .y = a * p0.y + b * p1.y + c * p2.y + d * p3.y,
+            });
+        }
+    }
+}
+
+static BFPoint * BFPathAppend(BFPathRef path, BFPathComponentType verb) {
+    int pointCount = BFPathVerbPointCount(verb);
+    if (!BFPathReserve(path, 1, pointCount)) {
+        return NULL;
+    }
+#ifdef __APPLE__
+    if (path->pathRef) {
+        CGPathRelease(path->pathRef);
+        path->pathRef = NULL;
+    }
+#endif
+    if (path->flattenedPaths[0]) {
+        BFPathClearFlattenedPaths(path);
+    }
+    BFPoint * points = path->points + path->pointCount;
+    path->verbs[path->verbCount++] = verb;
+    path->pointCount += pointCount;
+    return points;
+}
+
 void BFPathMoveToPoint(BFPathRef path, BFPoint point) {
-    CGPathMoveToPoint(path->pathRef, NULL, point.x, point.y);
+    BFPoint * points = BFPathAppend(path, kBFPathComponentMove);
+    if (points) {
+        points[0] = point;
+        BFPathUpdateBounds(path, kBFPathComponentMove, points);
+        path->startPoint = point;
+        path->currentPoint = point;
+        path->hasCurrentPoint = true;
+    }
 }
 
 void BFPathAddLineToPoint(BFPathRef path, BFPoint point) {
-    CGPathAddLineToPoint(path->pathRef, NULL, point.x, point.y);
+    BFPoint * points = (path->hasCurrentPoint ? BFPathAppend(path, kBFPathComponentAddLine) : NULL);
+    if (points) {
+        points[0] = point;
+        BFPathUpdateBounds(path, kBFPathComponentAddLine, points);
+        path->currentPoint = point;
+    }
 }
 
 void BFPathAddCurveToPoint(BFPathRef path, BFPoint point, BFPoint controlPoint1, BFPoint controlPoint2) {
-    CGPathAddCurveToPoint(path->pathRef, NULL, controlPoint1.x, controlPoint1.y, controlPoint2.x, controlPoint2.y, point.x, point.y);
+    BFPoint * points = (path->hasCurrentPoint ? BFPathAppend(path, kBFPathComponentAddCurve) : NULL);
+    if (points) {
+        points[0] = controlPoint1;
+        points[1] = controlPoint2;
+        points[2] = point;
+        BFPathUpdateBounds(path, kBFPathComponentAddCurve, points);
+        path->currentPoint = point;
+    }
 }
 
 void BFPathAddQuadCurveToPoint(BFPathRef path, BFPoint point, BFPoint controlPoint) {
-    CGPathAddQuadCurveToPoint(path->pathRef, NULL, controlPoint.x, controlPoint.y, point.x, point.y);
+    BFPoint * points = (path->hasCurrentPoint ? BFPathAppend(path, kBFPathComponentAddQuadCurve) : NULL);
+    if (points) {
+        points[0] = controlPoint;
+        points[1] = point;
+        BFPathUpdateBounds(path, kBFPathComponentAddQuadCurve, points);
+        path->currentPoint = point;
+    }
+}
+
+static void BFPathAddArcWithRadius(BFPathRef path, BFPoint centerPoint, double radius, double startAngle, double arcAngle) {
+    // Arcs are stored as cubic Béziers of at most a quarter turn each, like CGPathAddArc.
+    BFPoint startPoint = { .x = centerPoint.x + radius * cos(startAngle), .y = centerPoint.y + radius * sin(startAngle) };
+    if (!path->hasCurrentPoint) {
+        BFPathMoveToPoint(path, startPoint);
+    } else if (path->currentPoint.x != startPoint.x || path->currentPoint.y != startPoint.y) {
+        BFPathAddLineToPoint(path, startPoint);
+    }
+    if (arcAngle > 2 * M_PI) {
+        arcAngle = 2 * M_PI;
+    } else if (arcAngle < -2 * M_PI) {
+        arcAngle = -2 * M_PI;
+    }
+    int segmentCount = (int)ceil(fabs(arcAngle) / M_PI_2 - 1e-9);
+    double segmentAngle = (segmentCount > 0 ? arcAngle / segmentCount : 0);
+    double k = 4.0 / 3.0 * tan(segmentAngle / 4) * radius;
+    double angle = startAngle;
+    int index;
+    for (index = 0; index < segmentCount; index++) {
+        double nextAngle = (index == segmentCount - 1 ? startAngle + arcAngle : angle + segmentAngle);
+        double cos0 = cos(angle), sin0 = sin(angle), cos1 = cos(nextAngle), sin1 = sin(nextAngle);
+        BFPoint controlPoint1 = { .x = centerPoint.x + radius * cos0 - k * sin0, .y = centerPoint.y + radius * sin0 + k * cos0 };
+        BFPoint controlPoint2 = { .x = centerPoint.x + radius * cos1 + k * sin1, .y = centerPoint.y + radius * sin1 - k * cos1 };
+        BFPoint point = { .x = centerPoint.x + radius * cos1, .y = centerPoint.y + radius * sin1 };
+        BFPathAddCurveToPoint(path, point, controlPoint1, controlPoint2);
+        angle = nextAngle;
+    }
 }
 
 void BFPathAddArc(BFPathRef path, BFPoint centerPoint, double arcAngle) {
-    CGPoint currentPoint = CGPathGetCurrentPoint(path->pathRef);
+    BFPoint currentPoint = path->currentPoint;
     double radius = hypot(currentPoint.y - centerPoint.y, currentPoint.x - centerPoint.x);
     double startAngle = atan2(currentPoint.y - centerPoint.y, currentPoint.x - centerPoint.x);
-    double endAngle = startAngle + arcAngle;
-    bool clockwise = (arcAngle < 0);
-    CGPathAddArc(path->pathRef, NULL, centerPoint.x, centerPoint.y, radius, startAngle, endAngle, clockwise);
+    BFPathAddArcWithRadius(path, centerPoint, radius, startAngle, arcAngle);
 }
 
 void BFPathCloseSubpath(BFPathRef path) {
-    CGPathCloseSubpath(path->pathRef);
+    if (path->hasCurrentPoint && BFPathAppend(path, kBFPathComponentCloseSubpath)) {
+        path->currentPoint = path->startPoint;
+    }
 }
 
 void BFPathAddRect(BFPathRef path, BFRect rect) {
-    CGPathAddRect(path->pathRef, NULL, BFRectToCGRect(rect));
+    BFPathMoveToPoint(path, (BFPoint){ .x = rect.left, .y = rect.bottom });
+    BFPathAddLineToPoint(path, (BFPoint){ .x = rect.right, .y = rect.bottom });
+    BFPathAddLineToPoint(path, (BFPoint){ .x = rect.right, .y = rect.top });
+    BFPathAddLineToPoint(path, (BFPoint){ .x = rect.left, .y = rect.top });
+    BFPathCloseSubpath(path);
 }
 
 void BFPathAddRoundedRect(BFPathRef path, BFRect rect, double radius) {
-    CGPathMoveToPoint(path->pathRef, NULL, rect.left, rect.bottom + radius);
-    CGPathAddArc(path->pathRef, NULL, rect.left + radius, rect.top - radius, radius, M_PI, M_PI_2, 1);
-    CGPathAddArc(path->pathRef, NULL, rect.right - radius, rect.top - radius, radius, M_PI_2, 0, 1);
-    CGPathAddArc(path->pathRef, NULL, rect.right - radius, rect.bottom + radius, radius, 0, -M_PI_2, 1);
-    CGPathAddArc(path->pathRef, NULL, rect.left + radius, rect.bottom + radius, radius, -M_PI_2, -M_PI, 1);
-    CGPathCloseSubpath(path->pathRef);
+    BFPathMoveToPoint(path, (BFPoint){ .x = rect.left, .y = rect.bottom + radius });
+    BFPathAddArcWithRadius(path, (BFPoint){ .x = rect.left + radius, .y = rect.top - radius }, radius, M_PI, -M_PI_2);
+    BFPathAddArcWithRadius(path, (BFPoint){ .x = rect.right - radius, .y = rect.top - radius }, radius, M_PI_2, -M_PI_2);
+    BFPathAddArcWithRadius(path, (BFPoint){ .x = rect.right - radius, .y = rect.bottom + radius }, radius, 0, -M_PI_2);
+    BFPathAddArcWithRadius(path, (BFPoint){ .x = rect.left + radius, .y = rect.bottom + radius }, radius, -M_PI_2, -M_PI_2);
+    BFPathCloseSubpath(path);
 }
 
 void BFPathAddOvalInRect(BFPathRef path, BFRect rect) {
-    CGPathAddEllipseInRect(path->pathRef, NULL, BFRectToCGRect(rect));
+    BFPoint centerPoint = { .x = (rect.left + rect.right) / 2, .y = (rect.bottom + rect.top) / 2 };
+    double rx = (rect.right - rect.left) / 2, ry = (rect.top - rect.bottom) / 2;
+    double kx = rx * 0.5522847498307936, ky = ry * 0.5522847498307936;
+    BFPathMoveToPoint(path, (BFPoint){ .x = rect.right, .y = centerPoint.y });
+    BFPathAddCurveToPoint(path, (BFPoint){ .x = centerPoint.x, .y = rect.top }, (BFPoint){ .x = rect.right, .y = centerPoint.y + ky }, (BFPoint){ .x = centerPoint.x + kx, .y = rect.top });
+    BFPathAddCurveToPoint(path, (BFPoint){ .x = rect.left, .y = centerPoint.y }, (BFPoint){ .x = centerPoint.x - kx, .y = rect.top }, (BFPoint){ .x = rect.left, .y = centerPoint.y + ky });
+    BFPathAddCurveToPoint(path, (BFPoint){ .x = centerPoint.x, .y = rect.bottom }, (BFPoint){ .x = rect.left, .y = centerPoint.y - ky }, (BFPoint){ .x = centerPoint.x - kx, .y = rect.bottom });
+    BFPathAddCurveToPoint(path, (BFPoint){ .x = rect.right, .y = centerPoint.y }, (BFPoint){ .x = centerPoint.x + kx, .y = rect.bottom }, (BFPoint){ .x = rect.right, .y = centerPoint.y - ky });
+    BFPathCloseSubpath(path);
+}
+
+void BFPathAddPolyline(BFPathRef path, BFBufferRef buffer, bool closed) {
+    size_t index, count = BFBufferGetPointCount(buffer);
+    if (count == 0 || !BFPathReserve(path, count + 1, count)) {
+        return;
+    }
+    BFPathMoveToPoint(path, BFBufferGetPoint(buffer, 0));
+    for (index = 1; index < count; index++) {
+        BFPathAddLineToPoint(path, BFBufferGetPoint(buffer, index));
+    }
+    if (closed) {
+        BFPathCloseSubpath(path);
+    }
+}
+
+static BFPoint BFPathGetSplinePoint(BFBufferRef buffer, size_t count, long index, bool closed) {
+    if (closed) {
+        index = (index % (long)count + (long)count) % (long)count;
+    } else if (index < 0) {
+        index = 0;
+    } else if (index >= (long)count) {
+        index = count - 1;
+    }
+    return BFBufferGetPoint(buffer, index);
+}
+
+void BFPathAddSpline(BFPathRef path, BFBufferRef buffer, bool closed) {
+    // A uniform Catmull-Rom spline through every point, as cubic Béziers. Open ends repeat their endpoint.
+    size_t index, count = BFBufferGetPointCount(buffer);
+    if (count < 3) {
+        BFPathAddPolyline(path, buffer, closed);
+        return;
+    }
+    size_t segmentCount = (closed ? count : count - 1);
+    if (!BFPathReserve(path, segmentCount + 2, segmentCount * 3 + 1)) {
+        return;
+    }
+    BFPathMoveToPoint(path, BFBufferGetPoint(buffer, 0));
+    for (index = 0; index < segmentCount; index++) {
+        BFPoint point0 = BFPathGetSplinePoint(buffer, count, (long)index - 1, closed);
+        BFPoint point1 = BFPathGetSplinePoint(buffer, count, index, closed);
+        BFPoint point2 = BFPathGetSplinePoint(buffer, count, index + 1, closed);
+        BFPoint point3 = BFPathGetSplinePoint(buffer, count, index + 2, closed);
+        BFPoint controlPoint1 = { .x = point1.x + (point2.x - point0.x) / 6, .y = point1.y + (point2.y - point0.y) / 6 };
+        BFPoint controlPoint2 = { .x = point2.x - (point3.x - point1.x) / 6, .y = point2.y - (point3.y - point1.y) / 6 };
+        BFPathAddCurveToPoint(path, point2, controlPoint1, controlPoint2);
+    }
+    if (closed) {
+        BFPathCloseSubpath(path);
+    }
+}
+
+size_t BFPathGetVerbCount(BFPathRef path) {
+    return path->verbCount;
+}
+
+const uint8_t * BFPathGetVerbs(BFPathRef path) {
+    return path->verbs;
+}
+
+const BFPoint * BFPathGetPoints(BFPathRef path) {
+    return path->points;
+}
+
+bool BFPathGetBounds(BFPathRef path, BFRect * bounds) {
+    if (path->pointCount == 0) {
+        return false;
+    }
+    *bounds = path->bounds;
+    return true;
+}
+
+bool BFPathGetControlBounds(BFPathRef path, BFRect * bounds) {
+    if (path->pointCount == 0) {
+        return false;
+    }
+    *bounds = path->controlBounds;
+    return true;
 }
 
 void BFPathIterateComponents(BFPathRef path, BFPathComponentIterationFunction iterationFunction, void * userData) {
-    BFFunctionUserData cgUserData = { .function = iterationFunction, .userData = userData };
-    CGPathApply(path->pathRef, &cgUserData, (CGPathApplierFunction)BFPathCGPathElementToComponent);
+    const BFPoint * points = path->points;
+    size_t index;
+    for (index = 0; index < path->verbCount; index++) {
+        BFPathComponent component = { .type = path->verbs[index] };
+        switch (component.type) {
+            case kBFPathComponentMove:
+            case kBFPathComponentAddLine:
+                component.point = points[0];
+                break;
+            case kBFPathComponentAddQuadCurve:
+                component.controlPoint1 = points[0];
+                component.point = points[1];
+                break;
+            case kBFPathComponentAddCurve:
+                component.controlPoint1 = points[0];
+                component.controlPoint2 = points[1];
+                component.point = points[2];
+                break;
+            default:
+                break;
+        }
+        points += BFPathVerbPointCount(component.type);
+        iterationFunction(userData, component);
+    }
 }
 
-static void BFPathCGPathElementToComponent(BFFunctionUserData * userData, const CGPathElement * element) {
-    BFPathComponent component = {};
-    switch (element->type) {
-        case kCGPathElementMoveToPoint:
-            component.type = kBFPathComponentMove;
-            component.point.x = element->points[0].x;
-            component.point.y = element->points[0].y;
-            break;
-        case kCGPathElementAddLineToPoint:
-            component.type = kBFPathComponentAddLine;
-            component.point.x = element->points[0].x;
-            component.point.y = element->points[0].y;
-            break;
-        case kCGPathElementAddQuadCurveToPoint:
-            component.type = kBFPathComponentAddQuadCurve;
-            component.controlPoint1.x = element->points[0].x;
-            component.controlPoint1.y = element->points[0].y;
-            component.point.x = element->points[1].x;
-            component.point.y = element->points[1].y;
-            break;
-        case kCGPathElementAddCurveToPoint:
-            component.type = kBFPathComponentAddCurve;
-            component.controlPoint1.x = element->points[0].x;
-            component.controlPoint1.y = element->points[0].y;
-            component.controlPoint2.x = element->points[1].x;
-            component.controlPoint2.y = element->points[1].y;
-            component.point.x = element->points[2].x;
-            component.point.y = element->points[2].y;
-            break;
-        case kCGPathElementCloseSubpath:
-            component.type = kBFPathComponentCloseSubpath;
+#ifdef __APPLE__
+
+CGPathRef BFPathGetCGPath(const BFPathRef path) {
+    // Built on demand for the Quartz canvases, and dropped whenever the path changes. Paths in display lists are
+    // replayed on several threads at once, so whichever thread loses the race to build it releases its own copy.
+    CGMutablePathRef existingPathRef = __atomic_load_n(&path->pathRef, __ATOMIC_ACQUIRE);
+    if (!existingPathRef) {
+        CGMutablePathRef pathRef = CGPathCreateMutable();
+        const BFPoint * points = path->points;
+        size_t index;
+        for (index = 0; index < path->verbCount; index++) {
+            switch (path->verbs[index]) {
+                case kBFPathComponentMove:
+                    CGPathMoveToPoint(pathRef, NULL, points[0].x, points[0].y);
+                    break;
+                case kBFPathComponentAddLine:
+                    CGPathAddLineToPoint(pathRef, NULL, points[0].x, points[0].y);
+                    break;
+                case kBFPathComponentAddQuadCurve:
+                    CGPathAddQuadCurveToPoint(pathRef, NULL, points[0].x, points[0].y, points[1].x, points[1].y);
+                    break;
+                case kBFPathComponentAddCurve:
+                    CGPathAddCurveToPoint(pathRef, NULL, points[0].x, points[0].y, points[1].x, points[1].y, points[2].x, points[2].y);
+                    break;
+                case kBFPathComponentCloseSubpath:
+                    CGPathCloseSubpath(pathRef);
+                    break;
+            }
+            points += BFPathVerbPointCount(path->verbs[index]);
+        }
+        if (__atomic_compare_exchange_n(&path->pathRef, &existingPathRef, pathRef, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            existingPathRef = pathRef;
+        } else {
+            CGPathRelease(pathRef);
+        }
+    }
+    return existingPathRef;
+}
+
+#endif
+
+// BFFlattenedPath
+
+int BFPathSubdivisionCount(double deviation, double factor, double tolerance) {
+    // Wang's formula: the number of segments needed to keep a curve within the tolerance.
+    double count = ceil(sqrt(factor * deviation / tolerance));
+    return (count < 1 ? 1 : (count > 500 ? 500 : (int)count));
+}
+
+static int BFPathScaleBucket(BFTransformationComponents transformation) {
+    // The largest stretch of the transformation, rounded up to a half octave so that nearby scales share results.
+    double sum = transformation.a * transformation.a + transformation.b * transformation.b + transformation.c * transformation.c + transformation.d * transformation.d;
+    double difference = transformation.a * transformation.a + transformation.b * transformation.b - transformation.c * transformation.c - transformation.d * transformation.d;
+    double cross = transformation.a * transformation.c + transformation.b * transformation.d;
+    double scale = sqrt((sum + sqrt(difference * difference + 4 * cross * cross)) / 2);
+    if (!(scale > 1.0 / 65536)) {
+        scale = 1.0 / 65536;
+    } else if (scale > 65536) {
+        scale = 65536;
+    }
+    return (int)ceil(2 * log2(scale));
+}
+
+static void BFFlattenedPathDealloc(BFFlattenedPathRef flattenedPath) {
+    if (flattenedPath) {
+        free(flattenedPath->points);
+        free(flattenedPath->subpaths);
+    }
+    BFDealloc(flattenedPath);
+}
+
+static bool BFFlattenedPathReserve(BFFlattenedPathRef flattenedPath, size_t pointCount) {
+    if (flattenedPath->pointCount + pointCount > flattenedPath->pointCapacity) {
+        size_t capacity = (flattenedPath->pointCapacity ? flattenedPath->pointCapacity * 2 : 16);
+        while (capacity < flattenedPath->pointCount + pointCount) {
+            capacity *= 2;
+        }
+        BFPoint * points = realloc(flattenedPath->points, capacity * sizeof(BFPoint));
+        if (!points) {
+            return false;
+        }
+        flattenedPath->points = points;
+        flattenedPath->pointCapacity = capacity;
+    }
+    return true;
+}
+
+static void BFFlattenedPathFinishSubpath(BFFlattenedPathRef flattenedPath) {
+    if (flattenedPath->subpathCount > 0) {
+        BFFlattenedSubpath * subpath = &flattenedPath->subpaths[flattenedPath->subpathCount - 1];
+        subpath->pointCount = flattenedPath->pointCount - subpath->pointIndex;
+    }
+}
+
+static bool BFFlattenedPathBeginSubpath(BFFlattenedPathRef flattenedPath, BFPoint point) {
+    BFFlattenedPathFinishSubpath(flattenedPath);
+    if (flattenedPath->subpathCount == flattenedPath->subpathCapacity) {
+        size_t capacity = (flattenedPath->subpathCapacity ? flattenedPath->subpathCapacity * 2 : 4);
+        BFFlattenedSubpath * subpaths = realloc(flattenedPath->subpaths, capacity * sizeof(BFFlattenedSubpath));
+        if (!subpaths) {
+            return false;
+        }
+        flattenedPath->subpaths = subpaths;
+        flattenedPath->subpathCapacity = capacity;
+    }
+    if (!BFFlattenedPathReserve(flattenedPath, 1)) {
+        return false;
+    }
+    flattenedPath->subpaths[flattenedPath->subpathCount++] = (BFFlattenedSubpath){ .pointIndex = flattenedPath->pointCount, .pointCount = 1, .closed = false };
+    flattenedPath->points[flattenedPath->pointCount++] = point;
+    return true;
+}
+
+static bool BFFlattenedPathAddQuadCurve(BFFlattenedPathRef flattenedPath, BFPoint p0, BFPoint p1, BFPoint p2, double tolerance) {
+    int index, count = BFPathSubdivisionCount(hypot(p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y), 0.25, tolerance);
+    if (!BFFlattenedPathReserve(flattenedPath, count)) {
+        return false;
+    }
+    // In power form every point is independent of the others, so the loop vectorizes.
+    double ax = p0.x - 2 * p1.x + p2.x, ay = p0.y - 2 * p1.y + p2.y;
+    double bx = 2 * (p1.x - p0.x), by = 2 * (p1.y - p0.y);
+    double step = 1.0 / count;
+    BFPoint * points = flattenedPath->points + flattenedPath->pointCount;
+    for (index = 0; index < count - 1; index++) {
+        double t = (index + 1) * step;
+        points[index].x = (ax * t + bx) * t + p0.x;
+        points[index].y = (ay * t + by) * t + p0.y;
+    }
+    points[count - 1] = p2;
+    flattenedPath->pointCount += count;
+    return true;
+}
+
+static bool BFFlattenedPathAddCurve(BFFlattenedPathRef flattenedPath, BFPoint p0, BFPoint p1, BFPoint p2, BFPoint p3, double tolerance) {
+    double deviation1 = hypot(p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y);
+    double deviation2 = hypot(p1.x - 2 * p2.x + p3.x, p1.y - 2 * p2.y + p3.y);
+    int index, count = BFPathSubdivisionCount((deviation1 > deviation2 ? deviation1 : deviation2), 0.75, tolerance);
+    if (!BFFlattenedPathReserve(flattenedPath, count)) {
+        return false;
+    }
+    double ax = p3.x - p0.x + 3 * (p1.x - p2.x), ay = p3.y - p0.y + 3 * (p1.y - p2.y);
+    double bx = 3 * (p0.x - 2 * p1.x + p2.x), by = 3 * (p0.y - 2 * p1.y + p2.y);
+    double cx = 3 * (p1.x - p0.x), cy = 3 * (p1.y - p0.y);
+    double step = 1.0 / count;
+    BFPoint * points = flattenedPath->points + flattenedPath->pointCount;
+    for (index = 0; index < count - 1; index++) {
+        double t = (index + 1) * step;
+        points[index].x = ((ax * t + bx) * t + cx) * t + p0.x;
+        points[index].y = ((ay * t + by) * t + cy) * t + p0.y;
+    }
+    points[count - 1] = p3;
+    flattenedPath->pointCount += count;
+    return true;
+}
+
+static BFFlattenedPathRef BFFlattenedPathCreate(BFPathRef path, double tolerance, int scaleBucket) {
+    BFFlattenedPathRef flattenedPath = BFAlloc(sizeof(struct BFFlattenedPath), &flattenedPathBaseFunctions);
+    if (!flattenedPath) {
+        return NULL;
+    }
+    flattenedPath->tolerance = tolerance;
+    flattenedPath->scaleBucket = scaleBucket;
+    flattenedPath->points = NULL;
+    flattenedPath->pointCount = 0;
+    flattenedPath->pointCapacity = 0;
+    flattenedPath->subpaths = NULL;
+    flattenedPath->subpathCount = 0;
+    flattenedPath->subpathCapacity = 0;
+    BFMarkImmutable(flattenedPath);
+    BFRetain(flattenedPath);
+    
+    double userTolerance = tolerance / exp2(scaleBucket / 2.0);
+    const BFPoint * points = path->points;
+    BFPoint startPoint = { .x = 0, .y = 0 };
+    BFPoint currentPoint = startPoint;
+    bool open = false, ok = true;
+    size_t index;
+    for (index = 0; ok && index < path->verbCount; index++) {
+        BFPathComponentType verb = path->verbs[index];
+        if (verb == kBFPathComponentMove) {
+            ok = BFFlattenedPathBeginSubpath(flattenedPath, points[0]);
+            startPoint = currentPoint = points[0];
+            open = true;
+        } else if (verb == kBFPathComponentCloseSubpath) {
+            if (open) {
+                flattenedPath->subpaths[flattenedPath->subpathCount - 1].closed = true;
+            }
+            currentPoint = startPoint;
+            open = false;
+        } else {
+            if (!open) {
+                // Drawing on after a close starts a new subpath from the closed one's start.
+                ok = BFFlattenedPathBeginSubpath(flattenedPath, currentPoint);
+                open = true;
+            }
+            if (!ok) {
+                break;
+            }
+            switch (verb) {
+                case kBFPathComponentAddLine:
+                    if ((ok = BFFlattenedPathReserve(flattenedPath, 1))) {
+                        flattenedPath->points[flattenedPath->pointCount++] = points[0];
+                    }
+                    break;
+                case kBFPathComponentAddQuadCurve:
+                    ok = BFFlattenedPathAddQuadCurve(flattenedPath, currentPoint, points[0], points[1], userTolerance);
+                    break;
+                case kBFPathComponentAddCurve:
+                    ok = BFFlattenedPathAddCurve(flattenedPath, currentPoint, points[0], points[1], points[2], userTolerance);
+                    break;
+                default:
+                    break;
+            }
+            currentPoint = points[BFPathVerbPointCount(verb) - 1];
+        }
+        points += BFPathVerbPointCount(verb);
+    }
+    if (!ok) {
+        BFRelease(flattenedPath);
+        return NULL;
+    }
+    BFFlattenedPathFinishSubpath(flattenedPath);
+    return flattenedPath;
+}
+
+static void BFPathClearFlattenedPaths(BFPathRef path) {
+    pthread_mutex_lock(&BFPathFlattenedCacheMutex);
+    int index;
+    for (index = 0; index < BF_PATH_FLATTENED_CACHE_SIZE; index++) {
+        BFRelease(path->flattenedPaths[index]);
+        path->flattenedPaths[index] = NULL;
+    }
+    pthread_mutex_unlock(&BFPathFlattenedCacheMutex);
+}
+
+BFFlattenedPathRef BFPathCopyFlattened(BFPathRef path, double tolerance, BFTransformationComponents transformation) {
+    int scaleBucket = BFPathScaleBucket(transformation);
+    BFFlattenedPathRef flattenedPath = NULL;
+    int index;
+    pthread_mutex_lock(&BFPathFlattenedCacheMutex);
+    for (index = 0; index < BF_PATH_FLATTENED_CACHE_SIZE; index++) {
+        BFFlattenedPathRef cached = path->flattenedPaths[index];
+        if (cached && cached->tolerance == tolerance && cached->scaleBucket == scaleBucket) {
+            flattenedPath = BFRetain(cached);
+            // Keep the most recently used entry first.
+            memmove(path->flattenedPaths + 1, path->flattenedPaths, index * sizeof(BFFlattenedPathRef));
+            path->flattenedPaths[0] = cached;
             break;
-        default:
-            return;
+        }
     }
-    ((BFPathComponentIterationFunction)userData->function)(userData->userData, component);
+    pthread_mutex_unlock(&BFPathFlattenedCacheMutex);
+    if (flattenedPath) {
+        return flattenedPath;
+    }
+    
+    // Flattened outside the lock; if two threads miss at once, both results are valid and the later one is cached.
+    flattenedPath = BFFlattenedPathCreate(path, tolerance, scaleBucket);
+    if (flattenedPath) {
+        pthread_mutex_lock(&BFPathFlattenedCacheMutex);
+        BFRelease(path->flattenedPaths[BF_PATH_FLATTENED_CACHE_SIZE - 1]);
+        memmove(path->flattenedPaths + 1, path->flattenedPaths, (BF_PATH_FLATTENED_CACHE_SIZE - 1) * sizeof(BFFlattenedPathRef));
+        path->flattenedPaths[0] = BFRetain(flattenedPath);
+        pthread_mutex_unlock(&BFPathFlattenedCacheMutex);
+    }
+    return flattenedPath;
 }
 
-CGPathRef BFPathGetCGPath(const BFPathRef path) {
-    return path->pathRef;
+size_t BFFlattenedPathGetPointCount(BFFlattenedPathRef flattenedPath) {
+    return flattenedPath->pointCount;
+}
+
+const BFPoint * BFFlattenedPathGetPoints(BFFlattenedPathRef flattenedPath) {
+    return flattenedPath->points;
+}
+
+size_t BFFlattenedPathGetSubpathCount(BFFlattenedPathRef flattenedPath) {
+    return flattenedPath->subpathCount;
+}
+
+const BFFlattenedSubpath * BFFlattenedPathGetSubpaths(BFFlattenedPathRef flattenedPath) {
+    return flattenedPath->subpaths;
+}
+
+double BFFlattenedPathGetLength(BFFlattenedPathRef flattenedPath) {
+    double length = 0;
+    size_t subpathIndex, index;
+    for (subpathIndex = 0; subpathIndex < flattenedPath->subpathCount; subpathIndex++) {
+        BFFlattenedSubpath subpath = flattenedPath->subpaths[subpathIndex];
+        const BFPoint * points = flattenedPath->points + subpath.pointIndex;
+        for (index = 1; index < subpath.pointCount; index++) {
+            length += hypot(points[index].x - points[index - 1].x, points[index].y - points[index - 1].y);
+        }
+        if (subpath.closed && subpath.pointCount > 1) {
+            length += hypot(points[0].x - points[subpath.pointCount - 1].x, points[0].y - points[subpath.pointCount - 1].y);
+        }
+    }
+    return length;
 }
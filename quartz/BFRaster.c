@@ -0,0 +1,892 @@
+//
+//  BFRaster.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "butterfly.h"
+
+#include "BFComposite.h"
+#include "BFPath.h"
+#include "BFRaster.h"
+
+// Flattening tolerance, in device pixels.
+#define BF_RASTER_TOLERANCE 0.2
+#define BF_RASTER_BAND_HEIGHT 16
+
+typedef struct BFRasterEdge {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+} BFRasterEdge;
+
+struct BFRasterizer {
+    BFTransformationComponents transformation;
+    double tolerance;
+    bool stroking;
+    double halfThickness;
+    bool hasCurrentPoint;
+    BFPoint startPoint;
+    BFPoint currentPoint;
+    size_t componentCount;
+    
+    BFRasterEdge * edges;
+    size_t edgeCount;
+    size_t edgeCapacity;
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+    float offsetX;
+    float offsetY;
+    
+    BFPoint * polyline;
+    size_t polylineCount;
+    size_t polylineCapacity;
+    
+    float * accumulation;
+    size_t accumulationCapacity;
+    size_t * active;
+    size_t activeCapacity;
+    uint8_t * coverage;
+    size_t coverageCapacity;
+    uint8_t * span;
+    size_t spanCapacity;
+};
+
+typedef void (* BFRasterSpanFunction)(void * userData, int y, int x, int count, uint8_t * coverage);
+
+// BFRasterBox
+
+BFRasterBox BFRasterBoxIntersect(BFRasterBox box1, BFRasterBox box2) {
+    BFRasterBox box = {
+        .left = (box1.left > box2.left ? box1.left : box2.left),
+        .top = (box1.top > box2.top ? box1.top : box2.top),
+        .right = (box1.right < box2.right ? box1.right : box2.right),
+        .bottom = (box1.bottom < box2.bottom ? box1.bottom : box2.bottom),
+    };
+    return box;
+}
+
+bool BFRasterBoxIsEmpty(BFRasterBox box) {
+    return (box.left >= box.right || box.top >= box.bottom);
+}
+
+// BFRasterMatrix
+
+BFTransformationComponents BFRasterMatrixMake(double a, double b, double c, double d, double tx, double ty) {
+    BFTransformationComponents matrix = { .a = a, .b = b, .c = c, .d = d, .tx = tx, .ty = ty };
+    return matrix;
+}
+
+BFTransformationComponents BFRasterMatrixConcat(BFTransformationComponents matrix1, BFTransformationComponents matrix2) {
+    // Same order as CGAffineTransformConcat: matrix1 is applied first.
+    BFTransformationComponents matrix = {
+        .a = matrix1.a * matrix2.a + matrix1.b * matrix2.c,
+        .b = matrix1.a * matrix2.b + matrix1.b * matrix2.d,
+        .c = matrix1.c * matrix2.a + matrix1.d * matrix2.c,
+        .d = matrix1.c * matrix2.b + matrix1.d * matrix2.d,
+        .tx = matrix1.tx * matrix2.a + matrix1.ty * matrix2.c + matrix2.tx,
+        .ty = matrix1.tx * matrix2.b + matrix1.ty * matrix2.d + matrix2.ty,
+    };
+    return matrix;
+}
+
+BFTransformationComponents BFRasterMatrixInvert(BFTransformationComponents matrix) {
+    double determinant = matrix.a * matrix.d - matrix.b * matrix.c;
+    if (determinant == 0) {
+        return matrix;
+    }
+    BFTransformationComponents inverse = {
+        .a = matrix.d / determinant,
+        .b = -matrix.b / determinant,
+        .c = -matrix.c / determinant,
+        .d = matrix.a / determinant,
+    };
+    inverse.tx = -(matrix.tx * inverse.a + matrix.ty * inverse.c);
+    inverse.ty = -(matrix.tx * inverse.b + matrix.ty * inverse.d);
+    return inverse;
+}
+
+BFPoint BFRasterMatrixTransformPoint(BFTransformationComponents matrix, BFPoint point) {
+    BFPoint result = {
+        .x = matrix.a * point.x + matrix.c * point.y + matrix.tx,
+        .y = matrix.b * point.x + matrix.d * point.y + matrix.ty,
+    };
+    return result;
+}
+
+BFRect BFRasterMatrixTransformRect(BFTransformationComponents matrix, BFRect rect) {
+    BFPoint points[4] = {
+        BFRasterMatrixTransformPoint(matrix, (BFPoint){ .x = rect.left, .y = rect.bottom }),
+        BFRasterMatrixTransformPoint(matrix, (BFPoint){ .x = rect.right, .y = rect.bottom }),
+        BFRasterMatrixTransformPoint(matrix, (BFPoint){ .x = rect.right, .y = rect.top }),
+        BFRasterMatrixTransformPoint(matrix, (BFPoint){ .x = rect.left, .y = rect.top }),
+    };
+    BFRect result = { .left = points[0].x, .bottom = points[0].y, .right = points[0].x, .top = points[0].y };
+    int index;
+    for (index = 1; index < 4; index++) {
+        result.left = fmin(result.left, points[index].x);
+        result.bottom = fmin(result.bottom, points[index].y);
+        result.right = fmax(result.right, points[index].x);
+        result.top = fmax(result.top, points[index].y);
+    }
+    return result;
+}
+
+double BFRasterMatrixGetScale(BFTransformationComponents matrix) {
+    double scale1 = matrix.a * matrix.a + matrix.b * matrix.b;
+    double scale2 = matrix.c * matrix.c + matrix.d * matrix.d;
+    return sqrt(scale1 > scale2 ? scale1 : scale2);
+}
+
+// BFRasterMask
+
+struct BFRasterMask {
+    struct BFBase __base;
+    BFRasterBox box;
+    uint8_t * data;
+};
+
+static void BFRasterMaskDealloc(BFRasterMaskRef mask);
+
+static const BFBaseFunctions maskBaseFunctions = {
+    .name = "butterfly.RasterMask",
+    .dealloc = (BFBaseDeallocFunction)&BFRasterMaskDealloc,
+};
+
+static BFRasterMaskRef BFRasterMaskCreate(BFRasterBox box) {
+    BFRasterMaskRef mask = BFAlloc(sizeof(struct BFRasterMask), &maskBaseFunctions);
+    if (mask) {
+        mask->box = box;
+        mask->data = calloc((size_t)(box.right - box.left) * (size_t)(box.bottom - box.top), 1);
+        if (!mask->data) {
+            BFDealloc(mask);
+            return NULL;
+        }
+    }
+    return BFRetain(mask);
+}
+
+static void BFRasterMaskDealloc(BFRasterMaskRef mask) {
+    if (mask) {
+        free(mask->data);
+    }
+    BFDealloc(mask);
+}
+
+static uint8_t BFRasterMultiply(uint8_t value1, uint8_t value2) {
+    unsigned int product = value1 * value2 + 128;
+    return (uint8_t)((product + (product >> 8)) >> 8);
+}
+
+static void BFRasterMaskApply(BFRasterMaskRef mask, int y, int x, int count, uint8_t * coverage) {
+    size_t stride = (size_t)(mask->box.right - mask->box.left);
+    const uint8_t * row = mask->data + (size_t)(y - mask->box.top) * stride + (x - mask->box.left);
+    int index;
+    for (index = 0; index < count; index++) {
+        coverage[index] = BFRasterMultiply(coverage[index], row[index]);
+    }
+}
+
+// BFRasterSource
+
+void BFRasterPackColor(double r, double g, double b, double a, uint8_t * pixel) {
+    a = fmin(fmax(a, 0), 1);
+    pixel[0] = (uint8_t)(fmin(fmax(r, 0), 1) * a * 255 + 0.5);
+    pixel[1] = (uint8_t)(fmin(fmax(g, 0), 1) * a * 255 + 0.5);
+    pixel[2] = (uint8_t)(fmin(fmax(b, 0), 1) * a * 255 + 0.5);
+    pixel[3] = (uint8_t)(a * 255 + 0.5);
+}
+
+static uint8_t BFRasterImageGetChannel(const BFRasterBitmap * bitmap, int x, int y, int channel) {
+    x = (x < 0 ? 0 : (x >= bitmap->width ? bitmap->width - 1 : x));
+    y = (y < 0 ? 0 : (y >= bitmap->height ? bitmap->height - 1 : y));
+    return bitmap->pixels[(size_t)y * bitmap->stride + (size_t)x * 4 + channel];
+}
+
+static void BFRasterShadeImage(const BFRasterImage * image, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span) {
+    const BFRasterBitmap * bitmap = &image->bitmap;
+    double width = image->rect.right - image->rect.left;
+    double height = image->rect.top - image->rect.bottom;
+    if (bitmap->width <= 0 || bitmap->height <= 0 || width == 0 || height == 0) {
+        memset(span, 0, (size_t)count * 4);
+        return;
+    }
+    double scaleX = bitmap->width / width;
+    double scaleY = bitmap->height / height;
+    BFPoint point = BFRasterMatrixTransformPoint(*deviceToUser, (BFPoint){ .x = x + 0.5, .y = y + 0.5 });
+    int index, channel;
+    for (index = 0; index < count; index++, span += 4) {
+        // Bitmap rows run from the top of the rect downwards.
+        double u = (point.x - image->rect.left) * scaleX - 0.5;
+        double v = (image->rect.top - point.y) * scaleY - 0.5;
+        double floorU = floor(u), floorV = floor(v);
+        int u0 = (int)floorU, v0 = (int)floorV;
+        double fu = u - floorU, fv = v - floorV;
+        for (channel = 0; channel < 4; channel++) {
+            double top = BFRasterImageGetChannel(bitmap, u0, v0, channel) * (1 - fu) + BFRasterImageGetChannel(bitmap, u0 + 1, v0, channel) * fu;
+            double bottom = BFRasterImageGetChannel(bitmap, u0, v0 + 1, channel) * (1 - fu) + BFRasterImageGetChannel(bitmap, u0 + 1, v0 + 1, channel) * fu;
+            span[channel] = (uint8_t)(top * (1 - fv) + bottom * fv + 0.5);
+        }
+        point.x += deviceToUser->a;
+        point.y += deviceToUser->b;
+    }
+}
+
+void BFRasterSourceInitWithImage(BFRasterSource * source, const BFRasterImage * image, BFTransformationComponents deviceToUser) {
+    source->shade = (BFRasterShadeFunction)&BFRasterShadeImage;
+    source->object = image;
+    source->deviceToUser = deviceToUser;
+}
+
+// BFRasterizer
+
+BFRasterizer * BFRasterizerCreate(void) {
+    return calloc(1, sizeof(BFRasterizer));
+}
+
+void BFRasterizerDestroy(BFRasterizer * rasterizer) {
+    if (rasterizer) {
+        free(rasterizer->edges);
+        free(rasterizer->polyline);
+        free(rasterizer->accumulation);
+        free(rasterizer->active);
+        free(rasterizer->coverage);
+        free(rasterizer->span);
+        free(rasterizer);
+    }
+}
+
+static void BFRasterizerReset(BFRasterizer * rasterizer, BFTransformationComponents transformation) {
+    rasterizer->transformation = transformation;
+    rasterizer->hasCurrentPoint = false;
+    rasterizer->componentCount = 0;
+    rasterizer->edgeCount = 0;
+    rasterizer->polylineCount = 0;
+    rasterizer->minX = rasterizer->minY = INFINITY;
+    rasterizer->maxX = rasterizer->maxY = -INFINITY;
+    rasterizer->offsetX = rasterizer->offsetY = 0;
+}
+
+void BFRasterizerBeginFill(BFRasterizer * rasterizer, BFTransformationComponents transformation) {
+    BFRasterizerReset(rasterizer, transformation);
+    // Fills are flattened after transforming to device space.
+    rasterizer->stroking = false;
+    rasterizer->halfThickness = 0;
+    rasterizer->tolerance = BF_RASTER_TOLERANCE;
+}
+
+void BFRasterizerBeginStroke(BFRasterizer * rasterizer, BFTransformationComponents transformation, double thickness) {
+    BFRasterizerReset(rasterizer, transformation);
+    // Strokes are flattened and offset in user space, so the tolerance is scaled to match.
+    double scale = BFRasterMatrixGetScale(transformation);
+    rasterizer->stroking = true;
+    rasterizer->halfThickness = fabs(thickness) / 2;
+    rasterizer->tolerance = (scale > 0 ? BF_RASTER_TOLERANCE / scale : BF_RASTER_TOLERANCE);
+}
+
+static bool BFRasterizerGrow(void ** array, size_t * capacity, size_t needed, size_t elementSize) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t newCapacity = (*capacity ? *capacity * 2 : 64);
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    void * newArray = realloc(*array, newCapacity * elementSize);
+    if (!newArray) {
+        return false;
+    }
+    *array = newArray;
+    *capacity = newCapacity;
+    return true;
+}
+
+static void BFRasterizerAddEdge(BFRasterizer * rasterizer, BFPoint point0, BFPoint point1) {
+    if (point0.y == point1.y || !isfinite(point0.x + point0.y + point1.x + point1.y)) {
+        return;
+    }
+    if (!BFRasterizerGrow((void **)&rasterizer->edges, &rasterizer->edgeCapacity, rasterizer->edgeCount + 1, sizeof(BFRasterEdge))) {
+        return;
+    }
+    BFRasterEdge edge = { .x0 = point0.x, .y0 = point0.y, .x1 = point1.x, .y1 = point1.y };
+    rasterizer->edges[rasterizer->edgeCount++] = edge;
+    rasterizer->minX = fminf(rasterizer->minX, fminf(edge.x0, edge.x1));
+    rasterizer->maxX = fmaxf(rasterizer->maxX, fmaxf(edge.x0, edge.x1));
+    rasterizer->minY = fminf(rasterizer->minY, fminf(edge.y0, edge.y1));
+    rasterizer->maxY = fmaxf(rasterizer->maxY, fmaxf(edge.y0, edge.y1));
+}
+
+static void BFRasterizerAddUserPolygon(BFRasterizer * rasterizer, const BFPoint * points, size_t count) {
+    BFPoint first = BFRasterMatrixTransformPoint(rasterizer->transformation, points[0]);
+    BFPoint previous = first;
+    size_t index;
+    for (index = 1; index < count; index++) {
+        BFPoint point = BFRasterMatrixTransformPoint(rasterizer->transformation, points[index]);
+        BFRasterizerAddEdge(rasterizer, previous, point);
+        previous = point;
+    }
+    BFRasterizerAddEdge(rasterizer, previous, first);
+}
+
+static void BFRasterizerAddJoin(BFRasterizer * rasterizer, BFPoint center) {
+    // A round join is the whole circle; the parts inside the adjoining segments don't change coverage.
+    double radius = rasterizer->halfThickness;
+    double deviceRadius = radius / rasterizer->tolerance * BF_RASTER_TOLERANCE;
+    int count = 8;
+    if (deviceRadius > BF_RASTER_TOLERANCE) {
+        count = (int)ceil(M_PI / acos(1 - BF_RASTER_TOLERANCE / deviceRadius));
+        count = (count < 8 ? 8 : (count > 128 ? 128 : count));
+    }
+    BFPoint points[128];
+    int index;
+    for (index = 0; index < count; index++) {
+        // Clockwise, to match the winding of the segment quads.
+        double angle = -2 * M_PI * index / count;
+        points[index].x = center.x + radius * cos(angle);
+        points[index].y = center.y + radius * sin(angle);
+    }
+    BFRasterizerAddUserPolygon(rasterizer, points, count);
+}
+
+static void BFRasterizerStrokePolyline(BFRasterizer * rasterizer, bool closed) {
+    BFPoint * points = rasterizer->polyline;
+    size_t count = rasterizer->polylineCount;
+    double radius = rasterizer->halfThickness;
+    rasterizer->polylineCount = 0;
+    if (closed && count > 2 && points[count - 1].x == points[0].x && points[count - 1].y == points[0].y) {
+        count--;
+    }
+    if (count < 2 || radius <= 0) {
+        return;
+    }
+    size_t segmentCount = (closed ? count : count - 1);
+    size_t index;
+    for (index = 0; index < segmentCount; index++) {
+        BFPoint point0 = points[index];
+        BFPoint point1 = points[(index + 1) % count];
+        double dx = point1.x - point0.x, dy = point1.y - point0.y;
+        double length = hypot(dx, dy);
+        if (length == 0) {
+            continue;
+        }
+        double nx = -dy / length * radius, ny = dx / length * radius;
+        BFPoint quad[4] = {
+            { point0.x + nx, point0.y + ny },
+            { point1.x + nx, point1.y + ny },
+            { point1.x - nx, point1.y - ny },
+            { point0.x - nx, point0.y - ny },
+        };
+        BFRasterizerAddUserPolygon(rasterizer, quad, 4);
+    }
+    size_t firstJoin = (closed ? 0 : 1);
+    size_t lastJoin = (closed ? count : count - 1);
+    for (index = firstJoin; index < lastJoin; index++) {
+        BFPoint previous = points[(index + count - 1) % count];
+        BFPoint point = points[index];
+        BFPoint next = points[(index + 1) % count];
+        double inAngle = atan2(point.y - previous.y, point.x - previous.x);
+        double outAngle = atan2(next.y - point.y, next.x - point.x);
+        double turn = fabs(remainder(outAngle - inAngle, 2 * M_PI));
+        // Skip joins whose gap would be smaller than the flattening tolerance.
+        if (radius * (1 - cos(turn / 2)) > rasterizer->tolerance) {
+            BFRasterizerAddJoin(rasterizer, point);
+        }
+    }
+}
+
+static void BFRasterizerEmitPoint(BFRasterizer * rasterizer, BFPoint point) {
+    if (rasterizer->stroking) {
+        if (rasterizer->polylineCount > 0) {
+            BFPoint last = rasterizer->polyline[rasterizer->polylineCount - 1];
+            if (last.x == point.x && last.y == point.y) {
+                return;
+            }
+        }
+        if (BFRasterizerGrow((void **)&rasterizer->polyline, &rasterizer->polylineCapacity, rasterizer->polylineCount + 1, sizeof(BFPoint))) {
+            rasterizer->polyline[rasterizer->polylineCount++] = point;
+        }
+    } else {
+        BFRasterizerAddEdge(rasterizer, rasterizer->currentPoint, point);
+    }
+    rasterizer->currentPoint = point;
+}
+
+static void BFRasterizerFinishSubpath(BFRasterizer * rasterizer, bool closed) {
+    if (!rasterizer->hasCurrentPoint) {
+        return;
+    }
+    if (rasterizer->stroking) {
+        BFRasterizerStrokePolyline(rasterizer, closed);
+    } else {
+        // Fills are implicitly closed.
+        BFRasterizerAddEdge(rasterizer, rasterizer->currentPoint, rasterizer->startPoint);
+    }
+    rasterizer->currentPoint = rasterizer->startPoint;
+}
+
+static BFPoint BFRasterizerFlatteningPoint(BFRasterizer * rasterizer, BFPoint point) {
+    return (rasterizer->stroking ? point : BFRasterMatrixTransformPoint(rasterizer->transformation, point));
+}
+
+void BFRasterizerMoveToPoint(BFRasterizer * rasterizer, BFPoint point) {
+    BFRasterizerFinishSubpath(rasterizer, false);
+    point = BFRasterizerFlatteningPoint(rasterizer, point);
+    rasterizer->startPoint = point;
+    rasterizer->currentPoint = point;
+    rasterizer->hasCurrentPoint = true;
+    rasterizer->componentCount++;
+    if (rasterizer->stroking) {
+        BFRasterizerEmitPoint(rasterizer, point);
+    }
+}
+
+static void BFRasterizerEnsureCurrentPoint(BFRasterizer * rasterizer, BFPoint point) {
+    if (!rasterizer->hasCurrentPoint) {
+        BFRasterizerMoveToPoint(rasterizer, point);
+    } else if (rasterizer->stroking && rasterizer->polylineCount == 0) {
+        // Starting a new subpath after a close.
+        BFRasterizerEmitPoint(rasterizer, rasterizer->currentPoint);
+    }
+}
+
+void BFRasterizerAddLineToPoint(BFRasterizer * rasterizer, BFPoint point) {
+    BFRasterizerEnsureCurrentPoint(rasterizer, point);
+    rasterizer->componentCount++;
+    BFRasterizerEmitPoint(rasterizer, BFRasterizerFlatteningPoint(rasterizer, point));
+}
+
+void BFRasterizerAddCurveToPoint(BFRasterizer * rasterizer, BFPoint point, BFPoint controlPoint1, BFPoint controlPoint2) {
+    BFRasterizerEnsureCurrentPoint(rasterizer, point);
+    rasterizer->componentCount++;
+    BFPoint p0 = rasterizer->currentPoint;
+    BFPoint p1 = BFRasterizerFlatteningPoint(rasterizer, controlPoint1);
+    BFPoint p2 = BFRasterizerFlatteningPoint(rasterizer, controlPoint2);
+    BFPoint p3 = BFRasterizerFlatteningPoint(rasterizer, point);
+    double deviation1 = hypot(p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y);
+    double deviation2 = hypot(p1.x - 2 * p2.x + p3.x, p1.y - 2 * p2.y + p3.y);
+    int count = BFPathSubdivisionCount((deviation1 > deviation2 ? deviation1 : deviation2), 0.75, rasterizer->tolerance);
+    int index;
+    for (index = 1; index < count; index++) {
+        double t = (double)index / count, mt = 1 - t;
+        double a = mt * mt * mt, b = 3 * mt * mt * t, c = 3 * mt * t * t, d = t * t * t;
+        BFPoint flattened = {
+            .x = a * p0.x + b * p1.x + c * p2.x + d * p3.x,
+            .y = a * p0.y + b * p1.y + c * p2.y + d * p3.y,
+        };
+        BFRasterizerEmitPoint(rasterizer, flattened);
+    }
+    BFRasterizerEmitPoint(rasterizer, p3);
+}
+
+void BFRasterizerAddQuadCurveToPoint(BFRasterizer * rasterizer, BFPoint point, BFPoint controlPoint) {
+    BFRasterizerEnsureCurrentPoint(rasterizer, point);
+    rasterizer->componentCount++;
+    BFPoint p0 = rasterizer->currentPoint;
+    BFPoint p1 = BFRasterizerFlatteningPoint(rasterizer, controlPoint);
+    BFPoint p2 = BFRasterizerFlatteningPoint(rasterizer, point);
+    int count = BFPathSubdivisionCount(hypot(p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y), 0.25, rasterizer->tolerance);
+    int index;
+    for (index = 1; index < count; index++) {
+        double t = (double)index / count, mt = 1 - t;
+        double a = mt * mt, b = 2 * mt * t, c = t * t;
+        BFPoint flattened = {
+            .x = a * p0.x + b * p1.x + c * p2.x,
+            .y = a * p0.y + b * p1.y + c * p2.y,
+        };
+        BFRasterizerEmitPoint(rasterizer, flattened);
+    }
+    BFRasterizerEmitPoint(rasterizer, p2);
+}
+
+void BFRasterizerCloseSubpath(BFRasterizer * rasterizer) {
+    rasterizer->componentCount++;
+    BFRasterizerFinishSubpath(rasterizer, true);
+}
+
+void BFRasterizerAddPath(BFRasterizer * rasterizer, BFPathRef path) {
+    // Paths are flattened in user space and cached, so redrawing at a similar scale doesn't flatten again.
+    BFFlattenedPathRef flattenedPath = BFPathCopyFlattened(path, BF_RASTER_TOLERANCE, rasterizer->transformation);
+    if (!flattenedPath) {
+        return;
+    }
+    const BFPoint * points = BFFlattenedPathGetPoints(flattenedPath);
+    const BFFlattenedSubpath * subpaths = BFFlattenedPathGetSubpaths(flattenedPath);
+    size_t subpathIndex, count = BFFlattenedPathGetSubpathCount(flattenedPath);
+    for (subpathIndex = 0; subpathIndex < count; subpathIndex++) {
+        const BFPoint * subpathPoints = points + subpaths[subpathIndex].pointIndex;
+        size_t index;
+        BFRasterizerMoveToPoint(rasterizer, subpathPoints[0]);
+        for (index = 1; index < subpaths[subpathIndex].pointCount; index++) {
+            BFRasterizerAddLineToPoint(rasterizer, subpathPoints[index]);
+        }
+        if (subpaths[subpathIndex].closed) {
+            BFRasterizerCloseSubpath(rasterizer);
+        }
+    }
+    BFRelease(flattenedPath);
+}
+
+void BFRasterizerAddRect(BFRasterizer * rasterizer, BFRect rect) {
+    BFRasterizerMoveToPoint(rasterizer, (BFPoint){ .x = rect.left, .y = rect.bottom });
+    BFRasterizerAddLineToPoint(rasterizer, (BFPoint){ .x = rect.right, .y = rect.bottom });
+    BFRasterizerAddLineToPoint(rasterizer, (BFPoint){ .x = rect.right, .y = rect.top });
+    BFRasterizerAddLineToPoint(rasterizer, (BFPoint){ .x = rect.left, .y = rect.top });
+    BFRasterizerCloseSubpath(rasterizer);
+}
+
+void BFRasterizerSetOffset(BFRasterizer * rasterizer, BFPoint offset) {
+    // The edges stay where they were flattened; the offset is added as they're rendered or tested, so the same
+    // geometry can be filled at many positions without drifting.
+    rasterizer->offsetX = offset.x;
+    rasterizer->offsetY = offset.y;
+}
+
+bool BFRasterizerIsEmpty(BFRasterizer * rasterizer) {
+    return (rasterizer->componentCount == 0);
+}
+
+// Hit testing evaluates the nonzero winding number of the flattened edges at each point, so fills and stroke outlines
+// answer exactly what the coverage pass would paint, without touching any pixels.
+
+static bool BFRasterizerContainsPoint(BFRasterizer * rasterizer, BFPoint point) {
+    point.x -= rasterizer->offsetX;
+    point.y -= rasterizer->offsetY;
+    if (point.x < rasterizer->minX || point.x >= rasterizer->maxX || point.y < rasterizer->minY || point.y >= rasterizer->maxY) {
+        return false;
+    }
+    int winding = 0;
+    size_t index;
+    for (index = 0; index < rasterizer->edgeCount; index++) {
+        const BFRasterEdge * edge = &rasterizer->edges[index];
+        if ((edge->y0 <= point.y) != (edge->y1 <= point.y)) {
+            double x = edge->x0 + (point.y - edge->y0) * (edge->x1 - edge->x0) / (edge->y1 - edge->y0);
+            if (point.x < x) {
+                winding += (edge->y1 > edge->y0 ? 1 : -1);
+            }
+        }
+    }
+    return (winding != 0);
+}
+
+void BFRasterizerHitTest(BFRasterizer * rasterizer, const BFPoint * points, size_t count, const uint8_t * mask, uint8_t * results) {
+    BFRasterizerFinishSubpath(rasterizer, false);
+    rasterizer->hasCurrentPoint = false;
+    size_t index;
+    for (index = 0; index < count; index++) {
+        results[index] = ((!mask || mask[index]) && BFRasterizerContainsPoint(rasterizer, points[index]));
+    }
+}
+
+// Coverage accumulation, after font-rs: each edge adds its signed area to the cells it crosses, and a running sum
+// along each row gives the winding coverage.
+
+static void BFRasterAccumulateLine(float * accumulation, size_t stride, int width, int height, float x0, float y0, float x1, float y1) {
+    float direction = 1;
+    if (y0 == y1) {
+        return;
+    }
+    if (y0 > y1) {
+        float swap;
+        direction = -1;
+        swap = x0; x0 = x1; x1 = swap;
+        swap = y0; y0 = y1; y1 = swap;
+    }
+    if (y1 <= 0 || y0 >= height) {
+        return;
+    }
+    float dxdy = (x1 - x0) / (y1 - y0);
+    float x = x0;
+    if (y0 < 0) {
+        x = fminf(fmaxf(x - y0 * dxdy, 0), width);
+    }
+    int yStart = (y0 < 0 ? 0 : (int)y0);
+    int yEnd = (int)ceilf(y1);
+    if (yEnd > height) {
+        yEnd = height;
+    }
+    int y;
+    for (y = yStart; y < yEnd; y++) {
+        float * row = accumulation + (size_t)y * stride;
+        float dy = fminf(y + 1, y1) - fmaxf(y, y0);
+        float xNext = fminf(fmaxf(x + dxdy * dy, 0), width);
+        float d = dy * direction;
+        float xa = fminf(x, xNext), xb = fmaxf(x, xNext);
+        float xaFloor = floorf(xa);
+        int xai = (int)xaFloor;
+        float xbCeil = ceilf(xb);
+        int xbi = (int)xbCeil;
+        if (xbi <= xai + 1) {
+            float xm = 0.5f * (x + xNext) - xaFloor;
+            row[xai] += d - d * xm;
+            row[xai + 1] += d * xm;
+        } else {
+            float s = 1 / (xb - xa);
+            float xaFraction = xa - xaFloor;
+            float a0 = 0.5f * s * (1 - xaFraction) * (1 - xaFraction);
+            float xbFraction = xb - xbCeil + 1;
+            float am = 0.5f * s * xbFraction * xbFraction;
+            row[xai] += d * a0;
+            if (xbi == xai + 2) {
+                row[xai + 1] += d * (1 - a0 - am);
+            } else {
+                float a1 = s * (1.5f - xaFraction);
+                row[xai + 1] += d * (a1 - a0);
+                int xi;
+                for (xi = xai + 2; xi < xbi - 1; xi++) {
+                    row[xi] += d * s;
+                }
+                float a2 = a1 + (xbi - xai - 3) * s;
+                row[xbi - 1] += d * (1 - a2 - am);
+            }
+            row[xbi] += d * am;
+        }
+        x = xNext;
+    }
+}
+
+static void BFRasterAccumulateEdge(float * accumulation, size_t stride, int width, int height, float x0, float y0, float x1, float y1) {
+    // Split the edge where it leaves [0, width]; the parts outside are pinned to the boundary, so they still
+    // contribute their winding to the row.
+    float splits[4] = { 0, 0, 0, 1 };
+    int splitCount = 1;
+    if (x0 != x1) {
+        float t0 = (0 - x0) / (x1 - x0);
+        float t1 = (width - x0) / (x1 - x0);
+        if (t0 > t1) {
+            float swap = t0; t0 = t1; t1 = swap;
+        }
+        if (t0 > 0 && t0 < 1) {
+            splits[splitCount++] = t0;
+        }
+        if (t1 > 0 && t1 < 1) {
+            splits[splitCount++] = t1;
+        }
+    }
+    splits[splitCount] = 1;
+    int index;
+    for (index = 0; index < splitCount; index++) {
+        float ta = splits[index], tb = splits[index + 1];
+        float xa = fminf(fmaxf(x0 + (x1 - x0) * ta, 0), width);
+        float ya = y0 + (y1 - y0) * ta;
+        float xb = fminf(fmaxf(x0 + (x1 - x0) * tb, 0), width);
+        float yb = y0 + (y1 - y0) * tb;
+        BFRasterAccumulateLine(accumulation, stride, width, height, xa, ya, xb, yb);
+    }
+}
+
+static int BFRasterCompareEdges(const void * value1, const void * value2) {
+    const BFRasterEdge * edge1 = value1, * edge2 = value2;
+    float top1 = fminf(edge1->y0, edge1->y1), top2 = fminf(edge2->y0, edge2->y1);
+    return (top1 < top2 ? -1 : (top1 > top2 ? 1 : 0));
+}
+
+static void BFRasterizerRender(BFRasterizer * rasterizer, BFRasterBox box, BFRasterSpanFunction spanFunction, void * userData) {
+    BFRasterizerFinishSubpath(rasterizer, false);
+    rasterizer->hasCurrentPoint = false;
+    if (rasterizer->edgeCount == 0) {
+        return;
+    }
+    float offsetX = rasterizer->offsetX, offsetY = rasterizer->offsetY;
+    BFRasterBox edgeBox = {
+        .left = (int)fmaxf(floorf(rasterizer->minX + offsetX), -1e9f),
+        .top = (int)fmaxf(floorf(rasterizer->minY + offsetY), -1e9f),
+        .right = (int)fminf(ceilf(rasterizer->maxX + offsetX), 1e9f),
+        .bottom = (int)fminf(ceilf(rasterizer->maxY + offsetY), 1e9f),
+    };
+    box = BFRasterBoxIntersect(box, edgeBox);
+    if (BFRasterBoxIsEmpty(box)) {
+        return;
+    }
+    int width = box.right - box.left;
+    size_t stride = (size_t)width + 2;
+    size_t accumulationSize = stride * BF_RASTER_BAND_HEIGHT;
+    if (rasterizer->accumulationCapacity < accumulationSize) {
+        free(rasterizer->accumulation);
+        rasterizer->accumulation = malloc(accumulationSize * sizeof(float));
+        rasterizer->accumulationCapacity = (rasterizer->accumulation ? accumulationSize : 0);
+    }
+    if (!rasterizer->accumulation ||
+        !BFRasterizerGrow((void **)&rasterizer->coverage, &rasterizer->coverageCapacity, (size_t)width, 1) ||
+        !BFRasterizerGrow((void **)&rasterizer->active, &rasterizer->activeCapacity, rasterizer->edgeCount, sizeof(size_t))) {
+        return;
+    }
+    memset(rasterizer->accumulation, 0, accumulationSize * sizeof(float));
+    
+    qsort(rasterizer->edges, rasterizer->edgeCount, sizeof(BFRasterEdge), &BFRasterCompareEdges);
+    
+    float * accumulation = rasterizer->accumulation;
+    uint8_t * coverage = rasterizer->coverage;
+    size_t nextEdge = 0, activeCount = 0;
+    int bandTop;
+    for (bandTop = box.top; bandTop < box.bottom; bandTop += BF_RASTER_BAND_HEIGHT) {
+        int bandBottom = (bandTop + BF_RASTER_BAND_HEIGHT < box.bottom ? bandTop + BF_RASTER_BAND_HEIGHT : box.bottom);
+        int bandHeight = bandBottom - bandTop;
+        while (nextEdge < rasterizer->edgeCount) {
+            BFRasterEdge * edge = &rasterizer->edges[nextEdge];
+            if (fminf(edge->y0, edge->y1) + offsetY >= bandBottom) {
+                break;
+            }
+            rasterizer->active[activeCount++] = nextEdge++;
+        }
+        size_t index, keptCount = 0;
+        for (index = 0; index < activeCount; index++) {
+            BFRasterEdge * edge = &rasterizer->edges[rasterizer->active[index]];
+            if (fmaxf(edge->y0, edge->y1) + offsetY <= bandTop) {
+                continue;
+            }
+            rasterizer->active[keptCount++] = rasterizer->active[index];
+            float left = box.left - offsetX, top = bandTop - offsetY;
+            BFRasterAccumulateEdge(accumulation, stride, width, bandHeight, edge->x0 - left, edge->y0 - top, edge->x1 - left, edge->y1 - top);
+        }
+        activeCount = keptCount;
+        int row;
+        for (row = 0; row < bandHeight; row++) {
+            float * cells = accumulation + (size_t)row * stride;
+            float sum = 0;
+            int x, first = -1, last = -1;
+            for (x = 0; x < width; x++) {
+                sum += cells[x];
+                cells[x] = 0;
+                float value = fminf(fabsf(sum), 1);
+                coverage[x] = (uint8_t)(value * 255 + 0.5f);
+                if (coverage[x]) {
+                    if (first < 0) {
+                        first = x;
+                    }
+                    last = x;
+                }
+            }
+            cells[width] = 0;
+            cells[width + 1] = 0;
+            if (first >= 0) {
+                spanFunction(userData, bandTop + row, box.left + first, last - first + 1, coverage + first);
+            }
+        }
+    }
+}
+
+typedef struct BFRasterFillContext {
+    BFRasterizer * rasterizer;
+    const BFRasterBitmap * bitmap;
+    const BFRasterClip * clip;
+    const BFRasterSource * source;
+    uint8_t opacity;
+    BFPaintModeType paintModeType;
+} BFRasterFillContext;
+
+static void BFRasterFillSpan(BFRasterFillContext * context, int y, int x, int count, uint8_t * coverage) {
+    if (context->clip->mask) {
+        BFRasterMaskApply(context->clip->mask, y, x, count, coverage);
+    }
+    uint8_t * span = context->rasterizer->span;
+    const BFRasterSource * source = context->source;
+    source->shade(source->object, &source->deviceToUser, x, y, count, span);
+    if (context->opacity != 0xff) {
+        int index;
+        for (index = 0; index < count * 4; index++) {
+            span[index] = BFRasterMultiply(span[index], context->opacity);
+        }
+    }
+    uint8_t * destination = context->bitmap->pixels + (size_t)y * context->bitmap->stride + (size_t)x * 4;
+    BFCompositeSpan(context->paintModeType, destination, span, coverage, count);
+}
+
+void BFRasterizerFill(BFRasterizer * rasterizer, const BFRasterBitmap * bitmap, const BFRasterClip * clip, const BFRasterSource * source, double opacity, BFPaintModeType paintModeType) {
+    BFRasterBox bitmapBox = { .left = 0, .top = 0, .right = bitmap->width, .bottom = bitmap->height };
+    BFRasterBox box = BFRasterBoxIntersect(clip->box, bitmapBox);
+    if (BFRasterBoxIsEmpty(box) || !(opacity > 0)) {
+        return;
+    }
+    if (!BFRasterizerGrow((void **)&rasterizer->span, &rasterizer->spanCapacity, (size_t)bitmap->width * 4, 1)) {
+        return;
+    }
+    BFRasterFillContext context = {
+        .rasterizer = rasterizer,
+        .bitmap = bitmap,
+        .clip = clip,
+        .source = source,
+        .opacity = (uint8_t)(fmin(opacity, 1) * 255 + 0.5),
+        .paintModeType = paintModeType,
+    };
+    BFRasterizerRender(rasterizer, box, (BFRasterSpanFunction)&BFRasterFillSpan, &context);
+}
+
+typedef struct BFRasterClipContext {
+    BFRasterizer * rasterizer;
+    BFRasterMaskRef oldMask;
+    BFRasterMaskRef newMask;
+    const BFRasterSource * maskSource;
+} BFRasterClipContext;
+
+static void BFRasterClipSpan(BFRasterClipContext * context, int y, int x, int count, uint8_t * coverage) {
+    int index;
+    if (context->oldMask) {
+        BFRasterMaskApply(context->oldMask, y, x, count, coverage);
+    }
+    if (context->maskSource) {
+        uint8_t * span = context->rasterizer->span;
+        const BFRasterSource * source = context->maskSource;
+        source->shade(source->object, &source->deviceToUser, x, y, count, span);
+        for (index = 0; index < count; index++) {
+            coverage[index] = BFRasterMultiply(coverage[index], span[index * 4 + 3]);
+        }
+    }
+    BFRasterMaskRef mask = context->newMask;
+    size_t stride = (size_t)(mask->box.right - mask->box.left);
+    memcpy(mask->data + (size_t)(y - mask->box.top) * stride + (x - mask->box.left), coverage, (size_t)count);
+}
+
+void BFRasterizerClip(BFRasterizer * rasterizer, BFRasterClip * clip, const BFRasterSource * maskSource) {
+    BFRasterizerFinishSubpath(rasterizer, false);
+    BFRasterBox edgeBox = { 0, 0, 0, 0 };
+    if (rasterizer->edgeCount > 0) {
+        edgeBox.left = (int)fmaxf(floorf(rasterizer->minX), -1e9f);
+        edgeBox.top = (int)fmaxf(floorf(rasterizer->minY), -1e9f);
+        edgeBox.right = (int)fminf(ceilf(rasterizer->maxX), 1e9f);
+        edgeBox.bottom = (int)fminf(ceilf(rasterizer->maxY), 1e9f);
+    }
+    BFRasterBox box = BFRasterBoxIntersect(clip->box, edgeBox);
+    BFRasterMaskRef newMask = NULL;
+    if (!BFRasterBoxIsEmpty(box)) {
+        newMask = BFRasterMaskCreate(box);
+        if (newMask && (!maskSource || BFRasterizerGrow((void **)&rasterizer->span, &rasterizer->spanCapacity, (size_t)(box.right - box.left) * 4, 1))) {
+            BFRasterClipContext context = {
+                .rasterizer = rasterizer,
+                .oldMask = clip->mask,
+                .newMask = newMask,
+                .maskSource = maskSource,
+            };
+            BFRasterizerRender(rasterizer, box, (BFRasterSpanFunction)&BFRasterClipSpan, &context);
+        }
+    }
+    rasterizer->edgeCount = 0;
+    rasterizer->hasCurrentPoint = false;
+    BFRelease(clip->mask);
+    clip->mask = newMask;
+    clip->box = (newMask ? box : (BFRasterBox){ 0, 0, 0, 0 });
+}
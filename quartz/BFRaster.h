@@ -0,0 +1,117 @@
+//
+//  BFRaster.h
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef __BF_RASTER_H__
+#define __BF_RASTER_H__
+
+#include <stdint.h>
+
+#include "butterfly.h"
+
+// BFRasterBitmap
+
+typedef struct BFRasterBitmap {
+    uint8_t * pixels;
+    size_t stride;
+    int width;
+    int height;
+} BFRasterBitmap;
+
+// BFRasterBox
+
+typedef struct BFRasterBox {
+    int left;
+    int top;
+    int right;
+    int bottom;
+} BFRasterBox;
+
+BFRasterBox BFRasterBoxIntersect(BFRasterBox box1, BFRasterBox box2);
+bool BFRasterBoxIsEmpty(BFRasterBox box);
+
+// BFRasterMatrix
+
+BFTransformationComponents BFRasterMatrixMake(double a, double b, double c, double d, double tx, double ty);
+BFTransformationComponents BFRasterMatrixConcat(BFTransformationComponents matrix1, BFTransformationComponents matrix2);
+BFTransformationComponents BFRasterMatrixInvert(BFTransformationComponents matrix);
+BFPoint BFRasterMatrixTransformPoint(BFTransformationComponents matrix, BFPoint point);
+BFRect BFRasterMatrixTransformRect(BFTransformationComponents matrix, BFRect rect);
+double BFRasterMatrixGetScale(BFTransformationComponents matrix);
+
+// BFRasterSource
+
+typedef void (* BFRasterShadeFunction)(const void * object, const BFTransformationComponents * deviceToUser, int x, int y, int count, uint8_t * span);
+
+typedef struct BFRasterSource {
+    BFRasterShadeFunction shade;
+    const void * object;
+    BFTransformationComponents deviceToUser;
+} BFRasterSource;
+
+typedef struct BFRasterImage {
+    BFRasterBitmap bitmap;
+    BFRect rect;
+} BFRasterImage;
+
+void BFRasterPackColor(double r, double g, double b, double a, uint8_t * pixel);
+void BFRasterSourceInitWithImage(BFRasterSource * source, const BFRasterImage * image, BFTransformationComponents deviceToUser);
+
+// BFRasterClip
+
+typedef struct BFRasterMask * BFRasterMaskRef;
+
+typedef struct BFRasterClip {
+    BFRasterBox box;
+    BFRasterMaskRef mask;
+} BFRasterClip;
+
+// BFRasterizer
+
+typedef struct BFRasterizer BFRasterizer;
+
+BFRasterizer * BFRasterizerCreate(void);
+void BFRasterizerDestroy(BFRasterizer * rasterizer);
+
+void BFRasterizerBeginFill(BFRasterizer * rasterizer, BFTransformationComponents transformation);
+void BFRasterizerBeginStroke(BFRasterizer * rasterizer, BFTransformationComponents transformation, double thickness);
+
+void BFRasterizerMoveToPoint(BFRasterizer * rasterizer, BFPoint point);
+void BFRasterizerAddLineToPoint(BFRasterizer * rasterizer, BFPoint point);
+void BFRasterizerAddCurveToPoint(BFRasterizer * rasterizer, BFPoint point, BFPoint controlPoint1, BFPoint controlPoint2);
+void BFRasterizerAddQuadCurveToPoint(BFRasterizer * rasterizer, BFPoint point, BFPoint controlPoint);
+void BFRasterizerCloseSubpath(BFRasterizer * rasterizer);
+void BFRasterizerAddPath(BFRasterizer * rasterizer, BFPathRef path);
+void BFRasterizerAddRect(BFRasterizer * rasterizer, BFRect rect);
+void BFRasterizerSetOffset(BFRasterizer * rasterizer, BFPoint offset);
+bool BFRasterizerIsEmpty(BFRasterizer * rasterizer);
+
+void BFRasterizerFill(BFRasterizer * rasterizer, const BFRasterBitmap * bitmap, const BFRasterClip * clip, const BFRasterSource * source, double opacity, BFPaintModeType paintModeType);
+void BFRasterizerClip(BFRasterizer * rasterizer, BFRasterClip * clip, const BFRasterSource * maskSource);
+void BFRasterizerHitTest(BFRasterizer * rasterizer, const BFPoint * points, size_t count, const uint8_t * mask, uint8_t * results);
+
+// BFIcon
+
+bool BFIconGetRasterBitmap(BFIconRef icon, BFRasterBitmap * bitmap);
+
+#endif /* __BF_RASTER_H__ */
@@ -25,6 +25,7 @@
 #include "butterfly.h"
 #include "quartz.h"
 
+#include "BFGlyphCache.h"
 #include "BFQuartzTypes.h"
 
 struct BFStyledString {
@@ -104,44 +105,83 @@ CFIndex BFStyledStringCreateBreaking(BFStyledStringRef styledString, CFIndex sta
     return startPosition;
 }
 
+static void BFStyledStringGetTruncationRange(CFStringRef string, CFIndex length, CFIndex removedCount, CFRange * range) {
+    // Middle truncation: keep the first half of what remains (rounding up) and the rest from the end, without
+    // splitting surrogate pairs.
+    CFIndex keptCount = length - removedCount;
+    CFIndex prefixLength = (keptCount + 1) / 2;
+    CFIndex suffixStart = length - (keptCount - prefixLength);
+    if (prefixLength >= 1) {
+        UniChar beforeCharacter = CFStringGetCharacterAtIndex(string, prefixLength - 1);
+        if (beforeCharacter >= 0xD800 && beforeCharacter <= 0xDBFF) {
+            prefixLength--;
+        }
+    }
+    if (suffixStart < length) {
+        UniChar afterCharacter = CFStringGetCharacterAtIndex(string, suffixStart);
+        if (afterCharacter >= 0xDC00 && afterCharacter <= 0xDFFF) {
+            suffixStart++;
+        }
+    }
+    range->location = prefixLength;
+    range->length = suffixStart - prefixLength;
+}
+
 BFStyledStringRef BFStyledStringCreateTruncating(BFStyledStringRef styledString, double width) {
     BFRect stringRect = BFStyledStringMeasure(styledString);
     double stringWidth = stringRect.right - stringRect.left;
-    if (stringWidth <= width) {
+    CFIndex length = CFAttributedStringGetLength(styledString->stringRef);
+    if (stringWidth <= width || length == 0) {
         BFRetain(styledString);
     } else {
+        CFStringRef string = CFAttributedStringGetString(styledString->stringRef);
+        CTLineRef lineRef = styledString->lineRef;
+        double lineWidth = CTLineGetTypographicBounds(lineRef, NULL, NULL, NULL);
         CFStringRef ellipsis = CFStringCreateWithCString(NULL, "…", kCFStringEncodingUTF8);
-        CFMutableAttributedStringRef mutableString = CFAttributedStringCreateMutableCopy(NULL, 0, styledString->stringRef);
-        CTLineRef lineRef = CTLineCreateWithAttributedString(mutableString);
-        CFIndex length = CFAttributedStringGetLength(mutableString);
-        CFRange range = { .location = length / 2, .length = 1 };
-        // TODO: would a binary search be faster?
-        while (length >= 1 && CTLineGetTypographicBounds(lineRef, NULL, NULL, NULL) > width) {
-            CFStringRef string = CFAttributedStringGetString(mutableString);
-            if (range.location >= 1) {
-                UniChar beforeCharacter = CFStringGetCharacterAtIndex(string, range.location - 1);
-                if (beforeCharacter >= 0xD800 && beforeCharacter <= 0xDBFF) {
-                    range.location--;
-                    range.length++;
-                    length--;
-                }
+        
+        // The ellipsis takes on the attributes of the middle of the string, as the first replaced character's would.
+        CFAttributedStringRef ellipsisString = CFAttributedStringCreate(NULL, ellipsis, CFAttributedStringGetAttributes(styledString->stringRef, length / 2, NULL));
+        CTLineRef ellipsisLine = CTLineCreateWithAttributedString(ellipsisString);
+        double ellipsisWidth = CTLineGetTypographicBounds(ellipsisLine, NULL, NULL, NULL);
+        CFRelease(ellipsisLine);
+        CFRelease(ellipsisString);
+        
+        // Estimate the width for each number of removed characters from the caret offsets of the original line, and
+        // binary search for the fewest removals that fit.
+        CFIndex low = 1, high = length;
+        CFRange range;
+        while (low < high) {
+            CFIndex middle = low + (high - low) / 2;
+            BFStyledStringGetTruncationRange(string, length, middle, &range);
+            double prefixWidth = CTLineGetOffsetForStringIndex(lineRef, range.location, NULL);
+            double suffixWidth = lineWidth - CTLineGetOffsetForStringIndex(lineRef, range.location + range.length, NULL);
+            if (prefixWidth + ellipsisWidth + suffixWidth <= width) {
+                high = middle;
+            } else {
+                low = middle + 1;
             }
-            if (range.location + range.length < length) {
-                UniChar afterCharacter = CFStringGetCharacterAtIndex(string, range.location + range.length);
-                if (afterCharacter >= 0xDC00 && afterCharacter <= 0xDFFF) {
-                    range.length++;
-                    length--;
-                }
+        }
+        
+        // Kerning and ligatures across the cut can make the estimate slightly short, so check the real layout and
+        // remove more characters in the rare case it doesn't fit.
+        CFMutableAttributedStringRef mutableString = NULL;
+        CTLineRef truncatedLine = NULL;
+        CFIndex removedCount;
+        for (removedCount = low; removedCount <= length; removedCount++) {
+            if (mutableString) {
+                CFRelease(mutableString);
+                CFRelease(truncatedLine);
             }
+            BFStyledStringGetTruncationRange(string, length, removedCount, &range);
+            mutableString = CFAttributedStringCreateMutableCopy(NULL, 0, styledString->stringRef);
             CFAttributedStringReplaceString(mutableString, range, ellipsis);
-            CFRelease(lineRef);
-            lineRef = CTLineCreateWithAttributedString(mutableString);
-            length--;
-            range.location = length / 2;
-            range.length = 2;
+            truncatedLine = CTLineCreateWithAttributedString(mutableString);
+            if (CTLineGetTypographicBounds(truncatedLine, NULL, NULL, NULL) <= width) {
+                break;
+            }
         }
         CFRelease(ellipsis);
-        if (CTLineGetTypographicBounds(lineRef, NULL, NULL, NULL) < stringWidth) {
+        if (CTLineGetTypographicBounds(truncatedLine, NULL, NULL, NULL) < stringWidth) {
             CFAttributedStringRef attributedString = CFAttributedStringCreateCopy(NULL, mutableString);
             styledString = BFStyledStringCreateUsingAttributedString(attributedString);
             CFRelease(attributedString);
@@ -149,7 +189,7 @@ BFStyledStringRef BFStyledStringCreateTruncating(BFStyledStringRef styledString,
             BFRetain(styledString);
         }
         CFRelease(mutableString);
-        CFRelease(lineRef);
+        CFRelease(truncatedLine);
     }
     return styledString;
 }
@@ -304,14 +344,7 @@ static void BFStyledStringIterateRuns(BFStyledStringRef styledString, BFFunction
 }
 
 static void BFStyledStringAddGlyphsToPath(CTFontRef font, double baselineOffset, const CGGlyph * glyphs, const CGPoint * positions, CFIndex glyphCount, CGMutablePathRef path) {
-    CGAffineTransform glyphTransform = CGAffineTransformIdentity;
-    for (CFIndex glyphIndex = 0; glyphIndex < glyphCount; glyphIndex++) {
-        glyphTransform.tx = positions[glyphIndex].x;
-        glyphTransform.ty = positions[glyphIndex].y + baselineOffset;
-        CGPathRef glyphPath = CTFontCreatePathForGlyph(font, glyphs[glyphIndex], &glyphTransform);
-        CGPathAddPath(path, NULL, glyphPath);
-        CGPathRelease(glyphPath);
-    }
+    BFGlyphCacheAddGlyphsToPath(path, font, glyphs, positions, glyphCount, baselineOffset);
 }
 
 static void BFStyledStringDrawGlyphsInContext(CTFontRef font, double baselineOffset, const CGGlyph * glyphs, const CGPoint * positions, CFIndex glyphCount, BFStyledStringDrawGlyphsInContextUserData * userData) {
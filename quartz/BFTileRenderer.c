@@ -0,0 +1,203 @@
+//
+//  BFTileRenderer.c
+//
+//  Copyright (c) 2011-2019 James Rodovich
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "butterfly.h"
+
+#include "BFDisplayList.h"
+
+#define BF_TILE_RENDERER_DEFAULT_TILE_SIZE 256
+#define BF_TILE_RENDERER_MAX_THREADS 64
+
+// Each worker owns a contiguous range of tiles and takes them from the front; an idle worker steals from the back of
+// the busiest range. Tiles are independent, so the order they finish in never affects the output.
+typedef struct BFTileQueue {
+    pthread_mutex_t mutex;
+    size_t next;
+    size_t end;
+} BFTileQueue;
+
+typedef struct BFTileRenderer {
+    BFDisplayListRef displayList;
+    uint8_t * pixels;
+    size_t stride;
+    int width;
+    int height;
+    BFRect boundsRect;
+    double backingScale;
+    double pointScale;
+    int tileSize;
+    int columnCount;
+    BFTileQueue * queues;
+    int queueCount;
+} BFTileRenderer;
+
+typedef struct BFTileWorker {
+    BFTileRenderer * renderer;
+    int index;
+} BFTileWorker;
+
+static void BFTileRendererRenderTile(BFTileRenderer * renderer, size_t tile) {
+    int x = (int)(tile % renderer->columnCount) * renderer->tileSize;
+    int y = (int)(tile / renderer->columnCount) * renderer->tileSize;
+    int width = (renderer->width - x < renderer->tileSize ? renderer->width - x : renderer->tileSize);
+    int height = (renderer->height - y < renderer->tileSize ? renderer->height - y : renderer->tileSize);
+    
+    // The tile canvas draws straight into its part of the output buffer, sharing the full row stride.
+    BFRect tileRect = {
+        .left = renderer->boundsRect.left + x / renderer->backingScale,
+        .bottom = renderer->boundsRect.top - (y + height) / renderer->backingScale,
+        .right = renderer->boundsRect.left + (x + width) / renderer->backingScale,
+        .top = renderer->boundsRect.top - y / renderer->backingScale,
+    };
+    BFCanvasMetricsRef metrics = BFCanvasMetricsCreate(tileRect, renderer->backingScale, renderer->pointScale);
+    BFCanvasRef canvas = BFCanvasCreateForBitmap(renderer->pixels + (size_t)y * renderer->stride + (size_t)x * 4, renderer->stride, metrics);
+    BFRelease(metrics);
+    BFDisplayListReplay(renderer->displayList, canvas);
+    BFRelease(canvas);
+}
+
+static bool BFTileRendererTakeTile(BFTileQueue * queue, bool steal, size_t * tile) {
+    bool found = false;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->next < queue->end) {
+        *tile = (steal ? --queue->end : queue->next++);
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return found;
+}
+
+static void * BFTileRendererWork(BFTileWorker * worker) {
+    BFTileRenderer * renderer = worker->renderer;
+    BFTileQueue * ownQueue = &renderer->queues[worker->index];
+    size_t tile;
+    while (true) {
+        if (BFTileRendererTakeTile(ownQueue, false, &tile)) {
+            BFTileRendererRenderTile(renderer, tile);
+            continue;
+        }
+        BFTileQueue * victim = NULL;
+        size_t mostRemaining = 0;
+        int index;
+        for (index = 0; index < renderer->queueCount; index++) {
+            BFTileQueue * queue = &renderer->queues[index];
+            pthread_mutex_lock(&queue->mutex);
+            size_t remaining = queue->end - queue->next;
+            pthread_mutex_unlock(&queue->mutex);
+            if (remaining > mostRemaining) {
+                mostRemaining = remaining;
+                victim = queue;
+            }
+        }
+        if (!victim) {
+            break;
+        }
+        if (BFTileRendererTakeTile(victim, true, &tile)) {
+            BFTileRendererRenderTile(renderer, tile);
+        }
+    }
+    return NULL;
+}
+
+static int BFTileRendererGetThreadCount(int threadCount) {
+    if (threadCount <= 0) {
+        long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (processorCount > 0 ? (int)processorCount : 1);
+    }
+    return (threadCount > BF_TILE_RENDERER_MAX_THREADS ? BF_TILE_RENDERER_MAX_THREADS : threadCount);
+}
+
+static int BFTileRendererGetTileSize(BFTiledRenderOptions options, int width, int height, int threadCount) {
+    if (options.tileSize > 0) {
+        return options.tileSize;
+    }
+    if (options.deterministic) {
+        // Tile edges shift rounding in the coverage accumulation, so the grid mustn't depend on the thread count.
+        return BF_TILE_RENDERER_DEFAULT_TILE_SIZE;
+    }
+    // Aim for several tiles per thread so stealing can even out the load, without tiles so small that per-tile
+    // setup and culling dominate.
+    double tileSize = sqrt((double)width * height / (threadCount * 8.0));
+    tileSize = fmax(64, fmin(tileSize, 512));
+    return (int)(ceil(tileSize / 16) * 16);
+}
+
+void BFDisplayListRenderTiled(BFDisplayListRef displayList, void * pixels, size_t stride, BFCanvasMetricsRef metrics, BFTiledRenderOptions options) {
+    BFTileRenderer renderer = {
+        .displayList = displayList,
+        .pixels = pixels,
+        .stride = stride,
+        .boundsRect = BFCanvasMetricsGetBoundsRect(metrics),
+        .backingScale = BFCanvasMetricsGetBackingScale(metrics),
+        .pointScale = BFCanvasMetricsGetPointScale(metrics),
+    };
+    renderer.width = (int)round((renderer.boundsRect.right - renderer.boundsRect.left) * renderer.backingScale);
+    renderer.height = (int)round((renderer.boundsRect.top - renderer.boundsRect.bottom) * renderer.backingScale);
+    if (renderer.width <= 0 || renderer.height <= 0) {
+        return;
+    }
+    
+    int threadCount = BFTileRendererGetThreadCount(options.threadCount);
+    renderer.tileSize = BFTileRendererGetTileSize(options, renderer.width, renderer.height, threadCount);
+    renderer.columnCount = (renderer.width + renderer.tileSize - 1) / renderer.tileSize;
+    int rowCount = (renderer.height + renderer.tileSize - 1) / renderer.tileSize;
+    size_t tileCount = (size_t)renderer.columnCount * rowCount;
+    if ((size_t)threadCount > tileCount) {
+        threadCount = (int)tileCount;
+    }
+    
+    BFDisplayListPrepareForConcurrentReplay(displayList);
+    
+    BFTileQueue queues[BF_TILE_RENDERER_MAX_THREADS];
+    BFTileWorker workers[BF_TILE_RENDERER_MAX_THREADS];
+    pthread_t threads[BF_TILE_RENDERER_MAX_THREADS];
+    int index;
+    for (index = 0; index < threadCount; index++) {
+        pthread_mutex_init(&queues[index].mutex, NULL);
+        queues[index].next = tileCount * index / threadCount;
+        queues[index].end = tileCount * (index + 1) / threadCount;
+        workers[index] = (BFTileWorker){ .renderer = &renderer, .index = index };
+    }
+    renderer.queues = queues;
+    renderer.queueCount = threadCount;
+    
+    // The calling thread is worker 0; if a thread can't be started, the others will steal its tiles.
+    bool started[BF_TILE_RENDERER_MAX_THREADS] = { false };
+    for (index = 1; index < threadCount; index++) {
+        started[index] = (pthread_create(&threads[index], NULL, (void * (*)(void *))&BFTileRendererWork, &workers[index]) == 0);
+    }
+    BFTileRendererWork(&workers[0]);
+    for (index = 1; index < threadCount; index++) {
+        if (started[index]) {
+            pthread_join(threads[index], NULL);
+        }
+    }
+    for (index = 0; index < threadCount; index++) {
+        pthread_mutex_destroy(&queues[index].mutex);
+    }
+}
@@ -22,14 +22,18 @@
 //  THE SOFTWARE.
 //
 
+#include <math.h>
+
 #include "butterfly.h"
+#ifdef __APPLE__
 #include "quartz.h"
+#endif
 
-#include "BFQuartzTypes.h"
+#include "BFRaster.h"
 
 struct BFTransformation {
     struct BFBase __base;
-    CGAffineTransform affine;
+    BFTransformationComponents components;
 };
 
 static void BFTransformationInit(BFTransformationRef transformation);
@@ -49,7 +53,7 @@ BFTransformationRef BFTransformationCreate(void) {
 }
 
 static void BFTransformationInit(BFTransformationRef transformation) {
-    transformation->affine = CGAffineTransformIdentity;
+    transformation->components = BFRasterMatrixMake(1, 0, 0, 1, 0, 0);
 }
 
 static void BFTransformationDealloc(BFTransformationRef transformation) {
@@ -58,50 +62,63 @@ static void BFTransformationDealloc(BFTransformationRef transformation) {
     BFDealloc(transformation);
 }
 
+// Like the CGAffineTransform functions, each change applies before the existing transformation.
+
 void BFTransformationRotate(BFTransformationRef transformation, double angle) {
-    transformation->affine = CGAffineTransformRotate(transformation->affine, angle);
+    if (BFIsImmutable(transformation)) {
+        return;
+    }
+    BFTransformationComponents rotation = BFRasterMatrixMake(cos(angle), sin(angle), -sin(angle), cos(angle), 0, 0);
+    transformation->components = BFRasterMatrixConcat(rotation, transformation->components);
 }
 
 void BFTransformationTranslate(BFTransformationRef transformation, double dx, double dy) {
-    transformation->affine = CGAffineTransformTranslate(transformation->affine, dx, dy);
+    if (BFIsImmutable(transformation)) {
+        return;
+    }
+    BFTransformationComponents translation = BFRasterMatrixMake(1, 0, 0, 1, dx, dy);
+    transformation->components = BFRasterMatrixConcat(translation, transformation->components);
 }
 
 void BFTransformationScale(BFTransformationRef transformation, double ratio) {
-    transformation->affine = CGAffineTransformScale(transformation->affine, ratio, ratio);
+    if (BFIsImmutable(transformation)) {
+        return;
+    }
+    BFTransformationComponents scale = BFRasterMatrixMake(ratio, 0, 0, ratio, 0, 0);
+    transformation->components = BFRasterMatrixConcat(scale, transformation->components);
 }
 
 void BFTransformationInvert(BFTransformationRef transformation) {
-    transformation->affine = CGAffineTransformInvert(transformation->affine);
+    if (BFIsImmutable(transformation)) {
+        return;
+    }
+    transformation->components = BFRasterMatrixInvert(transformation->components);
 }
 
 void BFTransformationConcat(BFTransformationRef transformation1, BFTransformationRef transformation2) {
-    transformation1->affine = CGAffineTransformConcat(transformation1->affine, transformation2->affine);
+    if (BFIsImmutable(transformation1)) {
+        return;
+    }
+    transformation1->components = BFRasterMatrixConcat(transformation1->components, transformation2->components);
 }
 
 BFPoint BFTransformationTransformPoint(BFTransformationRef transformation, BFPoint point) {
-    CGPoint cgPoint = CGPointMake(point.x, point.y);
-    cgPoint = CGPointApplyAffineTransform(cgPoint, transformation->affine);
-    return (BFPoint){ .x = cgPoint.x, .y = cgPoint.y };
+    return BFRasterMatrixTransformPoint(transformation->components, point);
 }
 
 BFRect BFTransformationTransformRect(BFTransformationRef transformation, BFRect rect) {
-    CGRect cgRect = BFRectToCGRect(rect);
-    cgRect = CGRectApplyAffineTransform(cgRect, transformation->affine);
-    return BFRectFromCGRect(cgRect);
+    return BFRasterMatrixTransformRect(transformation->components, rect);
 }
 
 BFTransformationComponents BFTransformationGetComponents(BFTransformationRef transformation) {
-    BFTransformationComponents components = {
-        .a = transformation->affine.a,
-        .b = transformation->affine.b,
-        .c = transformation->affine.c,
-        .d = transformation->affine.d,
-        .tx = transformation->affine.tx,
-        .ty = transformation->affine.ty,
-    };
-    return components;
+    return transformation->components;
 }
 
+#ifdef __APPLE__
+
 CGAffineTransform BFTransformationGetCGAffineTransform(BFTransformationRef transformation) {
-    return transformation->affine;
+    BFTransformationComponents components = transformation->components;
+    return CGAffineTransformMake(components.a, components.b, components.c, components.d, components.tx, components.ty);
 }
+
+#endif
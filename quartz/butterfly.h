@@ -25,7 +25,15 @@
 #ifndef __BUTTERFLY_H__
 #define __BUTTERFLY_H__
 
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long CFIndex;
+#endif
 
 typedef struct {
     double x;
@@ -39,13 +47,27 @@ typedef struct {
     double top;
 } BFRect;
 
+typedef struct {
+    double a;
+    double b;
+    double c;
+    double d;
+    double tx;
+    double ty;
+} BFTransformationComponents;
+
 void * BFRetain(void * base);
 void BFRelease(void * base);
 
 typedef struct BFBase * BFBaseRef;
+typedef struct BFBitmap * BFBitmapRef;
+typedef struct BFBitmapPool * BFBitmapPoolRef;
+typedef struct BFBuffer * BFBufferRef;
 typedef struct BFCanvas * BFCanvasRef;
 typedef struct BFCanvasMetrics * BFCanvasMetricsRef;
 typedef struct BFColorPaint * BFColorPaintRef;
+typedef struct BFDisplayList * BFDisplayListRef;
+typedef struct BFFlattenedPath * BFFlattenedPathRef;
 typedef struct BFFont * BFFontRef;
 typedef struct BFGradientPaint * BFGradientPaintRef;
 typedef struct BFIcon * BFIconRef;
@@ -55,15 +77,22 @@ typedef struct BFPath * BFPathRef;
 typedef struct BFStyledString * BFStyledStringRef;
 typedef struct BFTransformation * BFTransformationRef;
 
+#define BFBitmapClassName "butterfly.Bitmap"
+#define BFBitmapPoolClassName "butterfly.BitmapPool"
+#define BFBufferClassName "butterfly.Buffer"
 #define BFCanvasClassName "butterfly.Canvas"
 #define BFCanvasMetricsClassName "butterfly.CanvasMetrics"
 #define BFColorPaintClassName "butterfly.ColorPaint"
+#define BFDisplayListClassName "butterfly.DisplayList"
+#define BFFlattenedPathClassName "butterfly.FlattenedPath"
 #define BFFontClassName "butterfly.Font"
 #define BFGradientPaintClassName "butterfly.GradientPaint"
 #define BFIconClassName "butterfly.Icon"
 #define BFPaintClassName "butterfly.Paint"
 #define BFPaintModeClassName "butterfly.PaintMode"
 #define BFPathClassName "butterfly.Path"
+#define BFPointClassName "butterfly.Point"
+#define BFRectClassName "butterfly.Rect"
 #define BFStyledStringClassName "butterfly.StyledString"
 #define BFTransformationClassName "butterfly.Transformation"
 
@@ -79,22 +108,74 @@ typedef struct BFBaseFunctions {
 struct BFBase {
     const BFBaseFunctions * subclass;
     int _refcount;
+    int _flags;
 };
 
 void * BFAlloc(size_t size, const BFBaseFunctions * subclass);
 void BFDealloc(void * base);
 
+// An immutable object can be shared between threads freely, and its setters leave it unchanged. Objects are marked
+// before they are handed out, and the mark is permanent.
+void BFMarkImmutable(void * object);
+bool BFIsImmutable(void * object);
+
 const void * BFSubclassFunctions(void * object);
 const char * BFSubclassName(void * object);
 
+// BFBitmapPool
+
+BFBitmapPoolRef BFBitmapPoolCreate(size_t maximumByteCount);
+BFBitmapPoolRef BFBitmapPoolGetDefault(void);
+
+BFBitmapRef BFBitmapPoolCreateBitmap(BFBitmapPoolRef pool, size_t width, size_t height);
+
+void * BFBitmapGetPixels(BFBitmapRef bitmap);
+size_t BFBitmapGetStride(BFBitmapRef bitmap);
+size_t BFBitmapGetWidth(BFBitmapRef bitmap);
+size_t BFBitmapGetHeight(BFBitmapRef bitmap);
+
+BFCanvasRef BFBitmapCreateCanvas(BFBitmapRef bitmap, BFCanvasMetricsRef metrics);
+
+// BFBuffer
+
+typedef enum BFBufferType {
+    kBFBufferTypeDouble,
+    kBFBufferTypeFloat,
+} BFBufferType;
+
+typedef void (* BFBufferDeallocFunction)(void * bytes, void * info);
+
+BFBufferRef BFBufferCreate(BFBufferType type, size_t count);
+BFBufferRef BFBufferCreateWithBytesNoCopy(void * bytes, BFBufferType type, size_t count, BFBufferDeallocFunction deallocFunction, void * info);
+
+BFBufferType BFBufferGetType(BFBufferRef buffer);
+size_t BFBufferGetCount(BFBufferRef buffer);
+void * BFBufferGetBytes(BFBufferRef buffer);
+double BFBufferGetValue(BFBufferRef buffer, size_t index);
+void BFBufferSetValue(BFBufferRef buffer, size_t index, double value);
+size_t BFBufferGetPointCount(BFBufferRef buffer);
+BFPoint BFBufferGetPoint(BFBufferRef buffer, size_t index);
+
 // BFCanvas
 
 // BFCanvasRef BFCanvasCreateForDisplay(CGContextRef context, BFCanvasMetricsRef metrics);
+BFCanvasRef BFCanvasCreateForBitmap(void * pixels, size_t stride, BFCanvasMetricsRef metrics);
 BFCanvasRef BFCanvasCreateForHitTest(BFCanvasMetricsRef metrics);
+BFCanvasRef BFCanvasCreateForHitTestPoints(BFCanvasMetricsRef metrics, const BFPoint points[], size_t pointCount);
+BFCanvasRef BFCanvasCreateForRecording(BFCanvasMetricsRef metrics);
 
 BFCanvasMetricsRef BFCanvasGetMetrics(BFCanvasRef canvas);
 void BFCanvasSetDirtyRect(BFCanvasRef canvas, BFRect rect);
 BFRect BFCanvasGetDirtyRect(BFCanvasRef canvas);
+
+typedef struct {
+    size_t drawnCount;
+    size_t culledCount;
+} BFCanvasCullingStatistics;
+
+BFCanvasCullingStatistics BFCanvasGetCullingStatistics(BFCanvasRef canvas);
+void BFCanvasResetCullingStatistics(BFCanvasRef canvas);
+
 void BFCanvasSetOpacity(BFCanvasRef canvas, double opacity);
 void BFCanvasSetPaint(BFCanvasRef canvas, BFPaintRef paint);
 void BFCanvasSetPaintMode(BFCanvasRef canvas, BFPaintModeRef paintMode);
@@ -114,9 +195,20 @@ void BFCanvasStrokePath(BFCanvasRef canvas, const BFPathRef path);
 void BFCanvasDrawStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point);
 void BFCanvasStrokeStyledString(BFCanvasRef canvas, BFStyledStringRef styledString, BFPoint point);
 void BFCanvasDrawIcon(BFCanvasRef canvas, const BFIconRef icon, BFRect rect);
+void BFCanvasFillRects(BFCanvasRef canvas, const BFRect rects[], size_t count);
+void BFCanvasFillPaths(BFCanvasRef canvas, const BFPathRef paths[], const BFTransformationRef transformations[], size_t count);
+void BFCanvasDrawInstances(BFCanvasRef canvas, const BFPathRef path, const BFPoint points[], const BFPaintRef paints[], size_t count);
 
 bool BFCanvasIsHitTest(BFCanvasRef canvas);
 bool BFCanvasPerformHitTest(BFCanvasRef canvas);
+size_t BFCanvasGetHitTestPointCount(BFCanvasRef canvas);
+bool BFCanvasGetHitTestResult(BFCanvasRef canvas, size_t index);
+bool BFCanvasGetLastHitTestResult(BFCanvasRef canvas, size_t index);
+
+bool BFCanvasIsRecording(BFCanvasRef canvas);
+// Hands over the commands recorded since the last call, as an immutable list, and records later commands into a new
+// list. A list taken partway through starts in the state the canvas had then, so take it once recording is done.
+BFDisplayListRef BFCanvasTakeDisplayList(BFCanvasRef canvas);
 
 // BFCanvasMetrics
 
@@ -129,12 +221,29 @@ double BFCanvasMetricsGetPointScale(BFCanvasMetricsRef canvasMetrics);
 // BFColorPaint
 
 BFColorPaintRef BFColorPaintCreate(void);
+// May return the same object to every caller asking for the same components, so the result is immutable.
+BFColorPaintRef BFColorPaintCreateWithRGBA(double r, double g, double b, double a);
 
 void BFColorPaintSetRGBA(BFColorPaintRef colorPaint, double r, double g, double b, double a);
 void BFColorPaintGetRGBA(BFColorPaintRef colorPaint, double * r, double * g, double * b, double * a);
 
 bool BFColorPaintEquals(BFColorPaintRef colorPaint1, BFColorPaintRef colorPaint2);
 
+// BFDisplayList
+
+size_t BFDisplayListGetCommandCount(BFDisplayListRef displayList);
+BFRect BFDisplayListGetBounds(BFDisplayListRef displayList);
+
+void BFDisplayListReplay(BFDisplayListRef displayList, BFCanvasRef canvas);
+
+typedef struct {
+    int threadCount;
+    int tileSize;
+    bool deterministic;
+} BFTiledRenderOptions;
+
+void BFDisplayListRenderTiled(BFDisplayListRef displayList, void * pixels, size_t stride, BFCanvasMetricsRef metrics, BFTiledRenderOptions options);
+
 // BFFont
 
 typedef struct {
@@ -157,6 +266,17 @@ double BFFontGetDescent(BFFontRef font);
 double BFFontGetLeading(BFFontRef font);
 BFFontFeatures BFFontGetFeatures(BFFontRef font);
 
+typedef struct {
+    size_t hitCount;
+    size_t missCount;
+    size_t evictionCount;
+    size_t entryCount;
+} BFFontCacheStatistics;
+
+BFFontCacheStatistics BFFontCacheGetStatistics(void);
+void BFFontCacheSetEntryLimit(size_t entryLimit);
+void BFFontCachePurge(void);
+
 // BFGradientPaint
 
 BFGradientPaintRef BFGradientPaintCreate(void);
@@ -165,12 +285,27 @@ void BFGradientPaintSetColors(BFGradientPaintRef gradientPaint, int count, const
 void BFGradientPaintSetLinearLocation(BFGradientPaintRef gradientPaint, BFPoint startPoint, BFPoint endPoint);
 void BFGradientPaintSetRadialLocation(BFGradientPaintRef gradientPaint, BFPoint startCenter, double startRadius, BFPoint endCenter, double endRadius);
 
+// BFGlyphCache
+
+typedef struct {
+    size_t hitCount;
+    size_t missCount;
+    size_t evictionCount;
+    size_t entryCount;
+    size_t memoryUsage;
+} BFGlyphCacheStatistics;
+
+BFGlyphCacheStatistics BFGlyphCacheGetStatistics(void);
+void BFGlyphCacheSetMemoryLimit(size_t memoryLimit);
+void BFGlyphCachePurge(void);
+
 // BFIcon
 
 BFIconRef BFIconCreate(BFRect boundsRect);
 // BFIconRef BFIconCreateWithCGImage(CGImageRef image, double width, double height);
 
 BFCanvasRef BFIconGetCanvas(BFIconRef icon);
+size_t BFIconGetImageGenerationCount(BFIconRef icon);
 
 // BFPaintMode
 
@@ -207,6 +342,8 @@ typedef enum BFPaintModeType {
 
 BFPaintModeRef BFPaintModeCreate(BFPaintModeType type);
 
+BFPaintModeType BFPaintModeGetType(BFPaintModeRef paintMode);
+
 // BFPath
 
 typedef enum BFPathComponentType {
@@ -227,6 +364,7 @@ typedef struct {
 typedef void (* BFPathComponentIterationFunction)(void * userData, BFPathComponent pathComponent);
 
 BFPathRef BFPathCreate(void);
+BFPathRef BFPathCreateCopy(BFPathRef path);
 
 void BFPathMoveToPoint(BFPathRef path, BFPoint point);
 void BFPathAddLineToPoint(BFPathRef path, BFPoint point);
@@ -237,9 +375,29 @@ void BFPathCloseSubpath(BFPathRef path);
 void BFPathAddRect(BFPathRef path, BFRect rect);
 void BFPathAddRoundedRect(BFPathRef path, BFRect rect, double radius);
 void BFPathAddOvalInRect(BFPathRef path, BFRect rect);
+void BFPathAddPolyline(BFPathRef path, BFBufferRef buffer, bool closed);
+void BFPathAddSpline(BFPathRef path, BFBufferRef buffer, bool closed);
+
+bool BFPathGetBounds(BFPathRef path, BFRect * bounds);
+bool BFPathGetControlBounds(BFPathRef path, BFRect * bounds);
 
 void BFPathIterateComponents(BFPathRef path, BFPathComponentIterationFunction iterationFunction, void * userData);
 
+// The tolerance is measured after applying the transformation; the points are returned untransformed.
+BFFlattenedPathRef BFPathCopyFlattened(BFPathRef path, double tolerance, BFTransformationComponents transformation);
+
+typedef struct {
+    size_t pointIndex;
+    size_t pointCount;
+    bool closed;
+} BFFlattenedSubpath;
+
+size_t BFFlattenedPathGetPointCount(BFFlattenedPathRef flattenedPath);
+const BFPoint * BFFlattenedPathGetPoints(BFFlattenedPathRef flattenedPath);
+size_t BFFlattenedPathGetSubpathCount(BFFlattenedPathRef flattenedPath);
+const BFFlattenedSubpath * BFFlattenedPathGetSubpaths(BFFlattenedPathRef flattenedPath);
+double BFFlattenedPathGetLength(BFFlattenedPathRef flattenedPath);
+
 // BFStyledString
 
 typedef struct {
@@ -269,15 +427,6 @@ char * BFStyledStringCopyString(BFStyledStringRef styledString);
 
 // BFTransformation
 
-typedef struct {
-    double a;
-    double b;
-    double c;
-    double d;
-    double tx;
-    double ty;
-} BFTransformationComponents;
-
 BFTransformationRef BFTransformationCreate(void);
 
 void BFTransformationRotate(BFTransformationRef transformation, double angle);
@@ -41,11 +41,17 @@
 #define BFRectToCGRect(rect) CGRectMake(rect.left, rect.bottom, rect.right - rect.left, rect.top - rect.bottom)
 #define BFRectFromCGRect(rect) (BFRect){ .left = rect.origin.x, .bottom = rect.origin.y, .right = rect.origin.x + rect.size.width, .top = rect.origin.y + rect.size.height }
 
+// BFBitmapPool
+
+CGContextRef BFBitmapGetCGContext(BFBitmapRef bitmap);
+
 // BFCanvas
 
 BFCanvasRef BFCanvasCreateForDisplay(CGContextRef context, BFCanvasMetricsRef metrics);
 
 CGContextRef BFCanvasGetCGContext(BFCanvasRef canvas);
+// Call after drawing into the canvas's context directly, so images cached from it (like an icon's) are made again.
+void BFCanvasNoteChanged(BFCanvasRef canvas);
 
 // BFColorPaint
 
@@ -71,6 +77,7 @@ void BFPaintFillRectInContext(BFPaintRef paint, CGContextRef context, CGRect rec
 // BFPaintMode
 
 CGBlendMode BFPaintModeCGBlendMode(BFPaintModeRef paintMode);
+CGBlendMode BFPaintModeTypeCGBlendMode(BFPaintModeType paintModeType);
 
 // BFPath
 